@@ -0,0 +1,208 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <string.h>
+
+#include "avi.h"
+
+/* AVIF_HASINDEX of the main header, AVIIF_KEYFRAME of the index entries */
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+static unsigned char *put32(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static unsigned char *put16(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static unsigned char *put4cc(unsigned char *p, const char *fourcc)
+{
+    memcpy(p, fourcc, 4);
+    return p + 4;
+}
+
+/******************************************************************************
+Description.: writes the header of an AVI file up to the start of the movi
+              list, the frames follow as chunks
+Input Value.: * buf...........: AVI_HEADER_LEN bytes
+              * width, height.: size of the pictures
+              * frames........: number of frames in the file
+              * usec_per_frame: average time between two frames
+              * movi_len......: length of all chunks written with avi_chunk()
+                                plus their data and padding
+              * index_len.....: length of the index entries
+Return Value: -
+******************************************************************************/
+void avi_header(unsigned char *buf, int width, int height, unsigned int frames, unsigned int usec_per_frame,
+                unsigned int movi_len, unsigned int index_len)
+{
+    unsigned char *p = buf;
+
+    p = put4cc(p, "RIFF");
+    p = put32(p, AVI_HEADER_LEN - 8 + movi_len + 8 + index_len);
+    p = put4cc(p, "AVI ");
+
+    p = put4cc(p, "LIST");
+    p = put32(p, 192);
+    p = put4cc(p, "hdrl");
+
+    /* main header */
+    p = put4cc(p, "avih");
+    p = put32(p, 56);
+    p = put32(p, usec_per_frame);
+    p = put32(p, 0);                        /* max bytes per second */
+    p = put32(p, 0);                        /* padding granularity */
+    p = put32(p, AVIF_HASINDEX);
+    p = put32(p, frames);
+    p = put32(p, 0);                        /* initial frames */
+    p = put32(p, 1);                        /* streams */
+    p = put32(p, 0);                        /* suggested buffer size */
+    p = put32(p, width);
+    p = put32(p, height);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = put4cc(p, "LIST");
+    p = put32(p, 116);
+    p = put4cc(p, "strl");
+
+    /* stream header, the rate is 1000000 / usec_per_frame */
+    p = put4cc(p, "strh");
+    p = put32(p, 56);
+    p = put4cc(p, "vids");
+    p = put4cc(p, "MJPG");
+    p = put32(p, 0);                        /* flags */
+    p = put16(p, 0);                        /* priority */
+    p = put16(p, 0);                        /* language */
+    p = put32(p, 0);                        /* initial frames */
+    p = put32(p, usec_per_frame);           /* scale */
+    p = put32(p, 1000000);                  /* rate */
+    p = put32(p, 0);                        /* start */
+    p = put32(p, frames);                   /* length */
+    p = put32(p, 0);                        /* suggested buffer size */
+    p = put32(p, 0xFFFFFFFF);               /* quality */
+    p = put32(p, 0);                        /* sample size */
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, width);
+    p = put16(p, height);
+
+    /* stream format, a BITMAPINFOHEADER */
+    p = put4cc(p, "strf");
+    p = put32(p, 40);
+    p = put32(p, 40);
+    p = put32(p, width);
+    p = put32(p, height);
+    p = put16(p, 1);                        /* planes */
+    p = put16(p, 24);                       /* bit count */
+    p = put4cc(p, "MJPG");
+    p = put32(p, width * height * 3);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = put4cc(p, "LIST");
+    p = put32(p, 4 + movi_len);
+    p = put4cc(p, "movi");
+}
+
+/******************************************************************************
+Description.: writes the header of the chunk of one frame
+Input Value.: * buf.: AVI_CHUNK_LEN bytes
+              * size: length of the JPEG, a chunk of odd length is followed
+                      by one byte of padding
+Return Value: -
+******************************************************************************/
+void avi_chunk(unsigned char *buf, unsigned int size)
+{
+    put32(put4cc(buf, "00dc"), size);
+}
+
+/******************************************************************************
+Description.: writes the header of the index, the entries follow
+Input Value.: * buf...: AVI_CHUNK_LEN bytes
+              * frames: number of index entries
+Return Value: -
+******************************************************************************/
+void avi_index_header(unsigned char *buf, unsigned int frames)
+{
+    put32(put4cc(buf, "idx1"), frames * AVI_INDEX_ENTRY_LEN);
+}
+
+/******************************************************************************
+Description.: writes the index entry of one frame
+Input Value.: * buf...: AVI_INDEX_ENTRY_LEN bytes
+              * offset: position of its chunk, counted from the "movi" fourcc
+              * size..: length of the JPEG
+Return Value: -
+******************************************************************************/
+void avi_index_entry(unsigned char *buf, unsigned int offset, unsigned int size)
+{
+    put32(put32(put32(put4cc(buf, "00dc"), AVIIF_KEYFRAME), offset), size);
+}
+
+/******************************************************************************
+Description.: finds the picture size in the frame header of a JPEG
+Input Value.: * jpeg.........: the frame
+              * len..........: its length
+              * width, height: store the size
+Return Value: 0 if the size was found, -1 otherwise
+******************************************************************************/
+int avi_jpeg_size(const unsigned char *jpeg, size_t len, int *width, int *height)
+{
+    size_t i = 2;
+    int marker;
+
+    if(len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        return -1;
+
+    while(i + 9 <= len && jpeg[i] == 0xFF) {
+        marker = jpeg[i + 1];
+        if(marker == 0xFF) {
+            i++;
+            continue;
+        }
+
+        /* any SOF but DHT, JPG and DAC */
+        if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            *height = jpeg[i + 5] << 8 | jpeg[i + 6];
+            *width = jpeg[i + 7] << 8 | jpeg[i + 8];
+            return 0;
+        }
+        if(marker == 0xDA)
+            break;
+
+        i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3]);
+    }
+
+    return -1;
+}
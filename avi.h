@@ -0,0 +1,52 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef AVI_H
+#define AVI_H
+
+#include <stddef.h>
+
+/*
+ * MJPEG in AVI without re-encoding: the JPEG frames become "00dc" chunks
+ * of a single video stream and the file ends with an idx1 index, so
+ * players can seek. The header has a fixed length, its sizes and frame
+ * count are known once all frames are written or counted.
+ */
+#define AVI_HEADER_LEN 224
+#define AVI_CHUNK_LEN 8
+#define AVI_INDEX_ENTRY_LEN 16
+
+/* movi chunks start at an even offset */
+static inline unsigned int avi_padded(unsigned int size)
+{
+    return size + (size & 1);
+}
+
+void avi_header(unsigned char *buf, int width, int height, unsigned int frames, unsigned int usec_per_frame,
+                unsigned int movi_len, unsigned int index_len);
+void avi_chunk(unsigned char *buf, unsigned int size);
+void avi_index_header(unsigned char *buf, unsigned int frames);
+void avi_index_entry(unsigned char *buf, unsigned int offset, unsigned int size);
+int avi_jpeg_size(const unsigned char *jpeg, size_t len, int *width, int *height);
+
+#endif
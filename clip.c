@@ -0,0 +1,192 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "avi.h"
+#include "playback.h"
+#include "clip.h"
+
+/******************************************************************************
+Description.: appends a frame to the clip
+Input Value.: * c..: the clip
+              * cf.: the frame
+Return Value: 0 on success, -1 if the clip gets too large or there is not
+              enough memory
+******************************************************************************/
+static int add_frame(clip *c, clip_frame *cf)
+{
+    clip_frame *frames;
+
+    if(AVI_HEADER_LEN + c->movi_len + AVI_CHUNK_LEN + avi_padded(cf->size) +
+       AVI_CHUNK_LEN + (c->count + 1) * AVI_INDEX_ENTRY_LEN > CLIP_MAX_BYTES)
+        return -1;
+
+    if(c->count == c->room) {
+        if((frames = mem_realloc(c->frames, (c->room + 256) * sizeof(clip_frame))) == NULL)
+            return -1;
+        c->frames = frames;
+        c->room += 256;
+    }
+
+    c->frames[c->count++] = *cf;
+    c->movi_len += AVI_CHUNK_LEN + avi_padded(cf->size);
+    return 0;
+}
+
+/******************************************************************************
+Description.: collects the frames of the history captured within a time
+              range. Only their indexes are kept, each frame is pinned
+              again with timeshift_at() when it gets sent and may have been
+              replaced by then.
+Input Value.: * c......: the clip, initialized with zeros
+              * history: the history of the input
+              * start..: capture time of the first frame in us
+              * end....: capture time the clip ends at in us
+Return Value: 0 on success, -1 if the clip is too large
+******************************************************************************/
+int clip_from_history(clip *c, timeshift *history, long long start, long long end)
+{
+    timeshift_frame *f, *next;
+    clip_frame cf = { .file = -1 };
+
+    c->history = history;
+
+    for(f = timeshift_by_time(history, start, 0); f != NULL; f = next) {
+        cf.usec = timeshift_usec(&f->timestamp);
+        if(cf.usec > end) {
+            timeshift_release(f);
+            break;
+        }
+
+        cf.size = f->size;
+        cf.seq = f->source_seq;
+        cf.index = f->index;
+        if(add_frame(c, &cf) < 0) {
+            timeshift_release(f);
+            return -1;
+        }
+
+        if(c->count == 1 && avi_jpeg_size(timeshift_data(history, f), f->size, &c->width, &c->height) < 0)
+            c->width = c->height = 0;
+
+        next = timeshift_at(history, f->index + 1);
+        timeshift_release(f);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: collects the recorded frames within a time range, the files
+              they are in are kept open until the clip gets freed
+Input Value.: * c....: the clip, initialized with zeros
+              * start: wall clock time of the first frame in us
+              * end..: wall clock time the clip ends at in us
+Return Value: 0 on success, -1 if the clip is too large or spans too many files
+******************************************************************************/
+int clip_from_recordings(clip *c, long long start, long long end)
+{
+    playback_file pf = { .fd = -1 }, next;
+    unsigned char head[4096];
+    clip_frame cf = { .index = 0 };
+    recorder_index_entry *e;
+    unsigned int index;
+    int rc = 0;
+
+    if(recorder_cfg.folder == NULL || playback_seek(&pf, start, &index) < 0)
+        return 0;
+
+    while(rc == 0) {
+        if(index < pf.count && pf.index[index].usec <= end) {
+            /* the file is taken over by the clip with its first frame */
+            if(c->file_count == 0 || c->files[c->file_count - 1] != pf.fd) {
+                if(c->file_count == CLIP_MAX_FILES) {
+                    rc = -1;
+                    break;
+                }
+                c->files[c->file_count++] = pf.fd;
+            }
+
+            e = &pf.index[index++];
+            cf.usec = e->usec;
+            cf.size = e->size;
+            cf.seq = e->seq;
+            cf.file = c->file_count - 1;
+            cf.offset = e->offset;
+            rc = add_frame(c, &cf);
+
+            if(c->count == 1 && (pread(pf.fd, head, MIN(sizeof(head), e->size), e->offset) <= 0 ||
+                                 avi_jpeg_size(head, MIN(sizeof(head), e->size), &c->width, &c->height) < 0))
+                c->width = c->height = 0;
+            continue;
+        }
+
+        if(index < pf.count || playback_neighbour(pf.name, 1, &next) < 0)
+            break;
+
+        if(c->file_count > 0 && c->files[c->file_count - 1] == pf.fd)
+            pf.fd = -1;
+        playback_close(&pf);
+        pf = next;
+        index = 0;
+    }
+
+    if(c->file_count > 0 && c->files[c->file_count - 1] == pf.fd)
+        pf.fd = -1;
+    playback_close(&pf);
+
+    return rc;
+}
+
+/******************************************************************************
+Description.: releases the files of a clip
+Input Value.: the clip
+Return Value: -
+******************************************************************************/
+void clip_free(clip *c)
+{
+    int k;
+
+    for(k = 0; k < c->file_count; k++)
+        close(c->files[k]);
+    mem_free(c->frames);
+
+    memset(c, 0, sizeof(*c));
+}
+
+/******************************************************************************
+Description.: length of the AVI file of a clip
+Input Value.: the clip
+Return Value: bytes
+******************************************************************************/
+unsigned long long clip_length(clip *c)
+{
+    return AVI_HEADER_LEN + c->movi_len + AVI_CHUNK_LEN + (unsigned long long)c->count * AVI_INDEX_ENTRY_LEN;
+}
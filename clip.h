@@ -0,0 +1,73 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef CLIP_H
+#define CLIP_H
+
+#include "timeshift.h"
+
+/*
+ * A clip is a range of frames of the timeshift history or of the
+ * recordings, sent as one MJPEG AVI file. All frames are looked up before
+ * the first byte goes out, so the header and the length of the answer are
+ * right from the start. The frames stay where they are: a frame of the
+ * history is pinned only while it is sent, so a slow client does not hold
+ * up the history, recorded frames are sent from their files.
+ */
+
+/* length of a clip if neither a duration nor both times are given */
+#define CLIP_DEFAULT_SECONDS 30
+#define CLIP_MAX_SECONDS 3600
+
+/* recorded files one clip may span */
+#define CLIP_MAX_FILES 256
+
+/* the AVI header counts in 32 bit, many players stop at 2 GB */
+#define CLIP_MAX_BYTES (2000ULL*1024*1024)
+
+typedef struct {
+    long long usec;             /* capture time in us since the epoch, as in X-Timestamp */
+    unsigned int size;
+    unsigned int seq;           /* X-Sequence */
+    unsigned int index;         /* history index of a frame of the history */
+    int file;                   /* file of a recorded frame */
+    unsigned int offset;        /* position of its JPEG data in the file */
+} clip_frame;
+
+typedef struct {
+    timeshift *history;         /* NULL for a clip of the recordings */
+    clip_frame *frames;
+    unsigned int count;
+    unsigned int room;          /* frames the array has room for */
+    int files[CLIP_MAX_FILES];
+    int file_count;
+    unsigned long long movi_len;    /* chunks of all frames with their padding */
+    int width, height;
+} clip;
+
+int clip_from_history(clip *c, timeshift *history, long long start, long long end);
+int clip_from_recordings(clip *c, long long start, long long end);
+void clip_free(clip *c);
+unsigned long long clip_length(clip *c);
+
+#endif
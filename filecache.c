@@ -0,0 +1,372 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "filecache.h"
+
+#define BUCKETS 64
+
+static char folder[PATH_MAX];
+static int enabled = 0;
+
+static file_entry *buckets[BUCKETS];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long cached_files = 0, cached_bytes = 0, hits = 0, misses = 0;
+
+/* counts invalidations, a file read meanwhile may already be outdated */
+static unsigned long generation = 0;
+
+static pthread_t watch_thread;
+static int watch_fd = -1;
+
+/******************************************************************************
+Description.: FNV-1a hash, used for the buckets and as ETag of the content
+Input Value.: data and its length
+Return Value: hash value
+******************************************************************************/
+static unsigned long long fnv1a(const unsigned char *data, size_t len)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+static int bucket_of(const char *name)
+{
+    return fnv1a((const unsigned char *)name, strlen(name)) % BUCKETS;
+}
+
+/******************************************************************************
+Description.: reads a complete file of the www folder into memory
+Input Value.: * name: filename relative to the www folder
+              * data: stores the allocated content
+              * size: stores the length of the content
+Return Value: 0 on success, -1 if the file is missing or too large
+******************************************************************************/
+static int read_file(const char *name, unsigned char **data, size_t *size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    size_t got = 0;
+    ssize_t rc;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s%s", folder, name);
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size > FILECACHE_MAX_FILE ||
+       (*data = mem_malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while(got < st.st_size && (rc = read(fd, *data + got, st.st_size - got)) > 0)
+        got += rc;
+    close(fd);
+
+    if(got != st.st_size) {
+        mem_free(*data);
+        return -1;
+    }
+
+    *size = got;
+    return 0;
+}
+
+/******************************************************************************
+Description.: loads a file and its .gz variant into a new entry
+Input Value.: filename relative to the www folder
+Return Value: the entry with one reference or NULL
+******************************************************************************/
+static file_entry *load_entry(const char *name)
+{
+    char gz_name[PATH_MAX];
+    file_entry *e;
+
+    if((e = mem_calloc(1, sizeof(file_entry))) == NULL)
+        return NULL;
+
+    if((e->name = mem_strdup(name)) == NULL || read_file(name, &e->data, &e->size) < 0) {
+        mem_free(e->name);
+        mem_free(e);
+        return NULL;
+    }
+    snprintf(e->etag, sizeof(e->etag), "\"%016llx\"", fnv1a(e->data, e->size));
+
+    snprintf(gz_name, sizeof(gz_name), "%s.gz", name);
+    if(read_file(gz_name, &e->gz_data, &e->gz_size) == 0)
+        snprintf(e->gz_etag, sizeof(e->gz_etag), "\"%016llx\"", fnv1a(e->gz_data, e->gz_size));
+
+    e->refs = 1;
+    return e;
+}
+
+static void free_entry(file_entry *e)
+{
+    mem_free(e->gz_data);
+    mem_free(e->data);
+    mem_free(e->name);
+    mem_free(e);
+}
+
+/******************************************************************************
+Description.: drops the reference of a cached file, the cache mutex must be held
+Input Value.: entry
+Return Value: -
+******************************************************************************/
+static void unref_locked(file_entry *e)
+{
+    if(--e->refs == 0)
+        free_entry(e);
+}
+
+/******************************************************************************
+Description.: removes a file from the cache, requests that still send it keep
+              their reference until they are done
+Input Value.: filename relative to the www folder, NULL drops all files
+Return Value: -
+******************************************************************************/
+static void invalidate(const char *name)
+{
+    file_entry **pe, *e;
+    int i;
+
+    pthread_mutex_lock(&cache_mutex);
+    generation++;
+    for(i = 0; i < BUCKETS; i++) {
+        if(name != NULL && i != bucket_of(name))
+            continue;
+
+        pe = &buckets[i];
+        while((e = *pe) != NULL) {
+            if(name != NULL && strcmp(e->name, name) != 0) {
+                pe = &e->next;
+                continue;
+            }
+
+            DBG("dropping %s from the file cache\n", e->name);
+            *pe = e->next;
+            cached_files--;
+            cached_bytes -= e->size + e->gz_size;
+            unref_locked(e);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/******************************************************************************
+Description.: waits for changes in the www folder and drops the affected files
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *watch_folder(void *arg)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char name[NAME_MAX + 1];
+    struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+    size_t l;
+
+    while((len = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+        for(p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)p;
+
+            if(ev->mask & IN_Q_OVERFLOW) {
+                invalidate(NULL);
+                continue;
+            }
+            if(ev->len == 0)
+                continue;
+
+            /* a changed variant belongs to the entry of the plain file */
+            strncpy(name, ev->name, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+            l = strlen(name);
+            if(l > 3 && strcmp(name + l - 3, ".gz") == 0)
+                name[l - 3] = '\0';
+
+            invalidate(name);
+        }
+    }
+
+    OPRINT("watching the www-folder failed, file cache disabled\n");
+    enabled = 0;
+    invalidate(NULL);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: looks up a file of the www folder, loads it on a cache miss
+Input Value.: filename relative to the www folder
+Return Value: the entry, it must be returned with filecache_put(). NULL if the
+              file does not exist or can not be cached, in that case the
+              caller has to read it from disk itself.
+******************************************************************************/
+file_entry *filecache_get(const char *name)
+{
+    file_entry *e, *loaded;
+    unsigned long gen;
+    int b;
+
+    /* only the folder itself is watched for changes */
+    if(!enabled || strchr(name, '/') != NULL)
+        return NULL;
+
+    b = bucket_of(name);
+
+    pthread_mutex_lock(&cache_mutex);
+    for(e = buckets[b]; e != NULL; e = e->next) {
+        if(strcmp(e->name, name) == 0) {
+            e->refs++;
+            hits++;
+            pthread_mutex_unlock(&cache_mutex);
+            return e;
+        }
+    }
+    misses++;
+    gen = generation;
+    pthread_mutex_unlock(&cache_mutex);
+
+    /* read the file without blocking other requests */
+    if((loaded = load_entry(name)) == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache_mutex);
+    for(e = buckets[b]; e != NULL; e = e->next) {
+        if(strcmp(e->name, name) == 0)
+            break;
+    }
+
+    if(e != NULL) {
+        /* another request was faster */
+        e->refs++;
+        free_entry(loaded);
+        loaded = e;
+    } else if(gen == generation && cached_bytes + loaded->size + loaded->gz_size <= FILECACHE_MAX_TOTAL) {
+        loaded->refs++;
+        loaded->next = buckets[b];
+        buckets[b] = loaded;
+        cached_files++;
+        cached_bytes += loaded->size + loaded->gz_size;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    return loaded;
+}
+
+/******************************************************************************
+Description.: returns an entry taken by filecache_get()
+Input Value.: entry
+Return Value: -
+******************************************************************************/
+void filecache_put(file_entry *entry)
+{
+    pthread_mutex_lock(&cache_mutex);
+    unref_locked(entry);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/******************************************************************************
+Description.: reports the state of the cache
+Input Value.: pointers to store the numbers at
+Return Value: -
+******************************************************************************/
+void filecache_stats(unsigned long *files, unsigned long *bytes, unsigned long *h, unsigned long *m)
+{
+    pthread_mutex_lock(&cache_mutex);
+    *files = cached_files;
+    *bytes = cached_bytes;
+    *h = hits;
+    *m = misses;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/******************************************************************************
+Description.: starts watching the www folder and loads all of its files, the
+              cache stays disabled if changes can not be watched
+Input Value.: the www folder, ending with a slash
+Return Value: 0 if the cache is enabled, -1 otherwise
+******************************************************************************/
+int filecache_init(const char *www_folder)
+{
+    struct dirent *de;
+    file_entry *e;
+    DIR *dir;
+    size_t l;
+
+    strncpy(folder, www_folder, sizeof(folder) - 1);
+
+    if((watch_fd = inotify_init()) < 0 ||
+       inotify_add_watch(watch_fd, folder, IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                         IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        OPRINT("can not watch the www-folder, file cache disabled\n");
+        if(watch_fd >= 0)
+            close(watch_fd);
+        return -1;
+    }
+
+    enabled = 1;
+    if(pthread_create(&watch_thread, NULL, watch_folder, NULL) != 0) {
+        enabled = 0;
+        close(watch_fd);
+        return -1;
+    }
+    pthread_detach(watch_thread);
+
+    /* warm up the cache, variants are loaded along with their plain files */
+    if((dir = opendir(folder)) != NULL) {
+        while((de = readdir(dir)) != NULL) {
+            l = strlen(de->d_name);
+            if(de->d_name[0] == '.' || (l > 3 && strcmp(de->d_name + l - 3, ".gz") == 0))
+                continue;
+            if((e = filecache_get(de->d_name)) != NULL)
+                filecache_put(e);
+        }
+        closedir(dir);
+    }
+
+    OPRINT("file cache........: %lu files, %lu bytes\n", cached_files, cached_bytes);
+    return 0;
+}
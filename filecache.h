@@ -0,0 +1,64 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stddef.h>
+
+/*
+ * files of the www folder are kept in memory up to these limits, larger
+ * files and files in subfolders are read from disk for every request
+ */
+#define FILECACHE_MAX_FILE (1024*1024)
+#define FILECACHE_MAX_TOTAL (16*1024*1024)
+
+/* quoted hex string of the 64 bit content hash */
+#define FILECACHE_ETAG_LEN 24
+
+/*
+ * One cached file of the www folder together with its precompressed
+ * "<name>.gz" variant, if there is one. Entries are refcounted, a changed
+ * file gets a new entry while requests still send the old one.
+ */
+typedef struct _file_entry file_entry;
+struct _file_entry {
+    file_entry *next;           /* next entry of the same hash bucket */
+    int refs;                   /* the cache itself holds one reference */
+    char *name;                 /* filename relative to the www folder */
+
+    unsigned char *data;
+    size_t size;
+    char etag[FILECACHE_ETAG_LEN];
+
+    unsigned char *gz_data;     /* NULL if there is no .gz variant */
+    size_t gz_size;
+    char gz_etag[FILECACHE_ETAG_LEN];
+};
+
+int filecache_init(const char *folder);
+file_entry *filecache_get(const char *name);
+void filecache_put(file_entry *entry);
+void filecache_stats(unsigned long *files, unsigned long *bytes, unsigned long *hits, unsigned long *misses);
+
+#endif
@@ -0,0 +1,606 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "frame.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define INC(p) __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+
+int frame_owner = 0;
+
+/* wall clock minus monotonic clock in us, taken once by frame_clock_init() */
+static long long clock_offset = 0;
+
+/******************************************************************************
+Description.: thin wrappers around the futex syscall, the words may live in
+              memory shared between processes so the non-private ops are used
+Input Value.: futex word, expected value and timeout in ms (<0 waits forever)
+Return Value: 0 if woken up, -1 with errno set otherwise
+******************************************************************************/
+static int futex_wait(unsigned int *uaddr, unsigned int val, int timeout_ms)
+{
+    struct timespec ts, *pts = NULL;
+
+    if(timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        pts = &ts;
+    }
+
+    return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, pts, NULL, 0);
+}
+
+static int futex_wake(unsigned int *uaddr)
+{
+    return syscall(SYS_futex, uaddr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/******************************************************************************
+Description.: maps memory that forked processes share. A POSIX shared memory
+              object is used and unlinked right away, so it vanishes with the
+              last process using it.
+Input Value.: size of the mapping
+Return Value: the mapping or MAP_FAILED
+******************************************************************************/
+static void *map_shared(size_t mapsize)
+{
+    static int count = 0;
+    char name[64];
+    void *map;
+    int fd;
+
+    snprintf(name, sizeof(name), "/uvcstreamer-%d-%d", (int)getpid(), count++);
+    if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return MAP_FAILED;
+    shm_unlink(name);
+
+    if(ftruncate(fd, mapsize) < 0) {
+        close(fd);
+        return MAP_FAILED;
+    }
+
+    map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map;
+}
+
+/******************************************************************************
+Description.: maps zeroed memory for a ring or another structure the readers
+              of the frames use
+Input Value.: * mapsize: size of the mapping
+              * shared.: 1 if forked worker processes use it as well
+Return Value: the mapping or MAP_FAILED
+******************************************************************************/
+void *frame_map(size_t mapsize, int shared)
+{
+    if(shared)
+        return map_shared(mapsize);
+
+    return mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+/******************************************************************************
+Description.: allocates the ring with all its slots as one mapping
+Input Value.: * slot_count: number of slots
+              * capacity..: size of the data area of each slot
+              * shared....: 1 if forked worker processes read from the ring
+Return Value: the ring or NULL in case of error
+******************************************************************************/
+frame_ring *frame_ring_create(int slot_count, size_t capacity, int shared)
+{
+    frame_ring *ring;
+    size_t header, mapsize;
+    int i;
+
+    if(slot_count < 2)
+        slot_count = 2;
+
+    /* keep every data area cache line aligned */
+    capacity = (capacity + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+    header = sizeof(frame_ring) + slot_count * sizeof(frame_slot);
+    header = (header + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+    mapsize = header + slot_count * capacity;
+
+    if((ring = frame_map(mapsize, shared)) == MAP_FAILED)
+        return NULL;
+
+    /* both kinds of mappings are already zeroed */
+    ring->pub.latest = -1;
+    ring->slot_count = slot_count;
+    ring->capacity = capacity;
+    ring->mapsize = mapsize;
+
+    for(i = 0; i < slot_count; i++)
+        ring->slots[i].offset = header + i * capacity;
+
+    return ring;
+}
+
+/******************************************************************************
+Description.: releases the memory of the ring, no reader may use it anymore
+Input Value.: ring
+Return Value: -
+******************************************************************************/
+void frame_ring_destroy(frame_ring *ring)
+{
+    if(ring != NULL)
+        munmap(ring, ring->mapsize);
+}
+
+/******************************************************************************
+Description.: tells whether any reader pins a slot
+Input Value.: slot
+Return Value: 1 if pinned, 0 otherwise
+******************************************************************************/
+static int is_pinned(frame_slot *slot)
+{
+    int i;
+
+    for(i = 0; i < FRAME_MAX_OWNERS; i++) {
+        if(LOAD(&slot->pins[i]) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: picks a slot the capture thread can write the next frame to.
+              Slots pinned by readers and the latest frame are skipped, if
+              there is no such slot the frame must be dropped.
+Input Value.: ring
+Return Value: slot to write to or NULL
+******************************************************************************/
+frame_slot *frame_begin(frame_ring *ring)
+{
+    int i, idx, latest = LOAD(&ring->pub.latest);
+
+    for(i = 0; i < ring->slot_count; i++) {
+        idx = (ring->prod.cursor + i) % ring->slot_count;
+        if(idx == latest || is_pinned(&ring->slots[idx]))
+            continue;
+
+        STORE(&ring->slots[idx].seq, 0);
+        ring->slots[idx].source_seq = 0;
+        ring->prod.cursor = (idx + 1) % ring->slot_count;
+        return &ring->slots[idx];
+    }
+
+    ring->prod.dropped++;
+    return NULL;
+}
+
+/******************************************************************************
+Description.: makes a completely written slot the latest frame and wakes up
+              the waiting readers, only shards with sleeping readers are
+              touched
+Input Value.: ring and the slot returned by frame_begin()
+Return Value: -
+******************************************************************************/
+void frame_publish(frame_ring *ring, frame_slot *slot)
+{
+    unsigned int seq;
+    int i;
+
+    /* 0 marks a slot under construction, so skip it on wrap around */
+    if(++ring->prod.next_seq == 0)
+        ring->prod.next_seq = 1;
+    seq = ring->prod.next_seq;
+
+    if(slot->source_seq == 0)
+        slot->source_seq = seq;
+    slot->timestamp = frame_wallclock(slot->timestamp);
+
+    STORE(&slot->seq, seq);
+    STORE(&ring->pub.latest, (int)(slot - ring->slots));
+    STORE(&ring->pub.seq, seq);
+    ring->prod.published++;
+
+    /*
+     * a reader announces itself in waiters before it checks pub.seq, so a
+     * shard seen without waiters has none that could miss this frame
+     */
+    for(i = 0; i < FRAME_WAIT_SHARDS; i++) {
+        if(LOAD(&ring->wq[i].waiters) == 0)
+            continue;
+        INC(&ring->wq[i].gen);
+        futex_wake(&ring->wq[i].gen);
+    }
+}
+
+/******************************************************************************
+Description.: sequence number of the latest published frame
+Input Value.: ring
+Return Value: sequence number, 0 if nothing was published yet
+******************************************************************************/
+unsigned int frame_seq(frame_ring *ring)
+{
+    return LOAD(&ring->pub.seq);
+}
+
+/******************************************************************************
+Description.: pins the latest slot, the producer skips pinned slots
+Input Value.: ring
+Return Value: pinned slot or NULL if nothing was published yet
+******************************************************************************/
+static frame_slot *pin_latest(frame_ring *ring)
+{
+    frame_slot *slot;
+    int idx;
+
+    for(;;) {
+        if((idx = LOAD(&ring->pub.latest)) < 0)
+            return NULL;
+
+        slot = &ring->slots[idx];
+        INC(&slot->pins[frame_owner]);
+
+        /*
+         * the producer may have picked this slot before we pinned it, but it
+         * never picks the latest one, so a slot that is still the latest
+         * after pinning stays untouched until frame_release()
+         */
+        if(LOAD(&ring->pub.latest) == idx && LOAD(&slot->seq) != 0)
+            return slot;
+
+        DEC(&slot->pins[frame_owner]);
+    }
+}
+
+/******************************************************************************
+Description.: waits for a frame newer than last_seq and pins it
+Input Value.: * ring......: ring to read from
+              * last_seq..: sequence number of the frame the reader already has
+              * shard.....: any number, readers are spread over the wait queues
+              * timeout_ms: maximum time to wait, <0 waits forever
+Return Value: pinned slot or NULL in case of timeout, must be released with
+              frame_release()
+******************************************************************************/
+frame_slot *frame_acquire(frame_ring *ring, unsigned int last_seq, int shard, int timeout_ms)
+{
+    frame_waitq *wq = &ring->wq[(unsigned int)shard % FRAME_WAIT_SHARDS];
+    frame_slot *slot;
+    unsigned int gen;
+    int rc = 0;
+
+    for(;;) {
+        if(LOAD(&ring->pub.seq) != last_seq && (slot = pin_latest(ring)) != NULL) {
+            if(slot->seq != last_seq)
+                return slot;
+            frame_release(slot);
+        }
+
+        if(rc < 0 && errno == ETIMEDOUT)
+            return NULL;
+
+        gen = LOAD(&wq->gen);
+        INC(&wq->waiters);
+        if(LOAD(&ring->pub.seq) == last_seq)
+            rc = futex_wait(&wq->gen, gen, timeout_ms);
+        DEC(&wq->waiters);
+    }
+}
+
+/******************************************************************************
+Description.: unpins a slot returned by frame_acquire()
+Input Value.: slot
+Return Value: -
+******************************************************************************/
+void frame_release(frame_slot *slot)
+{
+    DEC(&slot->pins[frame_owner]);
+}
+
+/******************************************************************************
+Description.: maps a requested rate to its counter
+Input Value.: frames per second, 0 or less for all frames
+Return Value: index into the demand counters
+******************************************************************************/
+static int demand_index(int fps)
+{
+    return (fps <= 0 || fps > FRAME_DEMAND_MAX) ? 0 : fps;
+}
+
+/******************************************************************************
+Description.: fixes the offset between the monotonic clock and the wall
+              clock, before the worker processes get forked so they all use
+              the same one. A fixed offset keeps the frame times steady when
+              the wall clock gets set.
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void frame_clock_init(void)
+{
+    struct timespec mono, real;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_offset = ((long long)real.tv_sec - mono.tv_sec) * 1000000 + (real.tv_nsec - mono.tv_nsec) / 1000;
+}
+
+/******************************************************************************
+Description.: the current time in the clock of the frame timestamps
+Input Value.: -
+Return Value: time in us since the epoch
+******************************************************************************/
+long long frame_clock_now(void)
+{
+    struct timespec mono;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return (long long)mono.tv_sec * 1000000 + mono.tv_nsec / 1000 + clock_offset;
+}
+
+/******************************************************************************
+Description.: converts a capture time to the clock of the frame timestamps.
+              V4L2 drivers stamp the frames with the monotonic clock, an
+              upstream server sends wall clock times, the clock closer to
+              the capture time is taken.
+Input Value.: capture time
+Return Value: the capture time in us since the epoch as a timeval
+******************************************************************************/
+struct timeval frame_wallclock(struct timeval capture)
+{
+    long long c = (long long)capture.tv_sec * 1000000 + capture.tv_usec, now = frame_clock_now();
+    struct timeval wall;
+
+    if(llabs(c - (now - clock_offset)) < llabs(c - now))
+        c += clock_offset;
+
+    wall.tv_sec = c / 1000000;
+    wall.tv_usec = c % 1000000;
+    return wall;
+}
+
+static long monotonic_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/******************************************************************************
+Description.: registers or unregisters a consumer of the frames, the capture
+              thread adapts the camera frame rate to the fastest one
+Input Value.: * ring..: the ring the consumer reads from
+              * fps...: frames per second it needs, 0 for all frames
+              * delta.: 1 when the consumer starts, -1 when it stops
+Return Value: -
+******************************************************************************/
+void frame_demand_add(frame_ring *ring, int fps, int delta)
+{
+    __atomic_add_fetch(&ring->demand.streams[frame_owner][demand_index(fps)], delta, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+Description.: notes a snapshot, their clients poll at an unknown rate so the
+              camera stays at its full rate for a while
+Input Value.: ring the snapshot was taken from
+Return Value: -
+******************************************************************************/
+void frame_demand_snapshot(frame_ring *ring)
+{
+    long now = monotonic_seconds();
+
+    /* the same second is written by most snapshots, skip the store then */
+    if(LOAD(&ring->demand.snapshot) != now)
+        STORE(&ring->demand.snapshot, now);
+}
+
+/******************************************************************************
+Description.: determines the frame rate the consumers need right now
+Input Value.: * ring.....: the ring
+              * full_fps.: rate that delivers all frames
+Return Value: the fastest requested rate, at most full_fps, or 0 if nobody
+              is reading
+******************************************************************************/
+int frame_demand(frame_ring *ring, int full_fps)
+{
+    long snapshot = LOAD(&ring->demand.snapshot);
+    int fps, owner, max = 0;
+
+    if(snapshot != 0 && monotonic_seconds() - snapshot < FRAME_SNAPSHOT_HOLD)
+        return full_fps;
+
+    for(owner = 0; owner < FRAME_MAX_OWNERS; owner++) {
+        if(LOAD(&ring->demand.streams[owner][0]) > 0)
+            return full_fps;
+
+        for(fps = FRAME_DEMAND_MAX; fps > max; fps--) {
+            if(LOAD(&ring->demand.streams[owner][fps]) > 0) {
+                max = fps;
+                break;
+            }
+        }
+    }
+
+    return (max < full_fps) ? max : full_fps;
+}
+
+/******************************************************************************
+Description.: registers or unregisters a client that is served from the ring,
+              with --stop the camera only runs while there are any
+Input Value.: * ring..: the ring
+              * delta.: 1 when serving starts, -1 when it is done
+Return Value: -
+******************************************************************************/
+void frame_consumer_add(frame_ring *ring, int delta)
+{
+    __atomic_add_fetch(&ring->demand.consumers[frame_owner], delta, __ATOMIC_SEQ_CST);
+
+    if(delta > 0) {
+        INC(&ring->demand.consumers_gen);
+        futex_wake(&ring->demand.consumers_gen);
+    }
+}
+
+/******************************************************************************
+Description.: counts the clients of all processes that are served right now
+Input Value.: ring
+Return Value: number of consumers
+******************************************************************************/
+int frame_consumers(frame_ring *ring)
+{
+    int owner, count = 0;
+
+    for(owner = 0; owner < FRAME_MAX_OWNERS; owner++)
+        count += LOAD(&ring->demand.consumers[owner]);
+
+    return count;
+}
+
+/******************************************************************************
+Description.: waits until a consumer arrives
+Input Value.: * ring......: the ring
+              * timeout_ms: maximum time to wait, <0 waits forever
+Return Value: -
+******************************************************************************/
+void frame_wait_consumers(frame_ring *ring, int timeout_ms)
+{
+    unsigned int gen = LOAD(&ring->demand.consumers_gen);
+
+    if(frame_consumers(ring) == 0)
+        futex_wait(&ring->demand.consumers_gen, gen, timeout_ms);
+}
+
+/******************************************************************************
+Description.: drops everything a process counted, used after a worker process
+              died. The process must be gone, it must not touch the ring anymore.
+Input Value.: * ring.: the ring
+              * owner: owner number of the process
+Return Value: -
+******************************************************************************/
+void frame_owner_reset(frame_ring *ring, int owner)
+{
+    int i;
+
+    if(owner <= 0 || owner >= FRAME_MAX_OWNERS)
+        return;
+
+    for(i = 0; i < ring->slot_count; i++)
+        STORE(&ring->slots[i].pins[owner], 0);
+
+    for(i = 0; i <= FRAME_DEMAND_MAX; i++)
+        STORE(&ring->demand.streams[owner][i], 0);
+
+    STORE(&ring->demand.consumers[owner], 0);
+}
+
+/******************************************************************************
+Description.: adds an event to the log of the ring and wakes up the readers.
+              Any thread of any process using the ring may post.
+Input Value.: * ring: the ring of the input the event belongs to
+              * type: name of the event, shorter than FRAME_EVENT_TYPE
+              * fmt.: printf format of the JSON data, followed by its values
+Return Value: -
+******************************************************************************/
+void frame_event_post(frame_ring *ring, const char *type, const char *fmt, ...)
+{
+    frame_event *e;
+    unsigned int id;
+    va_list ap;
+
+    if(ring == NULL)
+        return;
+
+    /* 0 marks an entry under construction, so skip it on wrap around */
+    while((id = INC(&ring->events.last_id)) == 0)
+        ;
+
+    e = &ring->events.log[id % FRAME_EVENTS];
+    STORE(&e->id, 0);
+    snprintf(e->type, sizeof(e->type), "%s", type);
+    va_start(ap, fmt);
+    vsnprintf(e->data, sizeof(e->data), fmt, ap);
+    va_end(ap);
+    STORE(&e->id, id);
+
+    INC(&ring->events.gen);
+    if(LOAD(&ring->events.waiters) > 0)
+        futex_wake(&ring->events.gen);
+}
+
+/******************************************************************************
+Description.: id of the newest event
+Input Value.: ring
+Return Value: id, 0 if nothing was posted yet
+******************************************************************************/
+unsigned int frame_event_last(frame_ring *ring)
+{
+    return LOAD(&ring->events.last_id);
+}
+
+/******************************************************************************
+Description.: waits for an event and copies it
+Input Value.: * ring......: the ring
+              * id........: id of the wanted event, usually the last one the
+                            reader got plus one
+              * ev........: stores the event
+              * timeout_ms: maximum time to wait, <0 waits forever
+Return Value: 0 if the event was copied, 1 in case of timeout, -1 if it was
+              already overwritten by newer events
+******************************************************************************/
+int frame_event_get(frame_ring *ring, unsigned int id, frame_event *ev, int timeout_ms)
+{
+    frame_event *e = &ring->events.log[id % FRAME_EVENTS];
+    unsigned int gen, last;
+    int rc = 0;
+
+    for(;;) {
+        gen = LOAD(&ring->events.gen);
+        last = LOAD(&ring->events.last_id);
+
+        if((int)(last - id) >= FRAME_EVENTS)
+            return -1;
+
+        /* the id may be taken while the entry is still written */
+        if((int)(last - id) >= 0 && LOAD(&e->id) == id) {
+            memcpy(ev, e, sizeof(*ev));
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            return (LOAD(&e->id) == id) ? 0 : -1;
+        }
+
+        if(rc < 0 && errno == ETIMEDOUT)
+            return 1;
+
+        INC(&ring->events.waiters);
+        rc = futex_wait(&ring->events.gen, gen, timeout_ms);
+        DEC(&ring->events.waiters);
+    }
+}
@@ -0,0 +1,186 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+
+/*
+ * waiting clients are spread over several futex words, so a new frame does
+ * not wake all of them through a single word
+ */
+#define FRAME_WAIT_SHARDS 4
+
+/*
+ * consumers tell the capture thread how many frames per second they need,
+ * rates above this limit count as "all frames"
+ */
+#define FRAME_DEMAND_MAX 60
+
+/* a snapshot keeps the camera at its full rate for this many seconds */
+#define FRAME_SNAPSHOT_HOLD 5
+
+/*
+ * Processes using a ring, the capture process is owner 0 and every HTTP
+ * worker process has its own number. Pins and demand are counted per
+ * owner, so the counts of a crashed process can be dropped.
+ */
+#define FRAME_MAX_OWNERS 17
+
+/* owner number of this process */
+extern int frame_owner;
+
+/*
+ * status changes of an input (controls, resolution, frame rate, clients,
+ * errors) are kept in a small log of events, readers that fall behind by
+ * more than FRAME_EVENTS events lose the oldest ones
+ */
+#define FRAME_EVENTS 64
+#define FRAME_EVENT_TYPE 12
+#define FRAME_EVENT_DATA 112
+
+typedef struct _frame_event frame_event;
+struct _frame_event {
+    unsigned int id;                /* 0 while the entry gets written */
+    char type[FRAME_EVENT_TYPE];    /* e.g. "control" */
+    char data[FRAME_EVENT_DATA];    /* JSON object */
+};
+
+/*
+ * A frame slot holds one published JPG frame.
+ * The capture thread only writes to slots which are neither the latest
+ * frame nor pinned by a reader, so readers never see a frame change under
+ * their feet and the producer never waits for a reader.
+ */
+typedef struct _frame_slot frame_slot;
+struct _frame_slot {
+    unsigned int seq;           /* sequence number of the frame, 0 while the slot gets written */
+    int size;                   /* used bytes of the data area */
+    struct timeval timestamp;   /* capture time on the wall clock, see frame_clock_init() */
+    unsigned int source_seq;    /* sequence number given by an upstream server, else the same as seq */
+    size_t offset;              /* start of the data area, counted from the start of the ring */
+    int pins[FRAME_MAX_OWNERS]; /* readers of each owner that currently pin this slot */
+} CACHE_ALIGNED;
+
+typedef struct _frame_waitq frame_waitq;
+struct _frame_waitq {
+    unsigned int gen;           /* futex word, incremented for frames published while readers sleep */
+    int waiters;                /* number of sleeping readers, the producer skips shards without */
+} CACHE_ALIGNED;
+
+/*
+ * The ring is a single mapping: this header, the slot descriptors and the
+ * data areas. Fields written by the producer and by the readers sit on
+ * separate cache lines.
+ */
+typedef struct _frame_ring frame_ring;
+struct _frame_ring {
+    /* read by every reader, written once per frame */
+    struct {
+        int latest;             /* index of the most recent slot, -1 if nothing was published yet */
+        unsigned int seq;       /* sequence number of that frame */
+    } pub CACHE_ALIGNED;
+
+    frame_waitq wq[FRAME_WAIT_SHARDS];
+
+    /* only touched by the capture thread */
+    struct {
+        unsigned int next_seq;
+        int cursor;
+        unsigned long published;
+        unsigned long dropped;
+    } prod CACHE_ALIGNED;
+
+    /*
+     * written by the consumers, read by the capture thread once in a while,
+     * like everything else in the ring they only hold plain numbers
+     */
+    struct {
+        int streams[FRAME_MAX_OWNERS][FRAME_DEMAND_MAX + 1];   /* active streams by requested fps, 0 for all frames */
+        int consumers[FRAME_MAX_OWNERS];    /* clients being served right now */
+        unsigned int consumers_gen;         /* futex word, incremented when a consumer arrives */
+        long snapshot;                      /* monotonic second of the last snapshot */
+        int fps;                            /* rate the camera currently runs at */
+    } demand CACHE_ALIGNED;
+
+    /* written by every thread that changes the input, read by event streams */
+    struct {
+        unsigned int last_id;               /* id of the newest event, ids start at 1 */
+        unsigned int gen;                   /* futex word, incremented for every event */
+        int waiters;
+        frame_event log[FRAME_EVENTS];
+    } events CACHE_ALIGNED;
+
+    /* constant after frame_ring_create() */
+    int slot_count;
+    size_t capacity;
+    size_t mapsize;
+
+    frame_slot slots[];
+};
+
+void frame_clock_init(void);
+long long frame_clock_now(void);
+struct timeval frame_wallclock(struct timeval capture);
+
+void *frame_map(size_t mapsize, int shared);
+frame_ring *frame_ring_create(int slot_count, size_t capacity, int shared);
+void frame_ring_destroy(frame_ring *ring);
+
+frame_slot *frame_begin(frame_ring *ring);
+void frame_publish(frame_ring *ring, frame_slot *slot);
+
+unsigned int frame_seq(frame_ring *ring);
+frame_slot *frame_acquire(frame_ring *ring, unsigned int last_seq, int shard, int timeout_ms);
+void frame_release(frame_slot *slot);
+
+void frame_demand_add(frame_ring *ring, int fps, int delta);
+void frame_demand_snapshot(frame_ring *ring);
+int frame_demand(frame_ring *ring, int full_fps);
+
+void frame_consumer_add(frame_ring *ring, int delta);
+int frame_consumers(frame_ring *ring);
+void frame_wait_consumers(frame_ring *ring, int timeout_ms);
+
+void frame_owner_reset(frame_ring *ring, int owner);
+
+void frame_event_post(frame_ring *ring, const char *type, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+unsigned int frame_event_last(frame_ring *ring);
+int frame_event_get(frame_ring *ring, unsigned int id, frame_event *ev, int timeout_ms);
+
+/******************************************************************************
+Description.: returns the data area of a slot
+Input Value.: ring and one of its slots
+Return Value: pointer to the JPG data
+******************************************************************************/
+static inline unsigned char *frame_data(frame_ring *ring, frame_slot *slot)
+{
+    return (unsigned char *)ring + slot->offset;
+}
+
+#endif
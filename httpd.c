@@ -22,20 +22,26 @@
 *******************************************************************************/
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <syslog.h>
 #include <netdb.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <linux/videodev2.h>
 #include <linux/version.h>
 #include <getopt.h>
@@ -44,6 +50,13 @@
 #include "uvcstreamer.h"
 #include "utils.h"
 #include "httpd.h"
+#include "filecache.h"
+#include "worker.h"
+#include "websocket.h"
+#include "multicast.h"
+#include "playback.h"
+#include "avi.h"
+#include "clip.h"
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,32)
 #define V4L2_CTRL_TYPE_STRING_SUPPORTED
@@ -63,12 +76,34 @@ context server = {
         .port = 8080,
         .auth = NULL,
         .www_folder = "./www/",
-        .control = false
+        .control = false,
+        .listen_count = 0,
+        .acceptors = 1,
+        .backlog = LISTEN_BACKLOG
     }
 };
 
 static globals *pglobal=&global;
 
+/* connection pool, one entry per allowed client, allocated by httpd_init() */
+static cfd *connections = NULL;
+static pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* snapshot headers, one per slot of each input's frame ring */
+static snapshot_header *snapshot_headers[MAX_INPUT_PLUGINS];
+
+/* serialized JSON documents, rebuilt when their version changes */
+static json_doc *input_json[MAX_INPUT_PLUGINS];
+static json_doc *output_json[MAX_OUTPUT_PLUGINS];
+static json_doc *program_json = NULL;
+static pthread_mutex_t json_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* part of every ETag, sequence numbers start over when the server restarts */
+static unsigned long boot_id = 0;
+
+/* set once the listening sockets are open */
+static int listening = 0;
+
 /******************************************************************************
 Description.: initializes the iobuffer structure properly
 Input Value.: pointer to already allocated iobuffer
@@ -87,24 +122,61 @@ Return Value: req
 ******************************************************************************/
 void init_request(request *req)
 {
-    req->type        = A_UNKNOWN;
-    req->type        = A_UNKNOWN;
-    req->parameter   = NULL;
-    req->client      = NULL;
-    req->auth        = NULL;
+    req->type         = A_UNKNOWN;
+    req->parameter[0] = '\0';
+    req->client[0]    = '\0';
+    req->auth[0]      = '\0';
+    req->etag[0]      = '\0';
+    req->keep_alive   = 0;
+    req->gzip         = 0;
+    req->upgrade      = 0;
+    req->ws_key[0]    = '\0';
+    req->last_event[0] = '\0';
+    req->range[0]      = '\0';
+}
+
+/******************************************************************************
+Description.: takes an unused entry of the connection pool
+Input Value.: * pc: server context the client connected to
+              * fd: accepted filedescriptor
+Return Value: the connection or NULL if the client limit is reached
+******************************************************************************/
+static cfd *get_connection(context *pc, int fd)
+{
+    cfd *c = NULL;
+    int i;
+
+    pthread_mutex_lock(&connections_mutex);
+    for(i = 0; i < pglobal->max_clients; i++) {
+        if(!connections[i].in_use) {
+            c = &connections[i];
+            c->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+
+    if(c != NULL) {
+        c->pc = pc;
+        c->fd = fd;
+        init_iobuffer(&c->iobuf);
+        init_request(&c->req);
+        memset(&c->stats, 0, sizeof(c->stats));
+    }
+
+    return c;
 }
 
 /******************************************************************************
-Description.: If strings were assigned to the different members free them
-              This will fail if strings are static, so always use strdup().
-Input Value.: req: pointer to request structure
+Description.: returns a connection to the pool
+Input Value.: connection taken by get_connection()
 Return Value: -
 ******************************************************************************/
-void free_request(request *req)
+static void put_connection(cfd *c)
 {
-    if(req->parameter != NULL) free(req->parameter);
-    if(req->client != NULL) free(req->client);
-    if(req->auth != NULL) free(req->auth);
+    pthread_mutex_lock(&connections_mutex);
+    c->in_use = 0;
+    pthread_mutex_unlock(&connections_mutex);
 }
 
 /******************************************************************************
@@ -320,394 +392,1478 @@ int unescape(char *string)
     return 0;
 }
 
+/******************************************************************************
+Description.: Look up a GET variable and convert its decimal value.
+Input Value.: * parameter: the parameter string of the command
+              * name.....: name of the variable including the "="
+              * value....: stores the converted value
+Return Value: 1 if the variable was found, 0 otherwise
+******************************************************************************/
+static int get_int_parameter(char *parameter, char *name, int *value)
+{
+    char *p;
+
+    if((p = strstr(parameter, name)) == NULL)
+        return 0;
+
+    *value = MAX(MIN(strtol(p + strlen(name), NULL, 10), INT_MAX), INT_MIN);
+    return 1;
+}
+
+/******************************************************************************
+Description.: Look up a GET variable holding a time in seconds with fraction,
+              as the X-Timestamp header gives it, e.g. "ts=1234.567890".
+              A unit like in "from=-10s" is ignored.
+Input Value.: * parameter: the parameter string of the command
+              * name.....: name of the variable including the "="
+              * usec.....: stores the value in microseconds
+Return Value: 1 if the variable was found, 0 otherwise
+******************************************************************************/
+static int get_time_parameter(char *parameter, char *name, long long *usec)
+{
+    double value;
+    char *p;
+
+    if((p = strstr(parameter, name)) == NULL)
+        return 0;
+
+    value = strtod(p + strlen(name), NULL) * 1000000;
+    *usec = (long long)(value < 0 ? value - 0.5 : value + 0.5);
+    return 1;
+}
+
+/******************************************************************************
+Description.: Selects the connection header which finishes every response.
+Input Value.: the request that gets answered, NULL if the connection closes
+Return Value: the header line
+******************************************************************************/
+static const char *connection_header(request *req)
+{
+    return (req != NULL && req->keep_alive) ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+/******************************************************************************
+Description.: Send a complete HTTP response with a body of known length, so
+              the connection can be used for further requests afterwards.
+Input Value.: * fd......: filedescriptor to send the answer to
+              * req.....: the request to answer, NULL closes the connection
+              * status..: status code and reason, e.g. "200 OK"
+              * mimetype: content type of the body
+              * extra...: additional header lines, may be empty
+              * body....: the body, may be NULL if len is 0
+              * len.....: length of the body
+Return Value: 0 if everything was sent, -1 otherwise
+******************************************************************************/
+static int send_response(int fd, request *req, const char *status, const char *mimetype, const char *extra, const char *body, int len)
+{
+    char header[BUFFER_SIZE] = {0};
+    struct iovec iov[2];
+
+    snprintf(header, sizeof(header), "HTTP/1.1 %s\r\n" \
+             "Content-type: %s\r\n" \
+             "Content-Length: %d\r\n" \
+             STD_HEADER \
+             "%s" \
+             "%s" \
+             "\r\n", status, mimetype, len, extra, connection_header(req));
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = strlen(header);
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = len;
+
+    if(writev(fd, iov, (len > 0) ? 2 : 1) < 0) {
+        DBG("write failed, done anyway\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Formats the ETag of a frame, it is made of the start time of the
+              server, the input number and the sequence number of the frame.
+Input Value.: * etag........: buffer of ETAG_LEN bytes for the quoted ETag
+              * input_number: input the frame was published on
+              * seq.........: sequence number of the frame
+Return Value: -
+******************************************************************************/
+static void format_etag(char *etag, int input_number, unsigned int seq)
+{
+    snprintf(etag, ETAG_LEN, "\"%lx-%d-%u\"", boot_id, input_number, seq);
+}
+
+/******************************************************************************
+Description.: Checks the value of an If-None-Match header against an ETag.
+Input Value.: * if_none_match: header value, may list several ETags or be "*"
+              * etag.........: the quoted ETag of the current frame
+Return Value: 1 if the client already has the frame, 0 otherwise
+******************************************************************************/
+static int etag_matches(char *if_none_match, char *etag)
+{
+    if(if_none_match[0] == '\0')
+        return 0;
+
+    return (strchr(if_none_match, '*') != NULL || strstr(if_none_match, etag) != NULL);
+}
+
+/******************************************************************************
+Description.: Returns the response header for the frame in a pinned slot. The
+              first client that asks for a frame builds the header, all
+              others requesting the same frame reuse it. While the header of
+              a slot gets built, other clients fall back to a private copy.
+Input Value.: * input_number: input the frame ring belongs to
+              * slot........: pinned slot, its header can not change meanwhile
+              * local.......: storage for the private copy
+Return Value: the header to send
+******************************************************************************/
+static snapshot_header *get_snapshot_header(int input_number, frame_slot *slot, snapshot_header *local)
+{
+    frame_ring *ring = pglobal->in[input_number].ring;
+    snapshot_header *sh = &snapshot_headers[input_number][slot - ring->slots];
+    char etag[ETAG_LEN];
+    int idle = 0;
+
+    if(__atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE) == slot->seq)
+        return sh;
+
+    /*
+     * a slot is only rewritten once nobody pins it anymore, so nobody can
+     * still be sending the old header of this slot when it gets replaced
+     */
+    if(__atomic_compare_exchange_n(&sh->building, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        __atomic_store_n(&sh->seq, 0, __ATOMIC_RELEASE);
+    else
+        sh = local;
+
+    format_etag(etag, input_number, slot->seq);
+    sh->len = snprintf(sh->header, sizeof(sh->header), "HTTP/1.1 200 OK\r\n" \
+                       REVALIDATE_HEADER \
+                       "Content-type: image/jpeg\r\n" \
+                       "Content-Length: %d\r\n" \
+                       "ETag: %s\r\n" \
+                       "X-Timestamp: %d.%06d\r\n" \
+                       "X-Sequence: %u\r\n", slot->size, etag, (int) slot->timestamp.tv_sec, (int) slot->timestamp.tv_usec,
+                       slot->source_seq);
+
+    if(sh != local) {
+        __atomic_store_n(&sh->seq, slot->seq, __ATOMIC_RELEASE);
+        __atomic_store_n(&sh->building, 0, __ATOMIC_RELEASE);
+    }
+
+    return sh;
+}
+
 /******************************************************************************
 Description.: Send a complete HTTP response and a single JPG-frame.
-Input Value.: fildescriptor fd to send the answer to
+              The latest published frame is sent right away, with the GET
+              variable "fresh=1" the next frame is awaited instead. If the
+              client already has the latest frame, only 304 is sent.
+Input Value.: * fd..........: fildescriptor to send the answer to
+              * input_number: input to take the frame from
+              * req.........: the request with GET variables and If-None-Match
 Return Value: -
 ******************************************************************************/
-void send_snapshot(int fd, int input_number)
+void send_snapshot(int fd, int input_number, request *req)
 {
-    unsigned char *frame = NULL;
-    int frame_size = 0;
     char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    char etag[ETAG_LEN];
+    frame_ring *ring = pglobal->in[input_number].ring;
+    frame_slot *slot = NULL;
+    snapshot_header local, *sh;
+    struct iovec iov[3];
+    unsigned int seq = 0;
+    int fresh = 0;
+    int waited;
+
+    /* pollers keep the camera at its full frame rate */
+    frame_demand_snapshot(ring);
+
+    /* sequence number 0 is never published, so the latest frame satisfies it */
+    if(get_int_parameter(req->parameter, "fresh=", &fresh) && fresh)
+        seq = frame_seq(ring);
+
+    /* the latest frame is still the one the client has, no need to pin it */
+    if(seq == 0 && frame_seq(ring) != 0) {
+        format_etag(etag, input_number, frame_seq(ring));
+        if(etag_matches(req->etag, etag)) {
+            DBG("frame %s not modified\n", etag);
+            sprintf(buffer, "HTTP/1.1 304 Not Modified\r\n" \
+                    REVALIDATE_HEADER \
+                    "ETag: %s\r\n" \
+                    "%s" \
+                    "\r\n", etag, connection_header(req));
+            if(write(fd, buffer, strlen(buffer)) < 0) {
+                DBG("write failed, done anyway\n");
+            }
+            return;
+        }
+    }
 
-    /* wait for a fresh frame */
-    pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    /*
+     * the wait only happens for fresh frames or if nothing was published yet,
+     * as a consumer the request starts a camera stopped by -s again, a camera
+     * that delivers nothing is answered with an error instead of a hang
+     */
+    frame_consumer_add(ring, 1);
+    for(waited = 0; !pglobal->stop && slot == NULL && waited < SNAPSHOT_TIMEOUT; waited++)
+        slot = frame_acquire(ring, seq, fd, 1000);
+    frame_consumer_add(ring, -1);
+    if(slot == NULL) {
+        if(!pglobal->stop)
+            send_error(fd, req, 503, "no frame from the camera");
+        return;
+    }
 
-    /* read buffer */
-    frame_size = pglobal->in[input_number].size;
+    DBG("got frame (size: %d kB)\n", slot->size / 1024);
 
-    /* allocate a buffer for this single frame */
-    if((frame = malloc(frame_size + 1)) == NULL) {
-        free(frame);
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-        send_error(fd, 500, "not enough memory");
-        return;
+    sh = get_snapshot_header(input_number, slot, &local);
+
+    /*
+     * send header and image with one call, the image straight from the pinned slot,
+     * the shared header is completed by the connection header of this request
+     */
+    snprintf(buffer, sizeof(buffer), "%s\r\n", connection_header(req));
+    iov[0].iov_base = sh->header;
+    iov[0].iov_len = sh->len;
+    iov[1].iov_base = buffer;
+    iov[1].iov_len = strlen(buffer);
+    iov[2].iov_base = frame_data(ring, slot);
+    iov[2].iov_len = slot->size;
+    if(writev(fd, iov, 3) < 0) {
+        DBG("write failed, done anyway\n");
     }
-    /* copy v4l2_buffer timeval to user space */
-    timestamp = pglobal->in[input_number].timestamp;
 
-    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-    DBG("got frame (size: %d kB)\n", frame_size / 1024);
+    frame_release(slot);
+}
+
+/******************************************************************************
+Description.: Decides whether a frame of a stream gets sent or skipped. With
+              "fps" frames are picked by their capture timestamps, so the
+              rate does not depend on how fast the client reads. With
+              "every" only every n-th published frame is sent.
+Input Value.: * ts......: capture time of the frame
+              * seq.....: its sequence number
+              * last_seq: sequence number of the last frame sent, 0 if none
+              * fps.....: requested frames per second, 0 to send all
+              * every...: send only every n-th frame, 0 or 1 to send all
+              * due.....: capture time in us the next frame is due, updated
+Return Value: 1 if the frame is to be sent, 0 if it gets skipped
+******************************************************************************/
+static int frame_due(long long ts, unsigned int seq, unsigned int last_seq, int fps, int every, long long *due)
+{
+    long long interval;
+
+    if(every > 1 && last_seq != 0 && seq - last_seq < (unsigned int)every)
+        return 0;
 
-    pthread_mutex_unlock(&pglobal->in[input_number].db);
+    if(fps <= 0)
+        return 1;
 
-    /* write the response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            STD_HEADER \
-            "Content-type: image/jpeg\r\n" \
+    /*
+     * a frame up to half an interval early is taken, so the rate is kept
+     * on average even if the camera rate is no multiple of it
+     */
+    interval = 1000000 / fps;
+    if(last_seq != 0 && ts < *due - interval / 2)
+        return 0;
+
+    /* start over if the stream fell behind, e.g. after the camera paused */
+    if(last_seq == 0 || ts > *due + interval)
+        *due = ts;
+    *due += interval;
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: Writes one frame of a multipart stream followed by the boundary.
+Input Value.: * fd.........: filedescriptor to send the frame to
+              * data.......: the JPG data, it stays pinned while it is sent
+              * size.......: its length
+              * timestamp..: capture time of the frame
+              * source_seq.: X-Sequence of the frame
+Return Value: 0 if it was sent, -1 otherwise
+******************************************************************************/
+static int write_part(int fd, unsigned char *data, int size, struct timeval timestamp, unsigned int source_seq)
+{
+    char buffer[BUFFER_SIZE] = {0};
+
+    DBG("got frame (size: %d kB)\n", size / 1024);
+
+    /*
+     * print the individual mimetype and the length
+     * sending the content-length fixes random stream disruption observed
+     * with firefox
+     */
+    sprintf(buffer, "Content-Type: image/jpeg\r\n" \
+            "Content-Length: %d\r\n" \
             "X-Timestamp: %d.%06d\r\n" \
-            "\r\n", (int) timestamp.tv_sec, (int) timestamp.tv_usec);
+            "X-Sequence: %u\r\n" \
+            "\r\n", size, (int)timestamp.tv_sec, (int)timestamp.tv_usec, source_seq);
+    DBG("sending intemdiate header\n");
+    if(write(fd, buffer, strlen(buffer)) < 0)
+        return -1;
 
-    /* send header and image now */
-    if(write(fd, buffer, strlen(buffer)) < 0 || \
-            write(fd, frame, frame_size) < 0) {
-        free(frame);
-        return;
+    DBG("sending frame\n");
+    if(write(fd, data, size) < 0)
+        return -1;
+
+    DBG("sending boundary\n");
+    sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
+    if(write(fd, buffer, strlen(buffer)) < 0)
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Streams frames of the history of an input, paced by their
+              capture times, "speed=N" plays them N times faster and
+              "speed=0" as fast as the client reads. A client that falls
+              behind the history continues with the oldest frame still
+              stored. The replay ends when the newest stored frame was sent.
+Input Value.: * fd..........: fildescriptor to send the frames to
+              * input_number: input the history belongs to
+              * from........: capture time of the first frame in us
+              * speed.......: playback speed
+              * fps, every..: decimation, see frame_due()
+              * seq.........: stores the ring sequence number of the last
+                              frame looked at, the live stream goes on after it
+              * last_sent...: sequence number of the last frame sent, updated
+              * due.........: state of frame_due()
+              * stats.......: counters of the connection
+Return Value: 0 when the replay caught up with the live frames, -1 if the
+              client is gone
+******************************************************************************/
+static int replay_history(int fd, int input_number, long long from, int speed, int fps, int every,
+                          unsigned int *seq, unsigned int *last_sent, long long *due, client_stats *stats)
+{
+    timeshift *history = pglobal->in[input_number].history;
+    long long start_ts = 0, start_clock = 0, ts, wait;
+    struct timespec now;
+    timeshift_frame *f;
+    unsigned int index;
+    int rc;
+
+    f = timeshift_by_time(history, from, 0);
+
+    while(f != NULL && !pglobal->stop) {
+        ts = timeshift_usec(&f->timestamp);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* playback time starts with the first frame and after every jump */
+        if(start_clock == 0) {
+            start_ts = ts;
+            start_clock = (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        }
+
+        /* the frame stays pinned while waiting, so pauses of the camera are skipped */
+        if(speed > 0) {
+            wait = start_clock + (ts - start_ts) / speed - ((long long)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+            if(wait > 1000000) {
+                start_clock = 0;
+                continue;
+            }
+            if(wait > 0) {
+                usleep(wait);
+                continue;
+            }
+        }
+
+        *seq = f->seq;
+        index = f->index;
+
+        if(!frame_due(ts, f->seq, *last_sent, fps, every, due)) {
+            stats->skipped++;
+            rc = 0;
+        } else {
+            *last_sent = f->seq;
+            rc = write_part(fd, timeshift_data(history, f), f->size, f->timestamp, f->source_seq);
+            if(rc == 0) {
+                stats->frames++;
+                stats->bytes += f->size;
+            }
+        }
+        timeshift_release(f);
+        if(rc < 0)
+            return -1;
+
+        if((f = timeshift_at(history, index + 1)) != NULL)
+            continue;
+
+        /*
+         * either the next frame is not stored yet, then the replay caught
+         * up, or it was already dropped and the oldest frame follows
+         */
+        if((f = timeshift_by_time(history, ts, 0)) != NULL && f->index == index) {
+            timeshift_release(f);
+            f = NULL;
+        }
+        if(f != NULL && f->index != index + 1)
+            start_clock = 0;
     }
 
-    free(frame);
+    return 0;
 }
 
 /******************************************************************************
 Description.: Send a complete HTTP response and a stream of JPG-frames.
-Input Value.: fildescriptor fd to send the answer to
+              The GET variables "fps=N" and "every=N" reduce the frame rate
+              of this client, skipped frames cause no work besides pinning.
+              With a history "from=-Ns" or "from=<X-Timestamp>" starts the
+              stream in the past, see replay_history().
+Input Value.: * fd..........: fildescriptor to send the answer to
+              * input_number: input to take the frames from
+              * req.........: the request with the GET variables
+              * stats.......: counters of the connection
 Return Value: -
 ******************************************************************************/
-void send_stream(int fd, int input_number)
+void send_stream(int fd, int input_number, request *req, client_stats *stats)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
+    int rc, fps = 0, every = 0, speed = 1;
     char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    frame_ring *ring = pglobal->in[input_number].ring;
+    timeshift *history = pglobal->in[input_number].history;
+    frame_slot *slot;
+    timeshift_frame *f;
+    unsigned int seq = 0, last_sent = 0;
+    long long due = 0, from = 0;
+
+    get_int_parameter(req->parameter, "fps=", &fps);
+    get_int_parameter(req->parameter, "every=", &every);
+    get_int_parameter(req->parameter, "speed=", &speed);
+    stats->fps = fps = MAX(fps, 0);
+    stats->every = every = MAX(every, 0);
 
     DBG("preparing header\n");
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
+    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
             STD_HEADER \
+            "Connection: close\r\n" \
             "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
             "\r\n" \
             "--" BOUNDARY "\r\n");
 
     if(write(fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
         return;
     }
 
     DBG("Headers send, sending stream now\n");
 
-    while(!pglobal->stop) {
-
-        /* wait for fresh frames */
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(fd, 500, "not enough memory");
-                return;
-            }
+    /* with "every" the rate depends on the camera, so it needs all frames */
+    frame_demand_add(ring, (every > 1) ? 0 : fps, 1);
 
-            frame = tmp;
+    if(history != NULL && get_time_parameter(req->parameter, "from=", &from)) {
+        /* a negative time counts back from the newest stored frame */
+        if(from < 0 && (f = timeshift_by_time(history, LLONG_MAX, 1)) != NULL) {
+            from += timeshift_usec(&f->timestamp);
+            timeshift_release(f);
         }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
-
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        if(replay_history(fd, input_number, from, MAX(speed, 0), fps, every, &seq, &last_sent, &due, stats) < 0) {
+            frame_demand_add(ring, (every > 1) ? 0 : fps, -1);
+            return;
+        }
+    }
 
-        /*
-         * print the individual mimetype and the length
-         * sending the content-length fixes random stream disruption observed
-         * with firefox
-         */
-        sprintf(buffer, "Content-Type: image/jpeg\r\n" \
-                "Content-Length: %d\r\n" \
-                "X-Timestamp: %d.%06d\r\n" \
-                "\r\n", frame_size, (int)timestamp.tv_sec, (int)timestamp.tv_usec);
-        DBG("sending intemdiate header\n");
-        if(write(fd, buffer, strlen(buffer)) < 0) break;
+    while(!pglobal->stop) {
 
-        DBG("sending frame\n");
-        if(write(fd, frame, frame_size) < 0) break;
+        /* the latest frame goes out right away, afterwards wait for fresh frames */
+        if((slot = frame_acquire(ring, seq, fd, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
 
-#if 0
-        {
-            int fdtest = open("test.jpg", O_WRONLY | O_CREAT, 0666);
-            write(fdtest, frame, frame_size);
-            close(fdtest);
+        /* decimation happens before any work is spent on the frame */
+        if(!frame_due(timeshift_usec(&slot->timestamp), slot->seq, last_sent, fps, every, &due)) {
+            frame_release(slot);
+            stats->skipped++;
+            continue;
         }
-#endif
+        last_sent = seq;
 
-        DBG("sending boundary\n");
-        sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
-        if(write(fd, buffer, strlen(buffer)) < 0) break;
+        /* the slot stays pinned while it is sent, so no private copy is needed */
+        rc = write_part(fd, frame_data(ring, slot), slot->size, slot->timestamp, slot->source_seq);
+        if(rc == 0) {
+            stats->frames++;
+            stats->bytes += slot->size;
+        }
+        frame_release(slot);
+        if(rc < 0) break;
     }
 
-    free(frame);
+    frame_demand_add(ring, (every > 1) ? 0 : fps, -1);
 }
 
 /******************************************************************************
-Description.: Send error messages and headers.
-Input Value.: * fd.....: is the filedescriptor to send the message to
-              * which..: HTTP error code, most popular is 404
-              * message: append this string to the displayed response
+Description.: Send a single frame of the history of an input, "seq=N" picks
+              it by its X-Sequence number, "ts=<X-Timestamp>" picks the newest
+              frame captured at or before that time. Stored frames never
+              change, so a client that already has one only gets 304.
+Input Value.: * fd..........: fildescriptor to send the answer to
+              * input_number: input the history belongs to
+              * req.........: the request with the GET variables
 Return Value: -
 ******************************************************************************/
-void send_error(int fd, int which, char *message)
+void send_frame(int fd, int input_number, request *req)
 {
     char buffer[BUFFER_SIZE] = {0};
+    char etag[ETAG_LEN];
+    timeshift *history = pglobal->in[input_number].history;
+    timeshift_frame *f = NULL;
+    struct iovec iov[2];
+    long long ts;
+    int seq;
+
+    if(history == NULL) {
+        send_error(fd, req, 404, "no timeshift history, see --timeshift");
+        return;
+    }
 
-    if(which == 401) {
-        sprintf(buffer, "HTTP/1.0 401 Unauthorized\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n" \
-                "\r\n" \
-                "401: Not Authenticated!\r\n" \
-                "%s", message);
-    } else if(which == 404) {
-        sprintf(buffer, "HTTP/1.0 404 Not Found\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "404: Not Found!\r\n" \
-                "%s", message);
-    } else if(which == 500) {
-        sprintf(buffer, "HTTP/1.0 500 Internal Server Error\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "500: Internal Server Error!\r\n" \
-                "%s", message);
-    } else if(which == 400) {
-        sprintf(buffer, "HTTP/1.0 400 Bad Request\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "400: Not Found!\r\n" \
-                "%s", message);
-    } else {
-        sprintf(buffer, "HTTP/1.0 501 Not Implemented\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "501: Not Implemented!\r\n" \
-                "%s", message);
+    if(get_int_parameter(req->parameter, "seq=", &seq))
+        f = timeshift_by_seq(history, (unsigned int)seq);
+    else if(get_time_parameter(req->parameter, "ts=", &ts))
+        f = timeshift_by_time(history, ts, 1);
+
+    if(f == NULL) {
+        send_error(fd, req, 404, "the frame is not in the timeshift history");
+        return;
     }
 
-    if(write(fd, buffer, strlen(buffer)) < 0) {
+    format_etag(etag, input_number, f->seq);
+    if(etag_matches(req->etag, etag)) {
+        timeshift_release(f);
+        snprintf(buffer, sizeof(buffer), "HTTP/1.1 304 Not Modified\r\n" \
+                 REVALIDATE_HEADER \
+                 "ETag: %s\r\n" \
+                 "%s" \
+                 "\r\n", etag, connection_header(req));
+        if(write(fd, buffer, strlen(buffer)) < 0) {
+            DBG("write failed, done anyway\n");
+        }
+        return;
+    }
+
+    snprintf(buffer, sizeof(buffer), "HTTP/1.1 200 OK\r\n" \
+             REVALIDATE_HEADER \
+             "Content-type: image/jpeg\r\n" \
+             "Content-Length: %d\r\n" \
+             "ETag: %s\r\n" \
+             "X-Timestamp: %d.%06d\r\n" \
+             "X-Sequence: %u\r\n" \
+             "%s" \
+             "\r\n", f->size, etag, (int)f->timestamp.tv_sec, (int)f->timestamp.tv_usec, f->source_seq,
+             connection_header(req));
+
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = strlen(buffer);
+    iov[1].iov_base = timeshift_data(history, f);
+    iov[1].iov_len = f->size;
+    if(writev(fd, iov, 2) < 0) {
         DBG("write failed, done anyway\n");
     }
+
+    timeshift_release(f);
 }
 
 /******************************************************************************
-Description.: Send HTTP header and copy the content of a file. To keep things
-              simple, just a single folder gets searched for the file. Just
-              files with known extension and supported mimetype get served.
-              If no parameter was given, the file "index.html" will be copied.
-Input Value.: * fd.......: filedescriptor to send data to
-              * parameter: string that consists of the filename
-              * id.......: specifies which server-context is the right one
-Return Value: -
+Description.: Writes one recorded frame of a multipart stream followed by the
+              boundary, the kernel copies the JPG data from the file.
+Input Value.: * fd: filedescriptor to send the frame to
+              * pf: the open recording
+              * e.: index entry of the frame
+Return Value: 0 if it was sent, -1 otherwise
 ******************************************************************************/
-void send_file(int id, int fd, char *parameter)
+static int write_recorded_part(int fd, playback_file *pf, recorder_index_entry *e)
 {
     char buffer[BUFFER_SIZE] = {0};
-    char *extension, *mimetype = NULL;
-    int i, lfd;
-    config conf = server.conf;
+    off_t offset = e->offset;
+    size_t left = e->size;
+    ssize_t sent;
+
+    sprintf(buffer, "Content-Type: image/jpeg\r\n" \
+            "Content-Length: %u\r\n" \
+            "X-Timestamp: %lld.%06lld\r\n" \
+            "X-Sequence: %u\r\n" \
+            "\r\n", e->size, e->usec / 1000000, e->usec % 1000000, e->seq);
+    if(write(fd, buffer, strlen(buffer)) < 0)
+        return -1;
+
+    while(left > 0 && (sent = sendfile(fd, pf->fd, &offset, left)) > 0)
+        left -= sent;
+    if(left > 0)
+        return -1;
+
+    sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
+    if(write(fd, buffer, strlen(buffer)) < 0)
+        return -1;
 
-    /* in case no parameter was given */
-    if(parameter == NULL || strlen(parameter) == 0)
-        parameter = "index.html";
+    return 0;
+}
 
-    /* find file-extension */
-    char * pch;
-    pch = strchr(parameter, '.');
-    int lastDot = 0;
-    while(pch != NULL) {
-        lastDot = pch - parameter;
-        pch = strchr(pch + 1, '.');
-    }
+/******************************************************************************
+Description.: Looks up the time of the frame recorded next to another one,
+              it may be in the neighbouring file.
+Input Value.: * pf.......: the open recording
+              * index....: index of the frame
+              * direction: 1 for the next frame, -1 for the previous one
+              * usec.....: stores the time of the neighbour in us
+Return Value: 1 if there is a neighbour, 0 otherwise
+******************************************************************************/
+static int recorded_neighbour(playback_file *pf, unsigned int index, int direction, long long *usec)
+{
+    playback_file other = { .fd = -1 };
 
-    if(lastDot == 0) {
-        send_error(fd, 400, "No file extension found");
-        return;
-    } else {
-        extension = parameter + lastDot;
-        DBG("%s EXTENSION: %s\n", parameter, extension);
+    if(direction > 0 && index + 1 < pf->count) {
+        *usec = pf->index[index + 1].usec;
+        return 1;
     }
-
-    /* determine mime-type */
-    for(i = 0; i < LENGTH_OF(mimetypes); i++) {
-        if(strcmp(mimetypes[i].dot_extension, extension) == 0) {
-            mimetype = (char *)mimetypes[i].mimetype;
-            break;
-        }
+    if(direction < 0 && index > 0) {
+        *usec = pf->index[index - 1].usec;
+        return 1;
     }
 
-    /* in case of unknown mimetype or extension leave */
-    if(mimetype == NULL) {
-        send_error(fd, 404, "MIME-TYPE not known");
-        return;
+    if(playback_neighbour(pf->name, direction, &other) < 0 || other.count == 0) {
+        playback_close(&other);
+        return 0;
     }
 
-    /* now filename, mimetype and extension are known */
-    DBG("trying to serve file \"%s\", extension: \"%s\" mime: \"%s\"\n", parameter, extension, mimetype);
+    *usec = other.index[(direction > 0) ? 0 : other.count - 1].usec;
+    playback_close(&other);
+    return 1;
+}
 
-    /* build the absolute path to the file */
-    strncat(buffer, conf.www_folder, sizeof(buffer) - 1);
-    strncat(buffer, parameter, sizeof(buffer) - strlen(buffer) - 1);
+/******************************************************************************
+Description.: Sends a single recorded frame for stepping through a recording.
+              X-Previous and X-Next give the times of the frames around it,
+              requesting "ts=" with one of them returns that frame.
+Input Value.: * fd...: filedescriptor to send the answer to
+              * req..: the request to answer
+              * pf...: the open recording
+              * index: index of the frame
+Return Value: -
+******************************************************************************/
+static void send_recorded_frame(int fd, request *req, playback_file *pf, unsigned int index)
+{
+    char buffer[BUFFER_SIZE] = {0}, previous[64] = "", next[64] = "";
+    recorder_index_entry *e = &pf->index[index];
+    off_t offset = e->offset;
+    size_t left = e->size;
+    ssize_t sent;
+    long long usec;
+
+    if(recorded_neighbour(pf, index, -1, &usec))
+        snprintf(previous, sizeof(previous), "X-Previous: %lld.%06lld\r\n", usec / 1000000, usec % 1000000);
+    if(recorded_neighbour(pf, index, 1, &usec))
+        snprintf(next, sizeof(next), "X-Next: %lld.%06lld\r\n", usec / 1000000, usec % 1000000);
+
+    snprintf(buffer, sizeof(buffer), "HTTP/1.1 200 OK\r\n" \
+             "Content-type: image/jpeg\r\n" \
+             "Content-Length: %u\r\n" \
+             STD_HEADER \
+             "X-Timestamp: %lld.%06lld\r\n" \
+             "X-Sequence: %u\r\n" \
+             "%s" \
+             "%s" \
+             "%s" \
+             "\r\n", e->size, e->usec / 1000000, e->usec % 1000000, e->seq, previous, next,
+             connection_header(req));
 
-    /* try to open that file */
-    if((lfd = open(buffer, O_RDONLY)) < 0) {
-        DBG("file %s not accessible\n", buffer);
-        send_error(fd, 404, "Could not open file");
+    if(write(fd, buffer, strlen(buffer)) < 0) {
+        req->keep_alive = 0;
         return;
     }
-    DBG("opened file: %s\n", buffer);
-
-    /* prepare HTTP header */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", mimetype);
-    i = strlen(buffer);
-
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    do {
-        if(write(fd, buffer, i) < 0) {
-            close(lfd);
-            return;
-        }
-    } while((i = read(lfd, buffer, sizeof(buffer))) > 0);
 
-    /* close file, job done */
-    close(lfd);
+    while(left > 0 && (sent = sendfile(fd, pf->fd, &offset, left)) > 0)
+        left -= sent;
+    if(left > 0)
+        req->keep_alive = 0;
 }
 
 /******************************************************************************
-Description.: Perform a command specified by parameter. Send response to fd.
-Input Value.: * fd.......: filedescriptor to send HTTP response to.
-              * parameter: contains the command and value as string.
-              * id.......: specifies which server-context to choose.
+Description.: Plays the recordings of the recorder output from the time given
+              with "ts=", a negative time counts back from now. Without it
+              the oldest recording is played. "speed=N" plays N times faster,
+              "speed=0" as fast as the client reads. The stream goes on with
+              the following files and waits for the recorder once it reached
+              the newest frame. "step=1" answers just the frame at the time.
+Input Value.: * fd...: filedescriptor to send the answer to
+              * req..: the request with the GET variables
+              * stats: counters of the connection
 Return Value: -
 ******************************************************************************/
-void command(int id, int fd, char *parameter)
+void send_playback(int fd, request *req, client_stats *stats)
 {
     char buffer[BUFFER_SIZE] = {0};
-    char *command = NULL, *svalue = NULL, *value, *command_id_string;
-    int res = 0, ivalue = 0, command_id = -1,  len = 0;
-
-    DBG("parameter is: %s\n", parameter);
-
-    /* sanity check of parameter-string */
-    if(parameter == NULL || strlen(parameter) >= 255 || strlen(parameter) == 0) {
-        DBG("parameter string looks bad\n");
-        send_error(fd, 400, "Parameter-string of command does not look valid.");
+    playback_file pf = { .fd = -1 }, next;
+    long long from = 0, start_ts = 0, start_clock = 0, now, wait;
+    int speed = 1, step = 0, idle = 0, rc;
+    recorder_index_entry *e;
+    struct timespec ts;
+    unsigned int index;
+
+    if(recorder_cfg.folder == NULL) {
+        send_error(fd, req, 404, "no recordings, see --record");
         return;
     }
 
-    /* command format:
-        ?control&dest=0plugin=0&id=0&group=0&value=0
-        where:
-        dest: specifies the command destination (input, output, program itself) 0-1-2
-        plugin specifies the plugin id  (not acceptable at the commands sent to the program itself)
-        id: the control id
-        group: the control's group eg. V4L2 control, jpg control, etc. This is optional
-        value: value the control
-    */
+    if(get_time_parameter(req->parameter, "ts=", &from) && from < 0)
+        from += frame_clock_now();
+    get_int_parameter(req->parameter, "speed=", &speed);
+    get_int_parameter(req->parameter, "step=", &step);
+    speed = MAX(speed, 0);
 
-    /* search for required variable "command" */
-    if((command = strstr(parameter, "id=")) == NULL) {
-        DBG("no command id specified\n");
-        send_error(fd, 400, "no GET variable \"id=...\" found, it is required to specify which command id to execute");
+    if(playback_seek(&pf, from, &index) < 0) {
+        send_error(fd, req, 404, "no frame was recorded at or after that time");
         return;
     }
 
-    /* allocate and copy command string */
-    command += strlen("id=");
-    len = strspn(command, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_1234567890");
-    if((command = strndup(command, len)) == NULL) {
-        send_error(fd, 500, "could not allocate memory");
-        LOG("could not allocate memory\n");
+    if(step) {
+        send_recorded_frame(fd, req, &pf, index);
+        playback_close(&pf);
         return;
     }
 
-    /* convert the command to id */
-    command_id_string = command;
-    len = strspn(command_id_string, "-1234567890");
-    if((svalue = strndup(command_id_string, len)) == NULL) {
-        if(command != NULL) free(command);
-        send_error(fd, 500, "could not allocate memory");
-        LOG("could not allocate memory\n");
-        return;
-    }
+    /* the stream only ends with the connection */
+    req->keep_alive = 0;
 
-    command_id = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
-    DBG("command id string: %s converted to int = %d\n", command, command_id);
+    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
+            STD_HEADER \
+            "Connection: close\r\n" \
+            "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
+            "\r\n" \
+            "--" BOUNDARY "\r\n");
 
-    /* find and convert optional parameter "value" */
-    if((value = strstr(parameter, "value=")) != NULL) {
-        value += strlen("value=");
-        len = strspn(value, "-1234567890");
-        if((svalue = strndup(value, len)) == NULL) {
-            if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
-            LOG("could not allocate memory\n");
-            return;
+    if(write(fd, buffer, strlen(buffer)) < 0) {
+        playback_close(&pf);
+        return;
+    }
+
+    while(!pglobal->stop) {
+        if(index >= pf.count) {
+            /* once the next file exists this one is finished, but it may have got its last frames meanwhile */
+            if(playback_neighbour(pf.name, 1, &next) == 0) {
+                if(playback_refresh(&pf)) {
+                    playback_close(&next);
+                } else {
+                    playback_close(&pf);
+                    pf = next;
+                    index = 0;
+                }
+                continue;
+            }
+
+            if(playback_refresh(&pf))
+                continue;
+
+            /* the newest frame was sent, wait for the recorder */
+            if(idle++ >= PLAYBACK_IDLE * 10)
+                break;
+            usleep(100000);
+            continue;
+        }
+        idle = 0;
+
+        e = &pf.index[index];
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+        /* playback time starts with the first frame and after every gap */
+        if(start_clock == 0) {
+            start_ts = e->usec;
+            start_clock = now;
+        }
+
+        if(speed > 0) {
+            wait = start_clock + (e->usec - start_ts) / speed - now;
+            if(wait > 1000000) {
+                start_clock = 0;
+                continue;
+            }
+            if(wait > 0) {
+                usleep(wait);
+                continue;
+            }
         }
-        ivalue = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
-        DBG("The command value converted value form string %s to integer %d\n", svalue, ivalue);
+
+        rc = write_recorded_part(fd, &pf, e);
+        if(rc < 0)
+            break;
+
+        stats->frames++;
+        stats->bytes += e->size;
+        index++;
     }
 
-    int group = IN_CMD_GENERIC;
-    if((value = strstr(parameter, "group=")) != NULL) {
-        value += strlen("group=");
-        len = strspn(value, "-1234567890");
-        if((svalue = strndup(value, len)) == NULL) {
-            if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
-            LOG("could not allocate memory\n");
-            return;
+    playback_close(&pf);
+}
+
+/******************************************************************************
+Description.: Parses the value of a Range header with a single range like
+              "0-499", "500-" or "-500".
+Input Value.: * range: header value without "bytes="
+              * size.: length of the file
+              * start: stores the first byte
+              * end..: stores the last byte
+Return Value: 1 for a satisfiable range, 0 if the whole file is to be sent,
+              -1 if the range lies outside of the file
+******************************************************************************/
+static int parse_range(char *range, off_t size, off_t *start, off_t *end)
+{
+    char *dash;
+
+    /* several ranges are answered with the whole file */
+    if(range[0] == '\0' || strchr(range, ',') != NULL || (dash = strchr(range, '-')) == NULL)
+        return 0;
+
+    if(range == dash) {
+        *start = MAX(size - strtoll(dash + 1, NULL, 10), 0);
+        *end = size - 1;
+    } else {
+        *start = strtoll(range, NULL, 10);
+        *end = (dash[1] != '\0') ? MIN(strtoll(dash + 1, NULL, 10), size - 1) : size - 1;
+    }
+
+    return (*start <= *end && *start < size) ? 1 : -1;
+}
+
+/******************************************************************************
+Description.: Sends a file of the recording folder, a single byte range is
+              answered with 206, so players can seek in the AVI files.
+Input Value.: * fd.: filedescriptor to send the answer to
+              * req: the request, its parameter is the filename
+Return Value: -
+******************************************************************************/
+void send_recording(int fd, request *req)
+{
+    char buffer[BUFFER_SIZE] = {0}, path[PATH_MAX];
+    off_t start = 0, end, left;
+    struct stat st;
+    ssize_t sent;
+    int lfd, ranged;
+
+    if(recorder_cfg.folder == NULL) {
+        send_error(fd, req, 404, "no recordings, see --record");
+        return;
+    }
+
+    /* only the files of the recorder, so the folder can not be left */
+    if(!recorder_is_file(req->parameter, ".avi") && !recorder_is_file(req->parameter, ".idx")) {
+        send_error(fd, req, 404, "not a recording");
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, req->parameter);
+    if((lfd = open(path, O_RDONLY)) < 0 || fstat(lfd, &st) < 0) {
+        if(lfd >= 0)
+            close(lfd);
+        send_error(fd, req, 404, "Could not open file");
+        return;
+    }
+    end = st.st_size - 1;
+
+    if((ranged = parse_range(req->range, st.st_size, &start, &end)) < 0) {
+        close(lfd);
+        snprintf(buffer, sizeof(buffer), "Content-Range: bytes */%ld\r\n", (long)st.st_size);
+        send_response(fd, req, "416 Range Not Satisfiable", "text/plain", buffer, NULL, 0);
+        return;
+    }
+
+    snprintf(buffer, sizeof(buffer), "HTTP/1.1 %s\r\n" \
+             "Content-type: %s\r\n" \
+             "Content-Length: %ld\r\n" \
+             STD_HEADER \
+             "Accept-Ranges: bytes\r\n",
+             ranged ? "206 Partial Content" : "200 OK",
+             recorder_is_file(req->parameter, ".avi") ? "video/x-msvideo" : "application/octet-stream",
+             (long)(end - start + 1));
+    if(ranged)
+        snprintf(buffer + strlen(buffer), sizeof(buffer) - strlen(buffer), "Content-Range: bytes %ld-%ld/%ld\r\n",
+                 (long)start, (long)end, (long)st.st_size);
+    snprintf(buffer + strlen(buffer), sizeof(buffer) - strlen(buffer), "%s\r\n", connection_header(req));
+
+    if(write(fd, buffer, strlen(buffer)) < 0) {
+        close(lfd);
+        req->keep_alive = 0;
+        return;
+    }
+
+    left = end - start + 1;
+    while(left > 0 && (sent = sendfile(fd, lfd, &start, left)) > 0)
+        left -= sent;
+
+    /* the client is gone, the announced length can not be kept */
+    if(left > 0)
+        req->keep_alive = 0;
+
+    close(lfd);
+}
+
+/******************************************************************************
+Description.: Sends a range of frames as an MJPEG AVI file. "duration=N"
+              gives the last N seconds, "start=" and "end=" or one of them
+              with "duration=" a range in the times of X-Timestamp. The
+              frames come from the timeshift history if it holds the start,
+              otherwise from the recordings, which store the same times.
+              The length is known in advance, so the file goes out
+              progressively without being assembled.
+Input Value.: * fd..........: filedescriptor to send the answer to
+              * input_number: input the history belongs to
+              * req.........: the request with the GET variables
+              * stats.......: counters of the connection
+Return Value: -
+******************************************************************************/
+void send_clip(int fd, int input_number, request *req, client_stats *stats)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    unsigned char header[AVI_HEADER_LEN], chunk[AVI_CHUNK_LEN], entries[64 * AVI_INDEX_ENTRY_LEN];
+    static const unsigned char pad = 0;
+    timeshift *history = pglobal->in[input_number].history;
+    long long start = 0, end = 0, duration = CLIP_DEFAULT_SECONDS * 1000000LL, newest = LLONG_MAX, oldest = LLONG_MAX;
+    int has_start, has_end, rc = 0;
+    unsigned int i, k, n, usec_per_frame, offset = 4;
+    clip c = { .history = NULL };
+    timeshift_frame *f;
+    clip_frame *cf;
+    struct iovec iov[3];
+    off_t pos;
+    size_t left;
+    ssize_t sent;
+
+    has_start = get_time_parameter(req->parameter, "start=", &start);
+    has_end = get_time_parameter(req->parameter, "end=", &end);
+    get_time_parameter(req->parameter, "duration=", &duration);
+
+    if(has_start && has_end)
+        duration = end - start;
+    if(duration <= 0 || duration > CLIP_MAX_SECONDS * 1000000LL) {
+        send_error(fd, req, 400, "the duration of a clip has to be between 0 and 3600 seconds");
+        return;
+    }
+
+    if(history != NULL) {
+        if((f = timeshift_by_time(history, LLONG_MAX, 1)) != NULL) {
+            newest = timeshift_usec(&f->timestamp);
+            timeshift_release(f);
+        }
+        if((f = timeshift_by_time(history, LLONG_MIN, 0)) != NULL) {
+            oldest = timeshift_usec(&f->timestamp);
+            timeshift_release(f);
         }
-        group = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
-        DBG("The command type value converted value form string %s to integer %d\n", svalue, group);
     }
 
-    int dest = Dest_Input;
-    if((value = strstr(parameter, "dest=")) != NULL) {
-        value += strlen("dest=");
-        len = strspn(value, "-1234567890");
-        if((svalue = strndup(value, len)) == NULL) {
-            if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
-            LOG("could not allocate memory\n");
-            return;
+    /* without times the clip ends with the newest frame */
+    if(!has_start && !has_end) {
+        if(newest != LLONG_MAX && (newest - duration >= oldest || recorder_cfg.folder == NULL)) {
+            end = newest;
+        } else {
+            end = frame_clock_now();
+        }
+    }
+    if(!has_start)
+        start = end - duration;
+    else if(!has_end)
+        end = start + duration;
+
+    if(history != NULL && start <= newest && (start >= oldest || recorder_cfg.folder == NULL))
+        rc = clip_from_history(&c, history, start, end);
+    else
+        rc = clip_from_recordings(&c, start, end);
+
+    if(rc < 0) {
+        clip_free(&c);
+        send_error(fd, req, 400, "the clip is too large");
+        return;
+    }
+    if(c.count == 0) {
+        clip_free(&c);
+        send_error(fd, req, 404, "no frames in that time range");
+        return;
+    }
+
+    usec_per_frame = (c.count > 1) ? (c.frames[c.count - 1].usec - c.frames[0].usec) / (c.count - 1) : 1000000;
+    avi_header(header, c.width, c.height, c.count, usec_per_frame, c.movi_len, c.count * AVI_INDEX_ENTRY_LEN);
+
+    snprintf(buffer, sizeof(buffer), "HTTP/1.1 200 OK\r\n" \
+             "Content-type: video/x-msvideo\r\n" \
+             "Content-Length: %llu\r\n" \
+             "Content-Disposition: attachment; filename=\"clip-%u-%u.avi\"\r\n" \
+             STD_HEADER \
+             "%s" \
+             "\r\n", clip_length(&c), c.frames[0].seq, c.frames[c.count - 1].seq, connection_header(req));
+
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = strlen(buffer);
+    iov[1].iov_base = header;
+    iov[1].iov_len = sizeof(header);
+    rc = write_iov(fd, iov, 2);
+
+    /* a chunk is its header, the JPEG and a padding byte if it has an odd length */
+    for(i = 0; i < c.count && rc == 0; i++) {
+        cf = &c.frames[i];
+        avi_chunk(chunk, cf->size);
+        iov[0].iov_base = chunk;
+        iov[0].iov_len = sizeof(chunk);
+
+        if(c.history != NULL) {
+            /* a frame replaced since the clip was collected ends the answer short */
+            if((f = timeshift_at(c.history, cf->index)) == NULL) {
+                DBG("frame %u of the clip left the history\n", cf->seq);
+                rc = -1;
+                break;
+            }
+            iov[1].iov_base = timeshift_data(c.history, f);
+            iov[1].iov_len = cf->size;
+            iov[2].iov_base = (void *)&pad;
+            iov[2].iov_len = cf->size & 1;
+            rc = write_iov(fd, iov, (cf->size & 1) ? 3 : 2);
+            timeshift_release(f);
+        } else if((rc = write_iov(fd, iov, 1)) == 0) {
+            pos = cf->offset;
+            left = cf->size;
+            while(left > 0 && (sent = sendfile(fd, c.files[cf->file], &pos, left)) > 0)
+                left -= sent;
+            if(left > 0 || ((cf->size & 1) && write(fd, &pad, 1) != 1))
+                rc = -1;
+        }
+
+        if(rc == 0) {
+            stats->frames++;
+            stats->bytes += cf->size;
+        }
+    }
+
+    /* idx1 counts from the "movi" fourcc */
+    avi_index_header(chunk, c.count);
+    if(rc == 0 && write(fd, chunk, sizeof(chunk)) != sizeof(chunk))
+        rc = -1;
+    for(i = 0; i < c.count && rc == 0; i += n) {
+        n = MIN(c.count - i, 64);
+        for(k = 0; k < n; k++) {
+            avi_index_entry(entries + k * AVI_INDEX_ENTRY_LEN, offset, c.frames[i + k].size);
+            offset += AVI_CHUNK_LEN + avi_padded(c.frames[i + k].size);
+        }
+        if(write(fd, entries, n * AVI_INDEX_ENTRY_LEN) != n * AVI_INDEX_ENTRY_LEN)
+            rc = -1;
+    }
+
+    /* the announced length could not be kept */
+    if(rc < 0)
+        req->keep_alive = 0;
+
+    clip_free(&c);
+}
+
+/******************************************************************************
+Description.: Writes one event of the log in the Server-Sent Events format,
+              its id is made of the start time of the server and the event
+              id, so ids of an earlier run do not match.
+Input Value.: * fd: filedescriptor to send the event to
+              * ev: the event
+Return Value: 0 if it was sent, -1 otherwise
+******************************************************************************/
+static int write_event(int fd, frame_event *ev)
+{
+    char buffer[BUFFER_SIZE / 2];
+
+    snprintf(buffer, sizeof(buffer), "id: %lu-%u\nevent: %s\ndata: %s\n\n", boot_id, ev->id, ev->type, ev->data);
+    return (write(fd, buffer, strlen(buffer)) < 0) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: Fires the trigger of the triggered recording, "seconds=N"
+              records N seconds from now instead of the post-roll. The
+              answer tells until when the recording goes on.
+Input Value.: * fd.: filedescriptor to send the answer to
+              * req: the request with the GET variables
+Return Value: -
+******************************************************************************/
+void send_trigger(int fd, request *req)
+{
+    char buffer[BUFFER_SIZE];
+    int seconds = recorder_cfg.postroll, len;
+    long long until;
+
+    if(recorder_triggers == NULL) {
+        send_error(fd, req, 404, "no triggered recording, see --trigger");
+        return;
+    }
+
+    get_int_parameter(req->parameter, "seconds=", &seconds);
+    recorder_fire(RECORDER_HTTP, MIN(MAX(seconds, 1), 3600));
+
+    until = __atomic_load_n(&recorder_triggers->until, __ATOMIC_ACQUIRE);
+    len = snprintf(buffer, sizeof(buffer), "{\n\"until\": %lld.%06lld,\n\"fired\": %lu\n}\n",
+                   until / 1000000, until % 1000000, __atomic_load_n(&recorder_triggers->fired, __ATOMIC_RELAXED));
+
+    if(send_response(fd, req, "200 OK", "application/x-javascript", "", buffer, len) < 0) {
+        DBG("unable to answer the trigger\n");
+    }
+}
+
+/******************************************************************************
+Description.: Sends the SDP file of the multicast stream, receivers like VLC
+              or ffplay open it to join the group.
+Input Value.: * fd.: filedescriptor to send the file to
+              * req: the request
+Return Value: -
+******************************************************************************/
+void send_sdp(int fd, request *req)
+{
+    char sdp[BUFFER_SIZE], origin[NI_MAXHOST];
+    int len;
+
+    socket_local_address(fd, origin, sizeof(origin));
+    if((len = multicast_sdp(sdp, sizeof(sdp), origin)) < 0) {
+        send_error(fd, req, 404, "multicast is not enabled");
+        return;
+    }
+
+    if(send_response(fd, req, "200 OK", "application/sdp", "", sdp, len) < 0) {
+        DBG("unable to serve the SDP file\n");
+    }
+}
+
+/******************************************************************************
+Description.: Sends the status changes of an input as Server-Sent Events:
+              "control", "resolution", "fps", "clients" and "error". Only
+              changes are sent, the complete state comes from input_N.json.
+              A client that reconnects with Last-Event-ID gets the events it
+              missed, if they are gone it gets a "reset" event and has to
+              load input_N.json again. The thread sleeps until something
+              happens, so idle clients cost nothing.
+Input Value.: * fd..........: filedescriptor to send the events to
+              * input_number: input whose events are sent
+              * req.........: the request with Last-Event-ID
+Return Value: -
+******************************************************************************/
+void send_events(int fd, int input_number, request *req)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    frame_ring *ring = pglobal->in[input_number].ring;
+    frame_event ev;
+    unsigned long boot = 0;
+    unsigned int id = 0, next;
+    int rc, idle = 0;
+
+    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
+            STD_HEADER \
+            "Connection: close\r\n" \
+            "Content-Type: text/event-stream\r\n" \
+            "\r\n" \
+            "retry: 2000\n\n");
+    if(write(fd, buffer, strlen(buffer)) < 0)
+        return;
+
+    /* without a usable Last-Event-ID the client starts with the next change */
+    next = frame_event_last(ring) + 1;
+    if(req->last_event[0] != '\0') {
+        if(sscanf(req->last_event, "%lu-%u", &boot, &id) == 2 && boot == boot_id &&
+           (int)(next - (id + 1)) >= 0 && (int)(next - (id + 1)) < FRAME_EVENTS) {
+            next = id + 1;
+        } else {
+            ev.id = next - 1;
+            snprintf(ev.type, sizeof(ev.type), "reset");
+            snprintf(ev.data, sizeof(ev.data), "{\"input\": %d}", input_number);
+            if(write_event(fd, &ev) < 0)
+                return;
+        }
+    }
+
+    while(!pglobal->stop) {
+        if((rc = frame_event_get(ring, next, &ev, 1000)) == 1) {
+            /* a comment line keeps proxies from closing the connection */
+            if(++idle >= EVENTS_HEARTBEAT) {
+                idle = 0;
+                if(write(fd, ": keep-alive\n\n", strlen(": keep-alive\n\n")) < 0)
+                    break;
+            }
+            continue;
+        }
+        idle = 0;
+
+        if(rc < 0) {
+            /* the client fell too far behind, it has to start over */
+            next = frame_event_last(ring) + 1;
+            ev.id = next - 1;
+            snprintf(ev.type, sizeof(ev.type), "reset");
+            snprintf(ev.data, sizeof(ev.data), "{\"input\": %d}", input_number);
+        } else {
+            next++;
+        }
+
+        if(write_event(fd, &ev) < 0)
+            break;
+    }
+}
+
+/******************************************************************************
+Description.: Send error messages and headers.
+Input Value.: * fd.....: is the filedescriptor to send the message to
+              * req....: the request to answer, NULL closes the connection
+              * which..: HTTP error code, most popular is 404
+              * message: append this string to the displayed response
+Return Value: -
+******************************************************************************/
+void send_error(int fd, request *req, int which, char *message)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    char *status, *extra = "";
+
+    if(which == 401) {
+        status = "401 Unauthorized";
+        extra = "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n";
+        snprintf(buffer, sizeof(buffer), "401: Not Authenticated!\r\n%s", message);
+    } else if(which == 404) {
+        status = "404 Not Found";
+        snprintf(buffer, sizeof(buffer), "404: Not Found!\r\n%s", message);
+    } else if(which == 500) {
+        status = "500 Internal Server Error";
+        snprintf(buffer, sizeof(buffer), "500: Internal Server Error!\r\n%s", message);
+    } else if(which == 503) {
+        status = "503 Service Unavailable";
+        snprintf(buffer, sizeof(buffer), "503: Service Unavailable!\r\n%s", message);
+    } else if(which == 400) {
+        status = "400 Bad Request";
+        snprintf(buffer, sizeof(buffer), "400: Not Found!\r\n%s", message);
+    } else {
+        status = "501 Not Implemented";
+        snprintf(buffer, sizeof(buffer), "501: Not Implemented!\r\n%s", message);
+    }
+
+    send_response(fd, req, status, "text/plain", extra, buffer, strlen(buffer));
+}
+
+/******************************************************************************
+Description.: Send a file of the www folder from the file cache. The
+              precompressed variant is preferred if the client accepts it,
+              a matching If-None-Match is answered with 304.
+Input Value.: * fd......: filedescriptor to send data to
+              * req.....: the request to answer
+              * entry...: the cached file
+              * mimetype: mimetype of the plain file
+Return Value: -
+******************************************************************************/
+static void send_cached_file(int fd, request *req, file_entry *entry, char *mimetype)
+{
+    char header[BUFFER_SIZE] = {0};
+    int gzip = (req->gzip && entry->gz_data != NULL);
+    char *etag = gzip ? entry->gz_etag : entry->etag;
+    struct iovec iov[2];
+
+    if(etag_matches(req->etag, etag)) {
+        snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\n" \
+                 REVALIDATE_HEADER \
+                 "ETag: %s\r\n" \
+                 "Vary: Accept-Encoding\r\n" \
+                 "%s" \
+                 "\r\n", etag, connection_header(req));
+        if(write(fd, header, strlen(header)) < 0) {
+            DBG("write failed, done anyway\n");
+        }
+        return;
+    }
+
+    snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n" \
+             "Content-type: %s\r\n" \
+             "Content-Length: %lu\r\n" \
+             REVALIDATE_HEADER \
+             "ETag: %s\r\n" \
+             "Vary: Accept-Encoding\r\n" \
+             "%s" \
+             "%s" \
+             "\r\n", mimetype, (unsigned long)(gzip ? entry->gz_size : entry->size), etag,
+             gzip ? "Content-Encoding: gzip\r\n" : "", connection_header(req));
+
+    /* header and content with one call */
+    iov[0].iov_base = header;
+    iov[0].iov_len = strlen(header);
+    iov[1].iov_base = gzip ? entry->gz_data : entry->data;
+    iov[1].iov_len = gzip ? entry->gz_size : entry->size;
+    if(writev(fd, iov, 2) < 0) {
+        DBG("write failed, done anyway\n");
+        req->keep_alive = 0;
+    }
+}
+
+/******************************************************************************
+Description.: Send HTTP header and copy the content of a file. To keep things
+              simple, just a single folder gets searched for the file. Just
+              files with known extension and supported mimetype get served.
+              If no parameter was given, the file "index.html" will be copied.
+Input Value.: * fd.......: filedescriptor to send data to
+              * req......: the request, its parameter consists of the filename
+              * id.......: specifies which server-context is the right one
+Return Value: -
+******************************************************************************/
+void send_file(int id, int fd, request *req)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    char *extension, *mimetype = NULL, *parameter = req->parameter;
+    int i, lfd;
+    struct stat st;
+    off_t left;
+    ssize_t sent;
+    file_entry *entry;
+    config conf = server.conf;
+
+    /* in case no parameter was given */
+    if(strlen(parameter) == 0)
+        parameter = "index.html";
+
+    /* do not leave the www folder */
+    if(strstr(parameter, "..") != NULL) {
+        send_error(fd, req, 404, "Could not open file");
+        return;
+    }
+
+    /* find file-extension */
+    char * pch;
+    pch = strchr(parameter, '.');
+    int lastDot = 0;
+    while(pch != NULL) {
+        lastDot = pch - parameter;
+        pch = strchr(pch + 1, '.');
+    }
+
+    if(lastDot == 0) {
+        send_error(fd, req, 400, "No file extension found");
+        return;
+    } else {
+        extension = parameter + lastDot;
+        DBG("%s EXTENSION: %s\n", parameter, extension);
+    }
+
+    /* determine mime-type */
+    for(i = 0; i < LENGTH_OF(mimetypes); i++) {
+        if(strcmp(mimetypes[i].dot_extension, extension) == 0) {
+            mimetype = (char *)mimetypes[i].mimetype;
+            break;
         }
-        dest = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
+    }
+
+    /* in case of unknown mimetype or extension leave */
+    if(mimetype == NULL) {
+        send_error(fd, req, 404, "MIME-TYPE not known");
+        return;
+    }
+
+    /* now filename, mimetype and extension are known */
+    DBG("trying to serve file \"%s\", extension: \"%s\" mime: \"%s\"\n", parameter, extension, mimetype);
+
+    /* files of the www folder usually come from memory */
+    if((entry = filecache_get(parameter)) != NULL) {
+        send_cached_file(fd, req, entry, mimetype);
+        filecache_put(entry);
+        return;
+    }
+
+    /* build the absolute path to the file */
+    strncat(buffer, conf.www_folder, sizeof(buffer) - 1);
+    strncat(buffer, parameter, sizeof(buffer) - strlen(buffer) - 1);
+
+    /* try to open that file */
+    if((lfd = open(buffer, O_RDONLY)) < 0) {
+        DBG("file %s not accessible\n", buffer);
+        send_error(fd, req, 404, "Could not open file");
+        return;
+    }
+    DBG("opened file: %s\n", buffer);
+
+    /* the length is required to keep the connection open afterwards */
+    if(fstat(lfd, &st) < 0) {
+        close(lfd);
+        send_error(fd, req, 404, "Could not open file");
+        return;
+    }
+
+    /* prepare HTTP header */
+    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
+            "Content-type: %s\r\n" \
+            "Content-Length: %ld\r\n" \
+            STD_HEADER \
+            "%s" \
+            "\r\n", mimetype, (long)st.st_size, connection_header(req));
+
+    /* first transmit HTTP-header, afterwards let the kernel copy the content of the file */
+    if(write(fd, buffer, strlen(buffer)) < 0) {
+        close(lfd);
+        req->keep_alive = 0;
+        return;
+    }
+
+    left = st.st_size;
+    while(left > 0 && (sent = sendfile(fd, lfd, NULL, left)) > 0)
+        left -= sent;
+
+    /* the file shrank meanwhile or the client is gone, the announced length can not be kept */
+    if(left > 0)
+        req->keep_alive = 0;
+
+    /* close file, job done */
+    close(lfd);
+}
+
+/******************************************************************************
+Description.: Perform a command given as GET variables, HTTP requests and
+              WebSocket clients use the same syntax.
+Input Value.: * parameter: the variables, "id=" is required
+              * command..: stores the command id as string, 32 bytes
+              * res......: stores the result of the command
+Return Value: 0 if the command was executed, -1 if "id=" is missing
+******************************************************************************/
+static int run_command(char *parameter, char *command, int *res)
+{
+    char *p;
+    int ivalue = 0, command_id = -1,  len = 0;
+
+    /* command format:
+        ?control&dest=0plugin=0&id=0&group=0&value=0
+        where:
+        dest: specifies the command destination (input, output, program itself) 0-1-2
+        plugin specifies the plugin id  (not acceptable at the commands sent to the program itself)
+        id: the control id
+        group: the control's group eg. V4L2 control, jpg control, etc. This is optional
+        value: value the control
+    */
+
+    /* search for required variable "command" */
+    if((p = strstr(parameter, "id=")) == NULL) {
+        DBG("no command id specified\n");
+        return -1;
+    }
+
+    /* copy command string */
+    p += strlen("id=");
+    len = MIN(strspn(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_1234567890"), 31);
+    memset(command, 0, 32);
+    strncpy(command, p, len);
+
+    /* convert the command to id */
+    command_id = MAX(MIN(strtol(command, NULL, 10), INT_MAX), INT_MIN);
+    DBG("command id string: %s converted to int = %d\n", command, command_id);
+
+    /* find and convert optional parameter "value" */
+    if(get_int_parameter(parameter, "value=", &ivalue)) {
+        DBG("The command value converted to integer %d\n", ivalue);
+    }
+
+    int group = IN_CMD_GENERIC;
+    if(get_int_parameter(parameter, "group=", &group)) {
+        DBG("The command type value converted to integer %d\n", group);
+    }
+
+    int dest = Dest_Input;
+    if(get_int_parameter(parameter, "dest=", &dest)) {
         #ifdef DEBUG
         switch (dest) {
             case Dest_Input:
-                DBG("The command destination value converted form the string \"%s\" to integer %d -> INPUT\n", svalue, dest );
+                DBG("The command destination value converted to integer %d -> INPUT\n", dest );
                 break;
             case Dest_Output:
-                DBG("The command destination value converted form the string \"%s\" to integer %d -> OUTPUT\n", svalue, dest );
+                DBG("The command destination value converted to integer %d -> OUTPUT\n", dest );
                 break;
             case Dest_Program:
-                DBG("The command destination value converted form the string \"%s\" to integer %d -> PROGRAM\n", svalue, dest );
+                DBG("The command destination value converted to integer %d -> PROGRAM\n", dest );
                 break;
         }
 
@@ -716,30 +1872,22 @@ void command(int id, int fd, char *parameter)
     }
 
     int plugin_no = 0; // default plugin no = 0 for campatibility reasons
-    if((value = strstr(parameter, "plugin=")) != NULL) {
-        value += strlen("plugin=");
-        len = strspn(value, "-1234567890");
-        if((svalue = strndup(value, len)) == NULL) {
-            if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
-            LOG("could not allocate memory\n");
-            return;
-        }
-        plugin_no = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
-        DBG("The plugin number value converted value form string %s to integer %d\n", svalue, plugin_no);
+    if(get_int_parameter(parameter, "plugin=", &plugin_no)) {
+        DBG("The plugin number value converted to integer %d\n", plugin_no);
     }
 
+    *res = 0;
     switch(dest) {
     case Dest_Input:
-        if(plugin_no < pglobal->incnt) {
-            res = pglobal->in[plugin_no].cmd(plugin_no, command_id, group, ivalue);
+        if(plugin_no >= 0 && plugin_no < pglobal->incnt) {
+            *res = pglobal->in[plugin_no].cmd(plugin_no, command_id, group, ivalue);
         } else {
             DBG("Invalid plugin number: %d because only %d input plugins loaded", plugin_no,  pglobal->incnt-1);
         }
         break;
     case Dest_Output:
-        if(plugin_no < pglobal->outcnt) {
-            res = pglobal->out[plugin_no].cmd(plugin_no, command_id, group, ivalue);
+        if(plugin_no >= 0 && plugin_no < pglobal->outcnt) {
+            *res = pglobal->out[plugin_no].cmd(plugin_no, command_id, group, ivalue);
         } else {
             DBG("Invalid plugin number: %d because only %d output plugins loaded", plugin_no,  pglobal->incnt-1);
         }
@@ -750,142 +1898,350 @@ void command(int id, int fd, char *parameter)
         fprintf(stderr, "Illegal command destination: %d\n", dest);
     }
 
+    return 0;
+}
+
+/******************************************************************************
+Description.: Perform a command specified by parameter. Send response to fd.
+Input Value.: * fd.......: filedescriptor to send HTTP response to.
+              * req......: its parameter contains the command and value as string.
+              * id.......: specifies which server-context to choose.
+Return Value: -
+******************************************************************************/
+void command(int id, int fd, request *req)
+{
+    char buffer[BUFFER_SIZE] = {0}, *parameter = req->parameter;
+    char command[32] = {0};
+    int res = 0;
+
+    DBG("parameter is: %s\n", parameter);
+
+    /* sanity check of parameter-string */
+    if(strlen(parameter) >= 255 || strlen(parameter) == 0) {
+        DBG("parameter string looks bad\n");
+        send_error(fd, req, 400, "Parameter-string of command does not look valid.");
+        return;
+    }
+
+    if(run_command(parameter, command, &res) < 0) {
+        send_error(fd, req, 400, "no GET variable \"id=...\" found, it is required to specify which command id to execute");
+        return;
+    }
+
     /* Send HTTP-response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: text/plain\r\n" \
-            STD_HEADER \
-            "\r\n" \
-            "%s: %d", command, res);
+    sprintf(buffer, "%s: %d", command, res);
+    send_response(fd, req, "200 OK", "text/plain", "", buffer, strlen(buffer));
+}
 
-    if(write(fd, buffer, strlen(buffer)) < 0) {
-        DBG("write failed, done anyway\n");
+/******************************************************************************
+Description.: Answers a text message of a WebSocket client. The message uses
+              the syntax of GET variables: "fps=N" and "every=N" change the
+              rate of this client, "quality=N" sets the JPEG quality of the
+              input and "id=..." runs a command like "?action=command".
+Input Value.: * lcfd........: the connection
+              * input_number: input the client streams from
+              * msg.........: the text message
+              * fps, every..: rate of this client, updated
+Return Value: 0 if the answer was sent, -1 otherwise
+******************************************************************************/
+static int websocket_control(cfd *lcfd, int input_number, char *msg, int *fps, int *every)
+{
+    char answer[BUFFER_SIZE / 4], command[32];
+    frame_ring *ring = pglobal->in[input_number].ring;
+    int new_fps = *fps, new_every = *every, value, res = 0;
+
+    if(get_int_parameter(msg, "fps=", &new_fps) | get_int_parameter(msg, "every=", &new_every)) {
+        new_fps = MAX(new_fps, 0);
+        new_every = MAX(new_every, 0);
+
+        /* the camera may have to run faster or may slow down now */
+        frame_demand_add(ring, (*every > 1) ? 0 : *fps, -1);
+        frame_demand_add(ring, (new_every > 1) ? 0 : new_fps, 1);
+        lcfd->stats.fps = *fps = new_fps;
+        lcfd->stats.every = *every = new_every;
+
+        snprintf(answer, sizeof(answer), "fps=%d&every=%d", new_fps, new_every);
+    } else if(!lcfd->pc->conf.control) {
+        snprintf(answer, sizeof(answer), "error: this server is configured to not accept control commands");
+    } else if(get_int_parameter(msg, "quality=", &value)) {
+        res = pglobal->in[input_number].cmd(input_number, 0, IN_CMD_JPEG_QUALITY, value);
+        snprintf(answer, sizeof(answer), "quality: %d", res);
+    } else if(run_command(msg, command, &res) == 0) {
+        snprintf(answer, sizeof(answer), "%s: %d", command, res);
+    } else {
+        snprintf(answer, sizeof(answer), "error: unknown request");
     }
 
-    if(command != NULL) free(command);
-    if(svalue != NULL) free(svalue);
+    return ws_send(lcfd->fd, WS_OP_TEXT, answer, strlen(answer), NULL, 0);
 }
 
 /******************************************************************************
-Description.: Serve a connected TCP-client. This thread function is called
-              for each connect of a HTTP client like a webbrowser. It determines
-              if it is a valid HTTP request and dispatches between the different
-              response options.
-Input Value.: arg is the filedescriptor and server-context of the connected TCP
-              socket. It must have been allocated so it is freeable by this
-              thread function.
-Return Value: always NULL
+Description.: Serves a WebSocket client. Every frame is sent as one binary
+              message, a header of 12 bytes in network byte order holds the
+              sequence number, the seconds and the microseconds of the
+              capture time, the JPEG follows. Text messages of the client
+              control the stream, see websocket_control(). A frame is
+              skipped while the client has not received the previous ones
+              yet, so a slow client gets fewer but current frames.
+Input Value.: * lcfd........: the connection, its request holds the handshake
+              * input_number: input to take the frames from
+Return Value: -
 ******************************************************************************/
-/* thread for clients that connected to this server */
-void *client_thread(void *arg)
+void send_websocket(cfd *lcfd, int input_number)
+{
+    char buffer[BUFFER_SIZE] = {0}, accept[WS_KEY_LEN];
+    frame_ring *ring = pglobal->in[input_number].ring;
+    client_stats *stats = &lcfd->stats;
+    struct pollfd pfd = { .fd = lcfd->fd, .events = POLLIN };
+    uint32_t meta[3];
+    frame_slot *slot;
+    ws_message msg;
+    unsigned int seq = 0, last_sent = 0;
+    int fps = 0, every = 0, rc;
+    long long due = 0;
+    time_t now, heard, pinged;
+
+    get_int_parameter(lcfd->req.parameter, "fps=", &fps);
+    get_int_parameter(lcfd->req.parameter, "every=", &every);
+    stats->fps = fps = MAX(fps, 0);
+    stats->every = every = MAX(every, 0);
+
+    ws_accept_key(lcfd->req.ws_key, accept);
+    snprintf(buffer, sizeof(buffer), "HTTP/1.1 101 Switching Protocols\r\n" \
+             "Server: MJPG-Streamer/0.2\r\n" \
+             "Upgrade: websocket\r\n" \
+             "Connection: Upgrade\r\n" \
+             "Sec-WebSocket-Accept: %s\r\n" \
+             "\r\n", accept);
+    if(write(lcfd->fd, buffer, strlen(buffer)) < 0)
+        return;
+
+    /* with "every" the rate depends on the camera, so it needs all frames */
+    frame_demand_add(ring, (every > 1) ? 0 : fps, 1);
+
+    memset(&msg, 0, sizeof(msg));
+    heard = pinged = time(NULL);
+
+    while(!pglobal->stop) {
+
+        /* messages of the client first, they may change the rate */
+        rc = 0;
+        while(rc >= 0 && (lcfd->iobuf.level > 0 || poll(&pfd, 1, 0) > 0)) {
+            if((rc = ws_recv(lcfd->fd, &lcfd->iobuf, &msg, 5)) < 0)
+                break;
+            heard = time(NULL);
+            if(rc == 1)
+                continue;
+
+            if(msg.opcode == WS_OP_CLOSE) {
+                ws_close(lcfd->fd, WS_CLOSE_NORMAL);
+                rc = -1;
+            } else if(msg.opcode == WS_OP_TEXT) {
+                stats->requests++;
+                rc = websocket_control(lcfd, input_number, msg.data, &fps, &every);
+            }
+        }
+        if(rc < 0)
+            break;
+
+        /* a client that does not answer pings anymore is gone */
+        now = time(NULL);
+        if(now - heard > 2 * WS_PING_INTERVAL)
+            break;
+        if(now - pinged >= WS_PING_INTERVAL && now - heard >= WS_PING_INTERVAL) {
+            if(ws_send(lcfd->fd, WS_OP_PING, NULL, 0, NULL, 0) < 0)
+                break;
+            pinged = now;
+        }
+
+        /* the wait is short, so client messages are not delayed for long */
+        if((slot = frame_acquire(ring, seq, lcfd->fd, WS_POLL_MS)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        if(!frame_due(timeshift_usec(&slot->timestamp), slot->seq, last_sent, fps, every, &due)) {
+            frame_release(slot);
+            stats->skipped++;
+            continue;
+        }
+
+        /* nothing is queued for a slow client, the frame is simply not sent */
+        if(socket_congested(lcfd->fd)) {
+            frame_release(slot);
+            stats->congested++;
+            continue;
+        }
+        last_sent = seq;
+
+        meta[0] = htonl(slot->source_seq);
+        meta[1] = htonl(slot->timestamp.tv_sec);
+        meta[2] = htonl(slot->timestamp.tv_usec);
+
+        /* the slot stays pinned while it is sent, so no private copy is needed */
+        rc = ws_send(lcfd->fd, WS_OP_BINARY, meta, sizeof(meta), frame_data(ring, slot), slot->size);
+        if(rc == 0) {
+            stats->frames++;
+            stats->bytes += slot->size;
+        }
+        frame_release(slot);
+        if(rc < 0)
+            break;
+    }
+
+    frame_demand_add(ring, (every > 1) ? 0 : fps, -1);
+}
+
+/******************************************************************************
+Description.: Copy the GET variables which follow a known part of the request
+              line to the parameter string of the request.
+Input Value.: * req...: the request to store the variables at
+              * buffer: the request line
+              * prefix: known part of the request line in front of the variables
+Return Value: -
+******************************************************************************/
+static void copy_parameter(request *req, char *buffer, char *prefix)
+{
+    char *pb;
+    int len;
+
+    memset(req->parameter, 0, sizeof(req->parameter));
+    if((pb = strstr(buffer, prefix)) == NULL)
+        return;
+
+    pb += strlen(prefix);
+    len = MIN(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), sizeof(req->parameter) - 1);
+    strncpy(req->parameter, pb, len);
+}
+
+/******************************************************************************
+Description.: Read and answer a single request of a connected client.
+Input Value.: * lcfd...: the connection, its iobuffer keeps pipelined requests
+              * timeout: seconds to wait for the request line
+              * served.: number of requests answered on this connection so far
+Return Value: 1 if the connection stays open for another request, 0 otherwise
+******************************************************************************/
+static int handle_request(cfd *lcfd, int timeout, int served)
 {
     int cnt;
     char input_suffixed = 0;
     int input_number = 0;
     char buffer[BUFFER_SIZE] = {0}, *pb = buffer;
-    iobuffer iobuf;
-    request req;
-    cfd lcfd; /* local-connected-file-descriptor */
-
-    /* we really need the fildescriptor and it must be freeable by us */
-    if(arg != NULL) {
-        memcpy(&lcfd, arg, sizeof(cfd));
-        free(arg);
-    } else
-        return NULL;
+    request *req = &lcfd->req;
 
-    /* initializes the structures */
-    init_iobuffer(&iobuf);
-    init_request(&req);
+    init_request(req);
 
     /* What does the client want to receive? Read the request. */
     memset(buffer, 0, sizeof(buffer));
-    if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-        close(lcfd.fd);
-        return NULL;
+    if((cnt = _readline(lcfd->fd, &lcfd->iobuf, buffer, sizeof(buffer) - 1, timeout)) == -1) {
+        return 0;
     }
 
+    /* HTTP/1.1 connections are persistent unless the client says otherwise */
+    req->keep_alive = (strstr(buffer, "HTTP/1.1") != NULL);
+
     /* determine what to deliver */
     if(strstr(buffer, "GET /?action=snapshot") != NULL) {
-        req.type = A_SNAPSHOT;
+        req->type = A_SNAPSHOT;
+        copy_parameter(req, buffer, "GET /?action=snapshot");
 #ifdef WXP_COMPAT
     } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".jpg") != NULL)) {
-        req.type = A_SNAPSHOT;
+        req->type = A_SNAPSHOT;
 #endif
         input_suffixed = 255;
     } else if(strstr(buffer, "GET /?action=stream") != NULL) {
         input_suffixed = 255;
-        req.type = A_STREAM;
+        req->type = A_STREAM;
+        copy_parameter(req, buffer, "GET /?action=stream");
 #ifdef WXP_COMPAT
     } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".mjpg") != NULL)) {
-        req.type = A_STREAM;
+        req->type = A_STREAM;
 #endif
         input_suffixed = 255;
+    } else if(strstr(buffer, "GET /?action=frame") != NULL || strstr(buffer, "GET /frame?") != NULL) {
+        input_suffixed = 255;
+        req->type = A_FRAME;
+        copy_parameter(req, buffer, "?");
+    } else if(strstr(buffer, "GET /?action=websocket") != NULL) {
+        input_suffixed = 255;
+        req->type = A_WEBSOCKET;
+        copy_parameter(req, buffer, "GET /?action=websocket");
+    } else if(strstr(buffer, "GET /?action=events") != NULL) {
+        input_suffixed = 255;
+        req->type = A_EVENTS;
+    } else if(strstr(buffer, "GET /?action=sdp") != NULL || strstr(buffer, "GET /cam.sdp") != NULL) {
+        req->type = A_SDP;
     } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_INPUT_JSON;
+        req->type = A_INPUT_JSON;
         input_suffixed = 255;
     } else if((strstr(buffer, "GET /output") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_OUTPUT_JSON;
+        req->type = A_OUTPUT_JSON;
         input_suffixed = 255;
     } else if(strstr(buffer, "GET /program.json") != NULL) {
-        req.type = A_PROGRAM_JSON;
+        req->type = A_PROGRAM_JSON;
         input_suffixed = 255;
+    } else if((strstr(buffer, "GET /motion") != NULL) && (strstr(buffer, ".json") != NULL)) {
+        req->type = A_MOTION_JSON;
+        input_suffixed = 255;
+    } else if(strstr(buffer, "GET /stats.json") != NULL) {
+        req->type = A_STATS_JSON;
+    } else if(strstr(buffer, "GET /?action=clip") != NULL) {
+        input_suffixed = 255;
+        req->type = A_CLIP;
+        copy_parameter(req, buffer, "GET /?action=clip");
+    } else if(strstr(buffer, "GET /?action=playback") != NULL) {
+        req->type = A_PLAYBACK;
+        copy_parameter(req, buffer, "GET /?action=playback");
+    } else if(strstr(buffer, "GET /?action=trigger") != NULL) {
+        req->type = A_TRIGGER;
+        copy_parameter(req, buffer, "GET /?action=trigger");
+    } else if(strstr(buffer, "GET /recordings.json") != NULL) {
+        req->type = A_RECORDINGS_JSON;
+    } else if(strstr(buffer, "GET /recordings/") != NULL) {
+        req->type = A_RECORDING;
+        copy_parameter(req, buffer, "GET /recordings/");
     } else if(strstr(buffer, "GET /?action=command") != NULL) {
         int len;
-        req.type = A_COMMAND;
+        req->type = A_COMMAND;
 
         /* advance by the length of known string */
         if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
             DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
+            send_error(lcfd->fd, NULL, 400, "Malformed HTTP request");
+            return 0;
         }
         pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
 
         /* only accept certain characters */
         len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
 
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-        	DBG("req.parameter is NULL");
-            exit(EXIT_FAILURE);
-        }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+        memset(req->parameter, 0, sizeof(req->parameter));
+        strncpy(req->parameter, pb, len);
 
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
+        if(unescape(req->parameter) == -1) {
+            send_error(lcfd->fd, NULL, 500, "could not properly unescape command parameter string");
             LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
+            return 0;
         }
 
-        DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
+        DBG("command parameter (len: %d): \"%s\"\n", len, req->parameter);
     } else {
         int len;
 
         DBG("try to serve a file\n");
-        req.type = A_FILE;
+        req->type = A_FILE;
 
         if((pb = strstr(buffer, "GET /")) == NULL) {
             DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
+            send_error(lcfd->fd, NULL, 400, "Malformed HTTP request");
+            return 0;
         }
 
         pb += strlen("GET /");
         len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._/-1234567890"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-        	DBG("req.parameter is NULL");
-        	exit(EXIT_FAILURE);
-        }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+        memset(req->parameter, 0, sizeof(req->parameter));
+        strncpy(req->parameter, pb, len);
 
-        DBG("parameter (len: %d): \"%s\"\n", len, req.parameter);
+        DBG("parameter (len: %d): \"%s\"\n", len, req->parameter);
     }
 
     /*
@@ -913,32 +2269,52 @@ void *client_thread(void *arg)
     do {
         memset(buffer, 0, sizeof(buffer));
 
-        if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-            free_request(&req);
-            close(lcfd.fd);
-            return NULL;
+        if((cnt = _readline(lcfd->fd, &lcfd->iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
+            return 0;
         }
 
         if(strstr(buffer, "User-Agent: ") != NULL) {
-            req.client = strdup(buffer + strlen("User-Agent: "));
+            strncpy(req->client, buffer + strlen("User-Agent: "), sizeof(req->client) - 1);
         } else if(strstr(buffer, "Authorization: Basic ") != NULL) {
-            req.auth = strdup(buffer + strlen("Authorization: Basic "));
-            decodeBase64(req.auth);
-            DBG("username:password: %s\n", req.auth);
+            strncpy(req->auth, buffer + strlen("Authorization: Basic "), sizeof(req->auth) - 1);
+            decodeBase64(req->auth);
+            DBG("username:password: %s\n", req->auth);
+        } else if(strstr(buffer, "If-None-Match: ") != NULL) {
+            strncpy(req->etag, buffer + strlen("If-None-Match: "), sizeof(req->etag) - 1);
+        } else if(strstr(buffer, "Accept-Encoding: ") != NULL) {
+            req->gzip = (strstr(buffer, "gzip") != NULL);
+        } else if(strncasecmp(buffer, "Range: bytes=", strlen("Range: bytes=")) == 0) {
+            pb = buffer + strlen("Range: bytes=");
+            snprintf(req->range, sizeof(req->range), "%.*s", (int)strspn(pb, "0123456789-,"), pb);
+        } else if(strstr(buffer, "Last-Event-ID: ") != NULL) {
+            pb = buffer + strlen("Last-Event-ID: ");
+            snprintf(req->last_event, sizeof(req->last_event), "%.*s", (int)strspn(pb, "0123456789-"), pb);
+        } else if(strstr(buffer, "Sec-WebSocket-Key: ") != NULL) {
+            pb = buffer + strlen("Sec-WebSocket-Key: ");
+            snprintf(req->ws_key, sizeof(req->ws_key), "%.*s",
+                     (int)strspn(pb, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/="), pb);
+        } else if((pb = strstr(buffer, "Upgrade: ")) != NULL) {
+            req->upgrade = (strncasecmp(pb + strlen("Upgrade: "), "websocket", strlen("websocket")) == 0);
+        } else if((pb = strstr(buffer, "Connection: ")) != NULL) {
+            pb += strlen("Connection: ");
+            if(strncasecmp(pb, "close", strlen("close")) == 0)
+                req->keep_alive = 0;
+            else if(strncasecmp(pb, "keep-alive", strlen("keep-alive")) == 0)
+                req->keep_alive = 1;
         }
 
     } while(cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
 
+    /* do not let a single client hold a connection forever */
+    if(served + 1 >= KEEP_ALIVE_MAX)
+        req->keep_alive = 0;
+
     /* check for username and password if parameter -c was given */
-    if(lcfd.pc->conf.auth != NULL) {
-        if(req.auth == NULL || strcmp(lcfd.pc->conf.auth, req.auth) != 0) {
+    if(lcfd->pc->conf.auth != NULL) {
+        if(strcmp(lcfd->pc->conf.auth, req->auth) != 0) {
             DBG("access denied\n");
-            send_error(lcfd.fd, 401, "username and password do not match to configuration");
-            close(lcfd.fd);
-            if(req.parameter != NULL) free(req.parameter);
-            if(req.client != NULL) free(req.client);
-            if(req.auth != NULL) free(req.auth);
-            return NULL;
+            send_error(lcfd->fd, req, 401, "username and password do not match to configuration");
+            return req->keep_alive;
         }
         DBG("access granted\n");
     }
@@ -947,171 +2323,242 @@ void *client_thread(void *arg)
 
     if(!(input_number < pglobal->incnt)) {
         DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
-        send_error(lcfd.fd, 404, "Invalid input plugin number");
-        req.type = A_UNKNOWN;
+        send_error(lcfd->fd, req, 404, "Invalid input plugin number");
+        return req->keep_alive;
     }
 
-    switch(req.type) {
+    lcfd->stats.type = req->type;
+    lcfd->stats.input = input_number;
+    lcfd->stats.requests++;
+
+    switch(req->type) {
     case A_SNAPSHOT:
         DBG("Request for snapshot from input: %d\n", input_number);
-        pthread_mutex_lock(&pglobal->in[input_number].out);
-		pglobal->in[input_number].num_outs++;
-		if(pglobal->in[input_number].num_outs == 1)
-		{
-			/* signal active outputs */
-			pthread_cond_broadcast(&pglobal->in[input_number].out_update);
-		}
-		/* allow others to access the global buffer again */
-		pthread_mutex_unlock(&pglobal->in[input_number].out);
-
-        send_snapshot(lcfd.fd, input_number);
-
-        pthread_mutex_lock(&pglobal->in[input_number].out);
-		if(pglobal->in[input_number].num_outs > 0)
-		{
-			pglobal->in[input_number].num_outs--;
-		}
-		/* allow others to access the global buffer again */
-		pthread_mutex_unlock(&pglobal->in[input_number].out);
-
+        send_snapshot(lcfd->fd, input_number, req);
         break;
 
     case A_STREAM:
         DBG("Request for stream from input: %d\n", input_number);
 
-        pthread_mutex_lock(&pglobal->in[input_number].out);
-		pglobal->in[input_number].num_outs++;
-		if(pglobal->in[input_number].num_outs == 1)
-		{
-			/* signal active outputs */
-			pthread_cond_broadcast(&pglobal->in[input_number].out_update);
-		}
-		/* allow others to access the global buffer again */
-		pthread_mutex_unlock(&pglobal->in[input_number].out);
-
-        send_stream(lcfd.fd, input_number);
-
-        pthread_mutex_lock(&pglobal->in[input_number].out);
-		if(pglobal->in[input_number].num_outs > 0)
-		{
-			pglobal->in[input_number].num_outs--;
-		}
-		/* allow others to access the global buffer again */
-		pthread_mutex_unlock(&pglobal->in[input_number].out);
+        /* the stream only ends with the connection */
+        req->keep_alive = 0;
+
+        /* a stopped camera starts again for active outputs */
+        frame_consumer_add(pglobal->in[input_number].ring, 1);
+
+        send_stream(lcfd->fd, input_number, req, &lcfd->stats);
+
+        frame_consumer_add(pglobal->in[input_number].ring, -1);
 
         break;
 
+    case A_FRAME:
+        DBG("Request for a stored frame of input: %d\n", input_number);
+        send_frame(lcfd->fd, input_number, req);
+        break;
+
+    case A_WEBSOCKET:
+        DBG("Request for websocket from input: %d\n", input_number);
+
+        /* the connection is not HTTP anymore */
+        req->keep_alive = 0;
+
+        if(!req->upgrade || req->ws_key[0] == '\0') {
+            send_error(lcfd->fd, req, 400, "WebSocket handshake expected");
+            break;
+        }
+
+        /* a stopped camera starts again for active outputs */
+        frame_consumer_add(pglobal->in[input_number].ring, 1);
+
+        send_websocket(lcfd, input_number);
+
+        frame_consumer_add(pglobal->in[input_number].ring, -1);
+
+        break;
+
+    case A_EVENTS:
+        DBG("Request for events of input: %d\n", input_number);
+
+        /* the stream only ends with the connection */
+        req->keep_alive = 0;
+
+        send_events(lcfd->fd, input_number, req);
+        break;
+
+    case A_SDP:
+        DBG("Request for the multicast SDP file\n");
+        send_sdp(lcfd->fd, req);
+        break;
+
     case A_COMMAND:
-        if(false == lcfd.pc->conf.control) {
-            send_error(lcfd.fd, 501, "this server is configured to not accept control commands");
+        if(false == lcfd->pc->conf.control) {
+            send_error(lcfd->fd, req, 501, "this server is configured to not accept control commands");
         }
         else {
-            command(lcfd.pc->id, lcfd.fd, req.parameter);
+            command(lcfd->pc->id, lcfd->fd, req);
         }
         break;
     case A_INPUT_JSON:
         DBG("Request for the Input plugin descriptor JSON file\n");
-        send_Input_JSON(lcfd.fd, input_number);
+        send_Input_JSON(lcfd->fd, req, input_number);
         break;
     case A_OUTPUT_JSON:
         DBG("Request for the Output plugin descriptor JSON file\n");
-        send_Output_JSON(lcfd.fd, input_number);
+        send_Output_JSON(lcfd->fd, req, input_number);
         break;
     case A_PROGRAM_JSON:
         DBG("Request for the program descriptor JSON file\n");
-        send_Program_JSON(lcfd.fd);
+        send_Program_JSON(lcfd->fd, req);
+        break;
+    case A_STATS_JSON:
+        DBG("Request for the statistics JSON file\n");
+        send_Stats_JSON(lcfd->fd, req, &lcfd->reply);
+        break;
+    case A_MOTION_JSON:
+        DBG("Request for the motion JSON file of input: %d\n", input_number);
+        send_Motion_JSON(lcfd->fd, req, input_number, &lcfd->reply);
+        break;
+    case A_CLIP:
+        DBG("Request for a clip of input: %d\n", input_number);
+        send_clip(lcfd->fd, input_number, req, &lcfd->stats);
+        break;
+    case A_PLAYBACK:
+        DBG("Request for the playback of recordings\n");
+        send_playback(lcfd->fd, req, &lcfd->stats);
+        break;
+    case A_RECORDING:
+        DBG("Request for a recorded file\n");
+        send_recording(lcfd->fd, req);
+        break;
+    case A_TRIGGER:
+        if(false == lcfd->pc->conf.control) {
+            send_error(lcfd->fd, req, 501, "this server is configured to not accept control commands");
+        }
+        else {
+            DBG("Request to trigger the recording\n");
+            send_trigger(lcfd->fd, req);
+        }
+        break;
+    case A_RECORDINGS_JSON:
+        DBG("Request for the recordings JSON file\n");
+        send_Recordings_JSON(lcfd->fd, req, &lcfd->reply);
         break;
     case A_FILE:
-        if(lcfd.pc->conf.www_folder == NULL)
-            send_error(lcfd.fd, 501, "no www-folder configured");
+        if(lcfd->pc->conf.www_folder == NULL)
+            send_error(lcfd->fd, req, 501, "no www-folder configured");
         else
-            send_file(lcfd.pc->id, lcfd.fd, req.parameter);
+            send_file(lcfd->pc->id, lcfd->fd, req);
         break;
     default:
         DBG("unknown request\n");
+        req->keep_alive = 0;
     }
 
-    close(lcfd.fd);
-    free_request(&req);
-
-    DBG("leaving HTTP client thread\n");
-    return NULL;
+    return req->keep_alive;
 }
 
 /******************************************************************************
-Description.: This function cleans up ressources allocated by the server_thread
-Input Value.: arg is not used
-Return Value: -
+Description.: Serve a connected TCP-client. This thread function is called
+              for each connect of a HTTP client like a webbrowser. It answers
+              the requests of the client one after the other until the
+              connection gets closed or stays idle for too long.
+Input Value.: arg is the filedescriptor and server-context of the connected TCP
+              socket. It was taken from the connection pool and is returned
+              to it by this thread function.
+Return Value: always NULL
 ******************************************************************************/
-void server_cleanup(void *arg)
+/* thread for clients that connected to this server */
+void *client_thread(void *arg)
 {
-    context *pcontext = arg;
-    int i;
+    cfd *lcfd = arg; /* local-connected-file-descriptor */
+    int served = 0;
+
+    /* we really need the fildescriptor, it comes from the connection pool */
+    if(lcfd == NULL)
+        return NULL;
 
-    OPRINT("cleaning up ressources allocated by server thread #%02d\n", pcontext->id);
+    /* the first request must arrive quickly, later ones may take until the idle timeout */
+    while(!pglobal->stop && handle_request(lcfd, (served == 0) ? 5 : KEEP_ALIVE_TIMEOUT, served))
+        served++;
 
-    for(i = 0; i < MAX_SD_LEN; i++)
-        close(pcontext->sd[i]);
+    close(lcfd->fd);
+    put_connection(lcfd);
+
+    DBG("leaving HTTP client thread\n");
+    return NULL;
 }
 
 /******************************************************************************
-Description.: Open a TCP socket and wait for clients to connect. If clients
-              connect, start a new thread for each accepted connection.
-Input Value.: arg is a pointer to the globals struct
-Return Value: always NULL, will only return on exit
+Description.: This function cleans up ressources allocated by the server_thread
+Input Value.: arg is the acceptor of the thread
+Return Value: -
 ******************************************************************************/
-void *server_thread(void *arg)
+void server_cleanup(void *arg)
 {
-    int on;
-    pthread_t client;
-    pthread_attr_t client_attr;
-    struct addrinfo *aip, *aip2;
-    struct addrinfo hints;
-    struct sockaddr_storage client_addr;
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    fd_set selectfds;
-    int max_fds = 0;
-    char name[NI_MAXHOST];
-    int err;
+    acceptor *a = arg;
     int i;
 
-    context *pcontext = arg;
-    pglobal = pcontext->pglobal;
+    OPRINT("cleaning up ressources allocated by server thread #%02d\n", a->id);
+
+    for(i = 0; i < a->sd_len; i++)
+        close(a->sd[i]);
+    a->sd_len = 0;
 
-    /* set cleanup handler to cleanup ressources */
-    pthread_cleanup_push(server_cleanup, pcontext);
+    /* the first acceptor owns the UNIX sockets */
+    for(i = 0; a->id == 0 && i < a->pc->conf.listen_count; i++) {
+        if(strncmp(a->pc->conf.listen[i], "unix:", 5) == 0)
+            unlink(a->pc->conf.listen[i] + 5);
+    }
+}
+
+/******************************************************************************
+Description.: opens the TCP sockets of one listen address, one per protocol
+              family the address resolves to
+Input Value.: * a...: acceptor the sockets are opened for
+              * host: address to bind to, NULL for all interfaces
+              * port: port number
+Return Value: number of sockets opened
+******************************************************************************/
+static int listen_tcp(acceptor *a, const char *host, const char *port)
+{
+    struct addrinfo *aip, *aip2;
+    struct addrinfo hints;
+    int on, sd, err, count = 0;
 
     bzero(&hints, sizeof(hints));
     hints.ai_family = PF_UNSPEC;
     hints.ai_flags = AI_PASSIVE;
     hints.ai_socktype = SOCK_STREAM;
 
-    snprintf(name, sizeof(name), "%d", pcontext->conf.port);
-    if((err = getaddrinfo(NULL, name, &hints, &aip)) != 0) {
-        perror(gai_strerror(err));
-        DBG("getaddrinfo %m\n");
-        exit(EXIT_FAILURE);
+    if((err = getaddrinfo(host, port, &hints, &aip)) != 0) {
+        OPRINT("%s:%s: %s\n", (host == NULL) ? "*" : host, port, gai_strerror(err));
+        return 0;
     }
 
-    for(i = 0; i < MAX_SD_LEN; i++)
-        pcontext->sd[i] = -1;
-
-    /* open sockets for server (1 socket / address family) */
-    i = 0;
     for(aip2 = aip; aip2 != NULL; aip2 = aip2->ai_next) {
-        if((pcontext->sd[i] = socket(aip2->ai_family, aip2->ai_socktype, 0)) < 0) {
+        if(a->sd_len >= MAX_SD_LEN) {
+            OPRINT("%s(): maximum number of server sockets exceeded\n", __FUNCTION__);
+            break;
+        }
+
+        if((sd = socket(aip2->ai_family, aip2->ai_socktype, 0)) < 0) {
             continue;
         }
 
         /* ignore "socket already in use" errors */
         on = 1;
-        if(setsockopt(pcontext->sd[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        if(setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
             perror("setsockopt(SO_REUSEADDR) failed");
         }
 
+        /* every acceptor binds its own socket, the kernel spreads the clients over them */
+        if(a->pc->conf.acceptors > 1 && setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("setsockopt(SO_REUSEPORT) failed");
+        }
+
         /* IPv6 socket should listen to IPv6 only, otherwise we will get "socket already in use" */
-        on = 1;
-        if(aip2->ai_family == AF_INET6 && setsockopt(pcontext->sd[i], IPPROTO_IPV6, IPV6_V6ONLY,
+        if(aip2->ai_family == AF_INET6 && setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY,
                 (const void *)&on , sizeof(on)) < 0) {
             perror("setsockopt(IPV6_V6ONLY) failed");
         }
@@ -1119,56 +2566,145 @@ void *server_thread(void *arg)
         /* perhaps we will use this keep-alive feature oneday */
         /* setsockopt(sd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)); */
 
-        if(bind(pcontext->sd[i], aip2->ai_addr, aip2->ai_addrlen) < 0) {
+        if(bind(sd, aip2->ai_addr, aip2->ai_addrlen) < 0) {
             perror("bind");
-            pcontext->sd[i] = -1;
+            close(sd);
             continue;
         }
 
-        if(listen(pcontext->sd[i], 10) < 0) {
+        if(listen(sd, a->pc->conf.backlog) < 0) {
             perror("listen");
-            pcontext->sd[i] = -1;
+            close(sd);
+            continue;
+        }
+
+        /* worker processes share the socket, the losers of a race must not block in accept() */
+        fcntl(sd, F_SETFL, O_NONBLOCK);
+
+        a->sd[a->sd_len++] = sd;
+        count++;
+    }
+
+    freeaddrinfo(aip);
+    return count;
+}
+
+/******************************************************************************
+Description.: opens a listening UNIX socket, a socket left behind by an
+              earlier run is replaced
+Input Value.: * a...: acceptor the socket is opened for
+              * path: filename of the socket
+Return Value: 1 if the socket was opened, 0 otherwise
+******************************************************************************/
+static int listen_unix(acceptor *a, const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int sd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        OPRINT("UNIX socket path too long: %s\n", path);
+        return 0;
+    }
+
+    if(a->sd_len >= MAX_SD_LEN || (sd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* never remove anything but a socket */
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    if(bind(sd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sd, a->pc->conf.backlog) < 0) {
+        perror(path);
+        close(sd);
+        return 0;
+    }
+
+    fcntl(sd, F_SETFL, O_NONBLOCK);
+
+    a->sd[a->sd_len++] = sd;
+    return 1;
+}
+
+/******************************************************************************
+Description.: opens all listening sockets of one acceptor. UNIX sockets can
+              not be shared by SO_REUSEPORT, only the first acceptor opens them.
+Input Value.: acceptor
+Return Value: number of sockets opened
+******************************************************************************/
+static int open_listeners(acceptor *a)
+{
+    config *conf = &a->pc->conf;
+    char host[NI_MAXHOST], port[NI_MAXHOST];
+    int i;
+
+    a->sd_len = 0;
+
+    if(conf->listen_count == 0) {
+        snprintf(port, sizeof(port), "%d", conf->port);
+        listen_tcp(a, NULL, port);
+    }
+
+    for(i = 0; i < conf->listen_count; i++) {
+        if(strncmp(conf->listen[i], "unix:", 5) == 0) {
+            if(a->id == 0)
+                listen_unix(a, conf->listen[i] + 5);
+        } else if(split_address(conf->listen[i], host, port, sizeof(host)) == 0) {
+            listen_tcp(a, (host[0] == '\0') ? NULL : host, port);
         } else {
-            i++;
-            if(i >= MAX_SD_LEN) {
-                OPRINT("%s(): maximum number of server sockets exceeded", __FUNCTION__);
-                i--;
-                break;
-            }
+            OPRINT("invalid listen address: %s\n", conf->listen[i]);
         }
     }
 
-    pcontext->sd_len = i;
+    return a->sd_len;
+}
 
-    if(pcontext->sd_len < 1) {
-        OPRINT("%s(): bind(%d) failed", __FUNCTION__, htons(pcontext->conf.port)); // ??? htons(pcontext->conf.port)
-        closelog();
-        exit(EXIT_FAILURE);
+/******************************************************************************
+Description.: Wait for clients to connect on the sockets of one acceptor. If
+              clients connect, start a new thread for each accepted connection.
+Input Value.: arg is the acceptor, its sockets were opened by httpd_run()
+Return Value: always NULL, will only return on exit
+******************************************************************************/
+void *server_thread(void *arg)
+{
+    pthread_t client;
+    pthread_attr_t client_attr;
+    struct sockaddr_storage client_addr;
+    struct timeval send_timeout = { .tv_sec = SEND_TIMEOUT };
+    socklen_t addr_len;
+    fd_set selectfds;
+    int max_fds = 0;
+    int err;
+    int i;
+
+    acceptor *a = arg;
+    context *pcontext = a->pc;
+    pglobal = pcontext->pglobal;
+
+    /* set cleanup handler to cleanup ressources */
+    pthread_cleanup_push(server_cleanup, a);
+
+    for(i = 0; i < a->sd_len; i++) {
+        if(a->sd[i] > max_fds)
+            max_fds = a->sd[i];
     }
 
     /* create a child for every client that connects */
     while(!pglobal->stop) {
-        //int *pfd = (int *)malloc(sizeof(int));
-        cfd *pcfd = malloc(sizeof(cfd));
-
-        if(pcfd == NULL) {
-        	DBG("failed to allocate (a very small amount of) memory\n");
-            exit(EXIT_FAILURE);
-        }
+        cfd *pcfd;
+        int fd;
 
         DBG("waiting for clients to connect\n");
 
         do {
             FD_ZERO(&selectfds);
 
-            for(i = 0; i < MAX_SD_LEN; i++) {
-                if(pcontext->sd[i] != -1) {
-                    FD_SET(pcontext->sd[i], &selectfds);
-
-                    if(pcontext->sd[i] > max_fds)
-                        max_fds = pcontext->sd[i];
-                }
-            }
+            for(i = 0; i < a->sd_len; i++)
+                FD_SET(a->sd[i], &selectfds);
 
             err = select(max_fds + 1, &selectfds, NULL, NULL, NULL);
 
@@ -1179,10 +2715,23 @@ void *server_thread(void *arg)
             }
         } while(err <= 0);
 
-        for(i = 0; i < max_fds + 1; i++) {
-            if(pcontext->sd[i] != -1 && FD_ISSET(pcontext->sd[i], &selectfds)) {
-                pcfd->fd = accept(pcontext->sd[i], (struct sockaddr *)&client_addr, &addr_len);
-                pcfd->pc = pcontext;
+        for(i = 0; i < a->sd_len; i++) {
+            if(FD_ISSET(a->sd[i], &selectfds)) {
+                addr_len = sizeof(struct sockaddr_storage);
+                if((fd = accept(a->sd[i], (struct sockaddr *)&client_addr, &addr_len)) < 0)
+                    continue;
+                a->accepted++;
+
+                /* a client that stops reading must not keep its connection and pinned slot */
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+                /* the connection pool limits the number of concurrent clients */
+                if((pcfd = get_connection(pcontext, fd)) == NULL) {
+                    DBG("client limit reached, rejecting client\n");
+                    send_error(fd, NULL, 503, "too many clients");
+                    close(fd);
+                    continue;
+                }
 
                 /* start new thread that will handle this TCP connected client */
                 DBG("create thread to handle client that just established a connection\n");
@@ -1202,7 +2751,7 @@ void *server_thread(void *arg)
 				if(pthread_create(&client, &client_attr, &client_thread, pcfd) != 0) {
                     DBG("could not launch another client thread\n");
                     close(pcfd->fd);
-                    free(pcfd);
+                    put_connection(pcfd);
                     continue;
                 }
                 pthread_detach(client);
@@ -1218,312 +2767,509 @@ void *server_thread(void *arg)
 }
 
 /******************************************************************************
-Description.: Send a JSON file which is contains information about the input plugin's
-              acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
-Return Value: -
+Description.: Serializes controls of a plugin, the menu items are included
+Input Value.: * sb....: buffer to append to
+              * params: the controls, may be NULL
+              * count.: number of controls
+              * dest..: command destination the controls belong to
+Return Value: 0 on success, -1 if the memory could not be allocated
 ******************************************************************************/
-void send_Input_JSON(int fd, int plugin_number)
+static int build_controls_json(strbuf *sb, control *params, int count, int dest)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
-
-    DBG("Serving the input plugin %d descriptor JSON file\n", plugin_number);
-
-
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"controls\": [\n");
-    if(pglobal->in[plugin_number].in_parameters != NULL) { //pglobal->in[plugin_number].parametercount=10;
-        for(i = 0; i < pglobal->in[plugin_number].parametercount; i++) {
-            char *menuString = NULL;
-            if(pglobal->in[plugin_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->in[plugin_number].in_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->in[plugin_number].in_parameters[i].ctrl.minimum; j <= pglobal->in[plugin_number].in_parameters[i].ctrl.maximum; j++) {
-                        int prevSize = 0;
-                        char* menuName=(char*)pglobal->in[plugin_number].in_parameters[i].menuitems[j].name;
-                        int itemLength = strlen(menuName)  + strlen("\"\": \"\"");
-
-
-                        {
-                            int iii;
-                            int menuNameLen=strlen(menuName) % 32;
-
-                            DBG("\n!!!menuName: %s(%i)\n", menuName, menuNameLen);
-                            for(iii=0; iii<menuNameLen; iii++){
-                                if((menuName[iii] < ' ') || (menuName[iii] > 'z'))
-                                    menuName[iii]='?';
-                                //fprintf(stderr, ". %c=%2x", menuName[iii], menuName[iii]);
-                            }
-                            //fprintf(stderr,"\n");
-                        }
-
-                        if (menuString == NULL) {
-                            prevSize = 0;
-                            menuString = (char*)calloc(itemLength + 5, sizeof(char));
-                        } else {
-                            prevSize = strlen(menuString);
-                            menuString = (char*)realloc(menuString, (strlen(menuString) + itemLength + 5) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-
-                        if(j != pglobal->in[plugin_number].in_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , menuName);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , menuName);
-                        }
-
-                        k++;
-                    }
-                }
+    int i, j;
+
+    strbuf_printf(sb, "{\n\"controls\": [\n");
+
+    for(i = 0; params != NULL && i < count; i++) {
+        strbuf_printf(sb, "{\n\"name\": ");
+        strbuf_json_string(sb, (char *)params[i].ctrl.name, sizeof(params[i].ctrl.name));
+        strbuf_printf(sb, ",\n"
+                      "\"id\": \"%d\",\n"
+                      "\"type\": \"%d\",\n"
+                      "\"min\": \"%d\",\n"
+                      "\"max\": \"%d\",\n"
+                      "\"step\": \"%d\",\n"
+                      "\"default\": \"%d\",\n"
+                      "\"value\": \"%d\",\n"
+                      "\"dest\": \"%d\",\n"
+                      "\"flags\": \"%d\",\n"
+                      "\"group\": \"%d\"",
+                      params[i].ctrl.id,
+                      params[i].ctrl.type,
+                      params[i].ctrl.minimum,
+                      params[i].ctrl.maximum,
+                      params[i].ctrl.step,
+                      params[i].ctrl.default_value,
+                      params[i].value,
+                      dest,
+                      params[i].ctrl.flags,
+                      params[i].group);
+
+        if(params[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
+            strbuf_printf(sb, ",\n\"menu\": {");
+            for(j = params[i].ctrl.minimum; params[i].menuitems != NULL && j <= params[i].ctrl.maximum; j++) {
+                strbuf_printf(sb, "\"%d\": ", j);
+                strbuf_json_string(sb, (char *)params[i].menuitems[j].name, sizeof(params[i].menuitems[j].name));
+                if(j != params[i].ctrl.maximum)
+                    strbuf_printf(sb, ", ");
             }
+            strbuf_printf(sb, "}");
+        }
 
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"0\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.name,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.id,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.type,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.minimum,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.maximum,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.step,
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.default_value,
-                    pglobal->in[plugin_number].in_parameters[i].value,
-                    // 0 is the code of the input plugin
-                    pglobal->in[plugin_number].in_parameters[i].ctrl.flags,
-                    pglobal->in[plugin_number].in_parameters[i].group
-                   );
-
-            if(pglobal->in[plugin_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
-            } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
-            }
+        strbuf_printf(sb, "\n}%s", (i != count - 1) ? ",\n" : "");
+    }
 
-            if(i != (pglobal->in[plugin_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
-        }
-    } else {
-        DBG("The input plugin has no paramters\n");
+    return strbuf_printf(sb, "\n]\n}\n");
+}
+
+/******************************************************************************
+Description.: Serializes the controls of an input plugin
+Input Value.: buffer to append to and number of the plugin
+Return Value: 0 on success, -1 if the memory could not be allocated
+******************************************************************************/
+static int build_input_json(strbuf *sb, int plugin_number)
+{
+    DBG("Serializing the input plugin %d descriptor JSON file\n", plugin_number);
+    return build_controls_json(sb, pglobal->in[plugin_number].in_parameters,
+                               pglobal->in[plugin_number].parametercount, Dest_Input);
+}
+
+/******************************************************************************
+Description.: Serializes the controls of an output plugin
+Input Value.: buffer to append to and number of the plugin
+Return Value: 0 on success, -1 if the memory could not be allocated
+******************************************************************************/
+static int build_output_json(strbuf *sb, int plugin_number)
+{
+    DBG("Serializing the output plugin %d descriptor JSON file\n", plugin_number);
+    return build_controls_json(sb, pglobal->out[plugin_number].out_parameters,
+                               pglobal->out[plugin_number].parametercount, Dest_Output);
+}
+
+/******************************************************************************
+Description.: Serializes the loaded plugins and their arguments
+Input Value.: buffer to append to, the number is not used
+Return Value: 0 on success, -1 if the memory could not be allocated
+******************************************************************************/
+static int build_program_json(strbuf *sb, int unused)
+{
+    int k;
+
+    DBG("Serializing the program descriptor JSON file\n");
+
+    strbuf_printf(sb, "{\n\"inputs\":[\n");
+    for(k = 0; k < pglobal->incnt; k++) {
+        strbuf_printf(sb, "{\n\"id\": \"%d\",\n\"name\": ", pglobal->in[k].param.id);
+        strbuf_json_string(sb, pglobal->in[k].plugin ? pglobal->in[k].plugin : "", SIZE_MAX);
+        strbuf_printf(sb, ",\n\"args\": ");
+        strbuf_json_string(sb, pglobal->in[k].param.parameters ? pglobal->in[k].param.parameters : "", SIZE_MAX);
+        strbuf_printf(sb, "\n}%s", (k != pglobal->incnt - 1) ? ", \n" : "\n");
+    }
+
+    strbuf_printf(sb, "],\n\"outputs\":[\n");
+    for(k = 0; k < pglobal->outcnt; k++) {
+        strbuf_printf(sb, "{\n\"id\": \"%d\",\n\"name\": ", pglobal->out[k].param.id);
+        strbuf_json_string(sb, pglobal->out[k].plugin ? pglobal->out[k].plugin : "", SIZE_MAX);
+        strbuf_printf(sb, ",\n\"args\": ");
+        strbuf_json_string(sb, pglobal->out[k].param.parameters ? pglobal->out[k].param.parameters : "", SIZE_MAX);
+        strbuf_printf(sb, "\n}%s", (k != pglobal->outcnt - 1) ? ", \n" : "\n");
+    }
+
+    return strbuf_printf(sb, "]}\n");
+}
+
+/******************************************************************************
+Description.: Returns a cached JSON document, it gets rebuilt if the version
+              of the described data changed since it was serialized
+Input Value.: * cache..: where the document of this kind is cached
+              * version: current version of the described data
+              * build..: serializes the document
+              * number.: plugin number passed to build
+Return Value: the document, must be returned with put_json(). NULL if the
+              memory could not be allocated.
+******************************************************************************/
+static json_doc *get_json(json_doc **cache, unsigned int version, int (*build)(strbuf *, int), int number)
+{
+    json_doc *doc;
+    strbuf sb;
+
+    pthread_mutex_lock(&json_mutex);
+    if((doc = *cache) != NULL && doc->version == version) {
+        doc->refs++;
+        pthread_mutex_unlock(&json_mutex);
+        return doc;
+    }
+
+    /* rebuilding is rare, so it is done while holding the lock */
+    strbuf_init(&sb);
+    if(build(&sb, number) < 0 || (doc = mem_malloc(sizeof(json_doc) + sb.len)) == NULL) {
+        pthread_mutex_unlock(&json_mutex);
+        strbuf_free(&sb);
+        return NULL;
     }
 
+    memcpy(doc->data, sb.data, sb.len);
+    doc->len = sb.len;
+    doc->version = version;
+    doc->refs = 2; /* the cache and the caller */
+
+    if(*cache != NULL && --(*cache)->refs == 0)
+        mem_free(*cache);
+    *cache = doc;
+    pthread_mutex_unlock(&json_mutex);
+
+    strbuf_free(&sb);
+    return doc;
+}
+
+/******************************************************************************
+Description.: returns a document taken by get_json()
+Input Value.: document
+Return Value: -
+******************************************************************************/
+static void put_json(json_doc *doc)
+{
+    pthread_mutex_lock(&json_mutex);
+    if(--doc->refs == 0)
+        mem_free(doc);
+    pthread_mutex_unlock(&json_mutex);
+}
 
-    sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            "}\n");
-    i = strlen(buffer);
+/******************************************************************************
+Description.: Sends a cached JSON document
+Input Value.: * fd.: fildescriptor to send the answer to
+              * req: the request to answer
+              * doc: the document, NULL results in an error response
+Return Value: -
+******************************************************************************/
+static void send_json(int fd, request *req, json_doc *doc)
+{
+    if(doc == NULL) {
+        send_error(fd, req, 500, "not enough memory for the JSON file");
+        return;
+    }
 
-    DBG(buffer);
+    if(send_response(fd, req, "200 OK", "application/x-javascript", "", doc->data, doc->len) < 0) {
+        DBG("unable to serve the JSON file\n");
+    }
+    put_json(doc);
+}
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the input plugin's
+              acceptable parameters
+Input Value.: * fd...........: fildescriptor to send the answer to
+              * req..........: the request to answer
+              * plugin_number: number of the input plugin
+Return Value: -
+******************************************************************************/
+void send_Input_JSON(int fd, request *req, int plugin_number)
+{
+    /* the controls belong to the capture process, worker processes ask it */
+    if(frame_owner != 0) {
+        send_json(fd, req, worker_input_json(plugin_number));
+        return;
     }
+
+    send_json(fd, req, httpd_input_json(plugin_number));
 }
 
+/******************************************************************************
+Description.: returns the serialized input plugin descriptor, it is rebuilt
+              if the controls changed
+Input Value.: number of the input plugin
+Return Value: the document, it must be returned with httpd_put_json(), NULL
+              if there is not enough memory
+******************************************************************************/
+json_doc *httpd_input_json(int plugin_number)
+{
+    return get_json(&input_json[plugin_number],
+                    __atomic_load_n(&pglobal->in[plugin_number].json_version, __ATOMIC_ACQUIRE),
+                    build_input_json, plugin_number);
+}
 
-void send_Program_JSON(int fd)
+void httpd_put_json(json_doc *doc)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do rea llocation if the buffer size is small
-    int i, k;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    put_json(doc);
+}
+
+/******************************************************************************
+Description.: Send a JSON file which lists the loaded plugins and their arguments
+Input Value.: * fd.: fildescriptor to send the answer to
+              * req: the request to answer
+Return Value: -
+******************************************************************************/
+void send_Program_JSON(int fd, request *req)
+{
+    /* the plugins do not change while the program runs */
+    send_json(fd, req, get_json(&program_json, 0, build_program_json, 0));
+}
+
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the output plugin's
+              acceptable parameters
+Input Value.: * fd...........: fildescriptor to send the answer to
+              * req..........: the request to answer
+              * plugin_number: number of the output plugin
+Return Value: -
+******************************************************************************/
+void send_Output_JSON(int fd, request *req, int plugin_number)
+{
+    if(plugin_number >= pglobal->outcnt) {
+        send_error(fd, req, 404, "Invalid output plugin number");
+        return;
+    }
+
+    send_json(fd, req, get_json(&output_json[plugin_number],
+                                __atomic_load_n(&pglobal->out[plugin_number].json_version, __ATOMIC_ACQUIRE),
+                                build_output_json, plugin_number));
+}
 
-    DBG("Serving the program descriptor JSON file\n");
+/******************************************************************************
+Description.: names the answers in the statistics
+Input Value.: answer type
+Return Value: name of the answer
+******************************************************************************/
+static const char *answer_name(answer_t type)
+{
+    switch(type) {
+    case A_SNAPSHOT:     return "snapshot";
+    case A_STREAM:       return "stream";
+    case A_COMMAND:      return "command";
+    case A_FILE:         return "file";
+    case A_INPUT_JSON:   return "input.json";
+    case A_OUTPUT_JSON:  return "output.json";
+    case A_PROGRAM_JSON: return "program.json";
+    case A_STATS_JSON:   return "stats.json";
+    case A_WEBSOCKET:    return "websocket";
+    case A_EVENTS:       return "events";
+    case A_SDP:          return "sdp";
+    case A_FRAME:        return "frame";
+    case A_PLAYBACK:     return "playback";
+    case A_RECORDING:    return "recording";
+    case A_RECORDINGS_JSON: return "recordings.json";
+    case A_CLIP:         return "clip";
+    case A_MOTION_JSON:  return "motion.json";
+    case A_TRIGGER:      return "trigger";
+    default:             return "unknown";
+    }
+}
 
+/******************************************************************************
+Description.: Send a JSON file with runtime statistics, the allocation
+              counters must stay flat once all pools are warmed up
+Input Value.: * fd.: fildescriptor to send the answer to
+              * req: the request to answer
+              * sb.: reply buffer of the connection, it is reused so
+                     serving the statistics does not allocate
+Return Value: -
+******************************************************************************/
+void send_Stats_JSON(int fd, request *req, strbuf *sb)
+{
+    unsigned long allocs, frees, files, bytes, hits, misses;
+    int i, k, used = 0;
+    frame_ring *ring;
+    timeshift *history;
+    client_stats *cs;
+
+    mem_stats(&allocs, &frees);
+    filecache_stats(&files, &bytes, &hits, &misses);
+
+    pthread_mutex_lock(&connections_mutex);
+    for(i = 0; i < pglobal->max_clients; i++)
+        used += connections[i].in_use;
+    pthread_mutex_unlock(&connections_mutex);
+
+    strbuf_reset(sb);
+    strbuf_printf(sb,
+                  "{\n"
+                  "\"allocations\": %lu,\n"
+                  "\"frees\": %lu,\n"
+                  "\"clients\": %d,\n"
+                  "\"max_clients\": %d,\n"
+                  "\"worker\": %d,\n"
+                  "\"file_cache\": {\"files\": %lu, \"bytes\": %lu, \"hits\": %lu, \"misses\": %lu},\n"
+                  "\"inputs\": [\n",
+                  allocs, frees, used, pglobal->max_clients, frame_owner, files, bytes, hits, misses);
 
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            /*"\"program\": [\n"
-            "{\n"*/
-            "\"inputs\":[\n");
     for(k = 0; k < pglobal->incnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
-                "\"id\": \"%d\",\n"
-                "\"name\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
-                pglobal->in[k].param.id,
-                pglobal->in[k].plugin,
-                pglobal->in[k].param.parameters);
-        if(k != (pglobal->incnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
-    }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "],\n");
-    sprintf(buffer + strlen(buffer),
-            "\"outputs\":[\n");
-    for(k = 0; k < pglobal->outcnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
-                "\"id\": \"%d\",\n"
-                "\"name\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
-                pglobal->out[k].param.id,
-                pglobal->out[k].plugin,
-                pglobal->out[k].param.parameters);
-        if(k != (pglobal->outcnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
+        if((ring = pglobal->in[k].ring) == NULL)
+            continue;
+        strbuf_printf(sb,
+                      "{\n"
+                      "\"id\": %d,\n"
+                      "\"slots\": %d,\n"
+                      "\"slot_size\": %lu,\n"
+                      "\"published\": %lu,\n"
+                      "\"dropped\": %lu,\n"
+                      "\"fps\": %d",
+                      k, ring->slot_count, (unsigned long)ring->capacity,
+                      ring->prod.published, ring->prod.dropped, ring->demand.fps);
+
+        /* the history is written by the capture process, the numbers may be a moment old */
+        if((history = pglobal->in[k].history) != NULL) {
+            strbuf_printf(sb,
+                          ",\n\"timeshift\": {\"seconds\": %d, \"memory\": %lu, \"capacity\": %lu, "
+                          "\"bytes\": %lu, \"frames\": %u, \"stored\": %lu, \"skipped\": %lu}",
+                          history->seconds, (unsigned long)history->mapsize, (unsigned long)history->capacity,
+                          (unsigned long)history->w.bytes, history->w.next - history->w.first,
+                          history->w.stored, history->w.skipped);
+        }
+        strbuf_printf(sb, "\n}%s\n", (k != pglobal->incnt - 1) ? "," : "");
+    }
+
+    /* the counters are only written by the threads serving the connections */
+    strbuf_printf(sb, "],\n\"connections\": [\n");
+    pthread_mutex_lock(&connections_mutex);
+    for(i = 0, k = 0; i < pglobal->max_clients; i++) {
+        if(!connections[i].in_use)
+            continue;
+        cs = &connections[i].stats;
+        strbuf_printf(sb,
+                      "%s{\"type\": \"%s\", \"input\": %d, \"fps\": %d, \"every\": %d, "
+                      "\"requests\": %lu, \"frames\": %lu, \"skipped\": %lu, \"congested\": %lu, \"bytes\": %llu}",
+                      (k++ != 0) ? ",\n" : "", answer_name(cs->type), cs->input, cs->fps, cs->every,
+                      cs->requests, cs->frames, cs->skipped, cs->congested, cs->bytes);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+
+    strbuf_printf(sb, "\n],\n\"accepted\": [");
+    for(i = 0; i < server.conf.acceptors; i++)
+        strbuf_printf(sb, "%s%lu", (i != 0) ? ", " : "", server.acceptors[i].accepted);
+
+    if(strbuf_printf(sb, "]\n}\n") < 0) {
+        send_error(fd, req, 500, "not enough memory for the statistics JSON file");
+        return;
     }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "]}\n");
-    i = strlen(buffer);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the program JSON file\n");
+    if(send_response(fd, req, "200 OK", "application/x-javascript", "", sb->data, sb->len) < 0) {
+        DBG("unable to serve the statistics JSON file\n");
     }
 }
 
 /******************************************************************************
-Description.: Send a JSON file which is contains information about the output plugin's
-              acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
+Description.: Send a JSON file listing the files of the recorder output with
+              the times of their first and last frame and the recorded
+              events of the event index whose files are still there
+Input Value.: * fd.: fildescriptor to send the answer to
+              * req: the request to answer
+              * sb.: reply buffer of the connection
 Return Value: -
 ******************************************************************************/
-void send_Output_JSON(int fd, int plugin_number)
+void send_Recordings_JSON(int fd, request *req, strbuf *sb)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do re allocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
-
-    DBG("Serving the output plugin %d descriptor JSON file\n", plugin_number);
-
-
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"controls\": [\n");
-    if(pglobal->out[plugin_number].out_parameters != NULL) {
-        for(i = 0; i < pglobal->out[plugin_number].parametercount; i++) {
-            char *menuString = NULL;
-            if(pglobal->out[plugin_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->out[plugin_number].out_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->out[plugin_number].out_parameters[i].ctrl.minimum; j <= pglobal->out[plugin_number].out_parameters[i].ctrl.maximum; j++) {
-                        int prevSize = strlen(menuString);
-                        int itemLength = strlen((char*)&pglobal->out[plugin_number].out_parameters[i].menuitems[j].name)  + strlen("\"\": \"\"");
-                        if (menuString == NULL) {
-                            menuString = (char*)calloc(itemLength + 5, sizeof(char));
-                        } else {
-                            menuString = (char*)realloc(menuString, (prevSize + itemLength + 5) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Not enough memory\n");
-                            return;
-                        }
-
-                        if(j != pglobal->out[plugin_number].out_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , (char*)&pglobal->out[plugin_number].out_parameters[i].menuitems[j].name);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , (char*)&pglobal->out[plugin_number].out_parameters[i].menuitems[j].name);
-                        }
-                        k++;
-                    }
-                }
-            }
+    playback_file pf = { .fd = -1 };
+    struct dirent **names;
+    long long first, last, oldest = -1, start;
+    char path[PATH_MAX], line[256];
+    struct stat st;
+    int i, n, k = 0;
+    FILE *f;
+
+    if(recorder_cfg.folder == NULL) {
+        send_error(fd, req, 404, "no recordings, see --record");
+        return;
+    }
 
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"1\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.name,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.id,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.type,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.minimum,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.maximum,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.step,
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.default_value,
-                    pglobal->out[plugin_number].out_parameters[i].value,
-                    // 1 is the code of the output plugin
-                    pglobal->out[plugin_number].out_parameters[i].ctrl.flags,
-                    pglobal->out[plugin_number].out_parameters[i].group
-                   );
-
-            if(pglobal->out[plugin_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
-            } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
+    strbuf_reset(sb);
+    strbuf_printf(sb, "{\n\"segment\": %d,\n\"files\": [\n", recorder_cfg.segment);
+
+    if((n = playback_list(&names)) > 0) {
+        for(i = 0; i < n; i++) {
+            if(playback_open(&pf, names[i]->d_name) < 0)
+                continue;
+            if(pf.count > 0 && fstat(pf.fd, &st) == 0) {
+                first = pf.index[0].usec;
+                last = pf.index[pf.count - 1].usec;
+                if(oldest < 0)
+                    oldest = first / 1000000;
+                strbuf_printf(sb,
+                              "%s{\"name\": \"%s\", \"start\": %lld.%06lld, \"end\": %lld.%06lld, "
+                              "\"frames\": %u, \"bytes\": %lld}",
+                              (k++ != 0) ? ",\n" : "", pf.name, first / 1000000, first % 1000000,
+                              last / 1000000, last % 1000000, pf.count, (long long)st.st_size);
             }
+            playback_close(&pf);
+        }
+        playback_free_list(names, n);
+    }
 
-            if(i != (pglobal->out[plugin_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
+    strbuf_printf(sb, "\n],\n\"events\": [\n");
+    snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, RECORDER_EVENTS);
+    if(oldest >= 0 && (f = fopen(path, "r")) != NULL) {
+        k = 0;
+        while(fgets(line, sizeof(line), f) != NULL) {
+            if(sscanf(line, "{\"start\": %lld", &start) != 1 || start < oldest)
+                continue;
+            line[strcspn(line, "\n")] = '\0';
+            strbuf_printf(sb, "%s%s", (k++ != 0) ? ",\n" : "", line);
         }
-    } else {
-        DBG("The output plugin %d has no paramters\n", plugin_number);
+        fclose(f);
+    }
+
+    if(strbuf_printf(sb, "\n]\n}\n") < 0) {
+        send_error(fd, req, 500, "not enough memory for the recordings JSON file");
+        return;
+    }
+
+    if(send_response(fd, req, "200 OK", "application/x-javascript", "", sb->data, sb->len) < 0) {
+        DBG("unable to serve the recordings JSON file\n");
     }
-    sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            /*"},\n"*/);
+}
+
+/******************************************************************************
+Description.: Send a JSON file with the motion of the latest analysed frame
+              of an input: the score in permille of changed blocks, the
+              state and the region mask, one hex number per row of cells
+              with bit 0 as the left column
+Input Value.: * fd..........: fildescriptor to send the answer to
+              * req.........: the request to answer
+              * input_number: the input
+              * sb..........: reply buffer of the connection
+Return Value: -
+******************************************************************************/
+void send_Motion_JSON(int fd, request *req, int input_number, strbuf *sb)
+{
+    motion *m = pglobal->in[input_number].motion;
+    motion_result r;
+    int i;
 
-    sprintf(buffer + strlen(buffer),
-            "}\n");
-    i = strlen(buffer);
+    if(m == NULL) {
+        send_error(fd, req, 404, "no motion detection, see --motion");
+        return;
+    }
+    motion_read(m, &r);
+
+    strbuf_reset(sb);
+    strbuf_printf(sb,
+                  "{\n"
+                  "\"seq\": %u,\n"
+                  "\"timestamp\": %d.%06d,\n"
+                  "\"width\": %d,\n"
+                  "\"height\": %d,\n"
+                  "\"cols\": %d,\n"
+                  "\"rows\": %d,\n"
+                  "\"brightness\": %d,\n"
+                  "\"score\": %d,\n"
+                  "\"active\": %s,\n"
+                  "\"threshold\": %d,\n"
+                  "\"percent\": %d,\n"
+                  "\"analysed\": %lu,\n"
+                  "\"failed\": %lu,\n"
+                  "\"mask\": [",
+                  r.source_seq, (int)r.timestamp.tv_sec, (int)r.timestamp.tv_usec, r.width, r.height,
+                  r.cols, r.rows, r.brightness, r.score, r.active ? "true" : "false",
+                  motion_cfg.threshold, motion_cfg.percent, r.analysed, r.failed);
+    for(i = 0; i < MOTION_MASK_ROWS; i++)
+        strbuf_printf(sb, "%s\"%04x\"", (i != 0) ? ", " : "", r.mask[i]);
+
+    if(strbuf_printf(sb, "]\n}\n") < 0) {
+        send_error(fd, req, 500, "not enough memory for the motion JSON file");
+        return;
+    }
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
+    if(send_response(fd, req, "200 OK", "application/x-javascript", "", sb->data, sb->len) < 0) {
+        DBG("unable to serve the motion JSON file\n");
     }
 }
 
@@ -1539,16 +3285,49 @@ Return Value: 0 if everything is OK, other values signal an error
 ******************************************************************************/
 int httpd_init(void)
 {
+    int i;
+
     pglobal->out[pglobal->outcnt].plugin=OUTPUT_PLUGIN_NAME;
+    pglobal->out[pglobal->outcnt].cmd=httpd_cmd;
     pglobal->outcnt++;
 
+    /* allocate the connection pool once, clients only take entries from it */
+    connections = mem_calloc(pglobal->max_clients, sizeof(cfd));
+    if(connections == NULL) {
+        OPRINT("could not allocate memory for the connection pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* the same in all worker processes, so their ETags match */
+    boot_id = (unsigned long)time(NULL);
+
+    /* the snapshot headers are kept per frame slot */
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].ring == NULL)
+            continue;
+        snapshot_headers[i] = mem_calloc(pglobal->in[i].ring->slot_count, sizeof(snapshot_header));
+        if(snapshot_headers[i] == NULL) {
+            OPRINT("could not allocate memory for the snapshot headers\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     server.id = 0;
     server.pglobal = pglobal;
+    server.conf.acceptors = MIN(MAX(server.conf.acceptors, 1), MAX_ACCEPTORS);
+    if(server.conf.backlog < 1)
+        server.conf.backlog = LISTEN_BACKLOG;
 
     OPRINT("www-folder-path...: %s\n", (server.conf.www_folder == NULL) ? "disabled" : server.conf.www_folder );
-    OPRINT("HTTP TCP port.....: %d\n", server.conf.port );
+    if(server.conf.listen_count == 0)
+        OPRINT("HTTP TCP port.....: %d\n", server.conf.port );
+    for(i = 0; i < server.conf.listen_count; i++)
+        OPRINT("listening on......: %s\n", server.conf.listen[i]);
+    OPRINT("acceptor threads..: %d\n", server.conf.acceptors);
+    OPRINT("listen backlog....: %d\n", server.conf.backlog);
     OPRINT("username:password.: %s\n", (server.conf.auth == NULL) ? "disabled" : server.conf.auth);
     OPRINT("control commands..: %s\n", (server.conf.control) ? "enabled" : "disabled");
+    OPRINT("maximum clients...: %d\n", pglobal->max_clients);
 
     return 0;
 }
@@ -1563,25 +3342,75 @@ Return Value: always 0
 ******************************************************************************/
 int httpd_stop()
 {
+    int i;
 
-    DBG("will cancel server thread\n");
-    pthread_cancel(server.threadID);
+    DBG("will cancel server threads\n");
+    for(i = 0; i < server.conf.acceptors; i++)
+        pthread_cancel(server.acceptors[i].threadID);
 
     return 0;
 }
 
 /******************************************************************************
-Description.: This creates and starts the server thread
-Input Value.: id determines which server instance to send commands to
+Description.: This opens the listening sockets of all acceptors. Worker
+              processes inherit them, so it is called before they get forked.
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int httpd_listen()
+{
+    acceptor *a;
+    int i;
+
+    if(listening)
+        return 0;
+    listening = 1;
+
+    /* all sockets are bound before any thread runs, so errors show up at startup */
+    for(i = 0; i < server.conf.acceptors; i++) {
+        a = &server.acceptors[i];
+        a->pc = &server;
+        a->id = i;
+
+        if(open_listeners(a) < 1) {
+            /* the other acceptors only lack the UNIX sockets of the first one */
+            if(i == 0 || server.conf.listen_count == 0) {
+                OPRINT("%s(): could not open any listening socket\n", __FUNCTION__);
+                closelog();
+                exit(EXIT_FAILURE);
+            }
+            OPRINT("%s(): acceptor #%02d has no sockets, using %d acceptors\n", __FUNCTION__, i, i);
+            server.conf.acceptors = i;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: This starts the server threads, one per acceptor. In worker
+              processes it runs after the fork, so the threads of the file
+              cache and the server belong to the worker.
+Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int httpd_run()
 {
-    DBG("launching server thread\n");
+    int i;
 
-    /* create thread and pass context to thread function */
-    pthread_create(&(server.threadID), NULL, server_thread, &(server));
-    pthread_detach(server.threadID);
+    httpd_listen();
+
+    if(server.conf.www_folder != NULL)
+        filecache_init(server.conf.www_folder);
+
+    DBG("launching %d server threads\n", server.conf.acceptors);
+
+    for(i = 0; i < server.conf.acceptors; i++) {
+        /* create thread and pass acceptor to thread function */
+        pthread_create(&(server.acceptors[i].threadID), NULL, server_thread, &(server.acceptors[i]));
+        pthread_detach(server.acceptors[i].threadID);
+    }
 
     return 0;
 }
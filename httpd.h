@@ -46,18 +46,63 @@
  * Using cached pictures would lead to showing old/outdated pictures
  * Many browser seem to ignore, or at least not always obey those headers
  * since i observed caching of files from time to time.
+ *
+ * The "Connection" header is added per response, it finishes the header.
  */
-#define STD_HEADER "Connection: close\r\n" \
-    "Server: MJPG-Streamer/0.2\r\n" \
+#define STD_HEADER "Server: MJPG-Streamer/0.2\r\n" \
     "Cache-Control: no-store, no-cache, must-revalidate, pre-check=0, post-check=0, max-age=0\r\n" \
     "Pragma: no-cache\r\n" \
     "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
 
+/*
+ * Snapshots may be kept by the client as long as it revalidates them,
+ * they carry an ETag so an unchanged frame is answered with 304.
+ */
+#define REVALIDATE_HEADER "Server: MJPG-Streamer/0.2\r\n" \
+    "Cache-Control: no-cache\r\n"
+
+/* "<boot>-<input>-<sequence>" in quotes */
+#define ETAG_LEN 48
+
+/*
+ * an event stream without news sends a comment after this many seconds,
+ * so a vanished client gets noticed
+ */
+#define EVENTS_HEARTBEAT 15
+
+/* value of Sec-WebSocket-Key and Sec-WebSocket-Accept, base64 of 16 and 20 bytes */
+#define WS_KEY_LEN 32
+
+/*
+ * persistent connections are closed after this many seconds without a
+ * request or after this many requests
+ */
+#define KEEP_ALIVE_TIMEOUT 15
+#define KEEP_ALIVE_MAX 100
+
+/* a client that takes no data for this many seconds is dropped */
+#define SEND_TIMEOUT 10
+
+/* seconds a snapshot waits for a frame before it is answered with 503 */
+#define SNAPSHOT_TIMEOUT 5
+
 /*
  * Maximum number of server sockets (i.e. protocol families) to listen.
  */
 #define MAX_SD_LEN 50
 
+/* maximum number of listen addresses given with -b */
+#define MAX_LISTENERS 8
+
+/*
+ * maximum number of threads accepting clients, with more than one every
+ * thread binds its own sockets to the same ports using SO_REUSEPORT
+ */
+#define MAX_ACCEPTORS 16
+
+/* default length of the queue of pending connections per listening socket */
+#define LISTEN_BACKLOG 128
+
 #define WXP_COMPAT
 
 /*
@@ -96,17 +141,41 @@ typedef enum {
     A_INPUT_JSON,
     A_OUTPUT_JSON,
     A_PROGRAM_JSON,
+    A_STATS_JSON,
+    A_WEBSOCKET,
+    A_EVENTS,
+    A_SDP,
+    A_FRAME,
+    A_PLAYBACK,
+    A_RECORDING,
+    A_RECORDINGS_JSON,
+    A_CLIP,
+    A_MOTION_JSON,
+    A_TRIGGER,
 } answer_t;
 
+/* size of the strings the request structure keeps */
+#define REQUEST_PARAMETER_LEN 128
+#define RANGE_LEN 48
+#define REQUEST_STRING_LEN 256
+
 /*
  * the client sends information with each request
- * this structure is used to store the important parts
+ * this structure is used to store the important parts,
+ * the strings are stored inline so serving a request does not allocate
  */
 typedef struct {
     answer_t type;
-    char *parameter;
-    char *client;
-    char *auth;
+    char parameter[REQUEST_PARAMETER_LEN];
+    char client[REQUEST_STRING_LEN];
+    char auth[REQUEST_STRING_LEN];
+    char etag[REQUEST_STRING_LEN];  /* value of If-None-Match */
+    int keep_alive;                 /* connection stays open after the answer */
+    int gzip;                       /* client accepts gzip content encoding */
+    int upgrade;                    /* client asks for a WebSocket */
+    char ws_key[WS_KEY_LEN];        /* value of Sec-WebSocket-Key */
+    char last_event[ETAG_LEN];      /* value of Last-Event-ID */
+    char range[RANGE_LEN];          /* value of Range without "bytes=" */
 } request;
 
 /* the iobuffer structure is used to read from the HTTP-client */
@@ -121,40 +190,105 @@ typedef struct {
     char *auth;
     char *www_folder;
     bool control;
+    char *listen[MAX_LISTENERS];    /* "host:port", "[IPv6 address]:port", "port" or "unix:/path" */
+    int listen_count;               /* without listen addresses all interfaces are used at "port" */
+    int acceptors;                  /* number of threads accepting clients */
+    int backlog;                    /* queue length of pending connections */
 } config;
 
-/* context of each server thread */
+typedef struct _context context;
+
+/* thread accepting clients on its own set of listening sockets */
 typedef struct {
+    context *pc;
+    int id;
     int sd[MAX_SD_LEN];
     int sd_len;
+    pthread_t threadID;
+    unsigned long accepted;         /* number of clients accepted */
+} acceptor;
+
+/* context of each server instance */
+struct _context {
     int id;
     globals *pglobal;
-    pthread_t threadID;
+    acceptor acceptors[MAX_ACCEPTORS];
 
     config conf;
-} context;
+};
+
+/* counters of one connection, reported by /stats.json */
+typedef struct {
+    answer_t type;              /* answer to the last request */
+    int input;                  /* input plugin of the last snapshot or stream */
+    int fps;                    /* frame rate the stream was limited to, 0 if not */
+    int every;                  /* only every n-th frame is streamed, 0 if all */
+    unsigned long requests;
+    unsigned long frames;       /* frames sent */
+    unsigned long skipped;      /* frames dropped by fps or every */
+    unsigned long congested;    /* frames dropped because the client was still reading */
+    unsigned long long bytes;   /* frame bytes sent */
+} client_stats;
 
 /*
  * this struct is just defined to allow passing all necessary details to a worker thread
  * "cfd" is for connected/accepted filedescriptor
+ * The structures are taken from a pool with one entry per allowed client,
+ * so they also hold the per connection buffers.
  */
 typedef struct {
     context *pc;
     int fd;
+    int in_use;
+    iobuffer iobuf;
+    request req;
+    strbuf reply;   /* reused for generated responses, it only grows */
+    client_stats stats;
 } cfd;
 
+/*
+ * prebuilt response header for the frame in one slot of a frame ring,
+ * concurrent snapshot requests for the same frame share it
+ */
+typedef struct {
+    unsigned int seq;           /* frame the header belongs to, 0 while it gets built */
+    int building;               /* set while one client thread builds the header */
+    int len;
+    char header[BUFFER_SIZE / 2];
+} snapshot_header;
+
+/*
+ * serialized JSON document, shared by all requests until the data it
+ * describes changes
+ */
+typedef struct {
+    int refs;                   /* the cache holds one reference */
+    unsigned int version;       /* version of the data it was built from */
+    size_t len;
+    char data[];
+} json_doc;
+
 extern context server;
 
 /* prototypes */
 void *server_thread(void *arg);
-void send_error(int fd, int which, char *message);
-void send_Output_JSON(int fd, int plugin_number);
-void send_Input_JSON(int fd, int plugin_number);
-void send_Program_JSON(int fd);
+int _read(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout);
+int _readline(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout);
+void decodeBase64(char *data);
+void send_error(int fd, request *req, int which, char *message);
+void send_Output_JSON(int fd, request *req, int plugin_number);
+void send_Input_JSON(int fd, request *req, int plugin_number);
+void send_Program_JSON(int fd, request *req);
+void send_Stats_JSON(int fd, request *req, strbuf *sb);
+void send_Recordings_JSON(int fd, request *req, strbuf *sb);
+void send_Motion_JSON(int fd, request *req, int input_number, strbuf *sb);
 
 int httpd_init(void);
 int httpd_stop(void);
+int httpd_listen(void);
 int httpd_run(void);
+json_doc *httpd_input_json(int plugin_number);
+void httpd_put_json(json_doc *doc);
 int httpd_cmd(int plugin, unsigned int control_id, unsigned int group, int value);
 
 #endif
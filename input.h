@@ -62,25 +62,22 @@ struct _input {
     // input plugin parameters
     struct _control *in_parameters;
     int parametercount;
+    unsigned int json_version; // incremented whenever controls, resolution or format change
 
 
     struct v4l2_jpegcompression jpegcomp;
 
-    /* signal fresh frames */
-    pthread_mutex_t db;
-    pthread_cond_t  db_update;
+    /*
+     * published JPG frames, this is more or less the "database",
+     * it also counts the active outputs
+     */
+    frame_ring *ring;
 
-    /* signal acitve outputs */
-    pthread_mutex_t out;
-    pthread_cond_t  out_update;
-    int num_outs;
+    /* copies of the frames of the last seconds, NULL without --timeshift */
+    timeshift *history;
 
-    /* global JPG frame, this is more or less the "database" */
-    unsigned char *buf;
-    int size;
-
-    /* v4l2_buffer timestamp */
-    struct timeval timestamp;
+    /* block grid and motion of the latest frame, NULL without --motion */
+    motion *motion;
 
     input_format *in_formats;
     int formatCount;
@@ -0,0 +1,404 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/* memmem() and strcasestr() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "httpd.h"
+#include "input_http.h"
+
+#define INPUT_PLUGIN_NAME "HTTP relay input"
+
+struct input_http_config input_http_cfg = {
+    .url = NULL,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static int plugin_id;
+static pthread_t relay_thread;
+
+static url_parts upstream_url;
+
+/* buffered connection to the upstream server */
+typedef struct {
+    int fd;
+    size_t start, end;          /* unread part of the buffer */
+    char buffer[INPUT_HTTP_BUFFER];
+} upstream;
+
+/******************************************************************************
+Description.: reads more data into the buffer, unread data is moved to its
+              start first
+Input Value.: connection
+Return Value: 0 if data was read, -1 on timeout, error or a full buffer
+******************************************************************************/
+static int fill(upstream *u)
+{
+    struct pollfd pfd = { .fd = u->fd, .events = POLLIN };
+    ssize_t rc;
+
+    if(u->start > 0) {
+        memmove(u->buffer, u->buffer + u->start, u->end - u->start);
+        u->end -= u->start;
+        u->start = 0;
+    }
+
+    if(u->end == sizeof(u->buffer) || poll(&pfd, 1, INPUT_HTTP_TIMEOUT * 1000) != 1 ||
+       (rc = read(u->fd, u->buffer + u->end, sizeof(u->buffer) - u->end)) <= 0)
+        return -1;
+
+    u->end += rc;
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads one line, CR and LF are removed
+Input Value.: * u...: connection
+              * line: destination, longer lines are cut
+              * len.: its size
+Return Value: 0 on success, -1 if the connection failed
+******************************************************************************/
+static int read_line(upstream *u, char *line, size_t len)
+{
+    char *nl;
+    size_t n;
+
+    while((nl = memchr(u->buffer + u->start, '\n', u->end - u->start)) == NULL) {
+        if(fill(u) < 0)
+            return -1;
+    }
+
+    n = nl - (u->buffer + u->start);
+    snprintf(line, len, "%.*s", (int)n, u->buffer + u->start);
+    line[strcspn(line, "\r")] = '\0';
+    u->start += n + 1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads a body of known length, what is not in the buffer yet is
+              read straight into the destination
+Input Value.: * u..: connection
+              * dst: destination, NULL skips the body
+              * len: length of the body
+Return Value: 0 on success, -1 if the connection failed
+******************************************************************************/
+static int read_body(upstream *u, unsigned char *dst, size_t len)
+{
+    struct pollfd pfd = { .fd = u->fd, .events = POLLIN };
+    size_t n = MIN(len, u->end - u->start);
+    ssize_t rc;
+
+    if(dst != NULL) {
+        memcpy(dst, u->buffer + u->start, n);
+        dst += n;
+    }
+    u->start += n;
+    len -= n;
+
+    while(len > 0) {
+        if(poll(&pfd, 1, INPUT_HTTP_TIMEOUT * 1000) != 1)
+            return -1;
+
+        if(dst != NULL)
+            rc = read(u->fd, dst, len);
+        else
+            rc = read(u->fd, u->buffer, MIN(len, sizeof(u->buffer)));
+        if(rc <= 0)
+            return -1;
+
+        if(dst != NULL)
+            dst += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads a body without Content-Length, it ends before the next
+              boundary line
+Input Value.: * u....: connection
+              * delim: CRLF and the boundary line
+              * dst..: destination, NULL skips the body
+              * cap..: size of the destination
+              * size.: stores the length of the body, larger than cap if it
+                       did not fit
+Return Value: 0 on success, -1 if the connection failed
+******************************************************************************/
+static int read_until(upstream *u, const char *delim, unsigned char *dst, size_t cap, size_t *size)
+{
+    size_t dlen = strlen(delim), avail, n;
+    char *found;
+
+    *size = 0;
+    for(;;) {
+        avail = u->end - u->start;
+        found = memmem(u->buffer + u->start, avail, delim, dlen);
+
+        /* the end of the buffer may hold the start of the boundary */
+        n = (found != NULL) ? (size_t)(found - (u->buffer + u->start)) : (avail >= dlen) ? avail - dlen + 1 : 0;
+
+        if(dst != NULL && *size + n <= cap)
+            memcpy(dst + *size, u->buffer + u->start, n);
+        *size += n;
+        u->start += n;
+
+        if(found != NULL)
+            return 0;
+        if(fill(u) < 0)
+            return -1;
+    }
+}
+
+/******************************************************************************
+Description.: requests the stream and publishes its frames until the
+              connection fails
+Input Value.: ring to publish the frames to
+Return Value: number of frames received
+******************************************************************************/
+static unsigned long relay(frame_ring *ring)
+{
+    char line[BUFFER_SIZE], boundary[REQUEST_PARAMETER_LEN] = "", delim[REQUEST_PARAMETER_LEN + 8], *p;
+    unsigned long frames = 0;
+    struct timespec now;
+    struct timeval timestamp;
+    unsigned int seq;
+    frame_slot *slot;
+    size_t size;
+    long sec, usec;
+    int length, rc;
+    upstream *u;
+
+    if((u = mem_malloc(sizeof(upstream))) == NULL)
+        return 0;
+    u->start = u->end = 0;
+
+    if((u->fd = connect_tcp(upstream_url.host, upstream_url.port, INPUT_HTTP_TIMEOUT)) < 0) {
+        mem_free(u);
+        return 0;
+    }
+
+    snprintf(line, sizeof(line), "GET %s HTTP/1.0\r\n" \
+             "Host: %s\r\n" \
+             "User-Agent: " SOURCE_NAME "/" SOURCE_VERSION "\r\n" \
+             "%s%s%s" \
+             "\r\n", upstream_url.path, upstream_url.host, (upstream_url.auth[0] != '\0') ? "Authorization: Basic " : "",
+             upstream_url.auth, (upstream_url.auth[0] != '\0') ? "\r\n" : "");
+    if(write(u->fd, line, strlen(line)) < 0 || read_line(u, line, sizeof(line)) < 0)
+        goto done;
+
+    if(strncmp(line, "HTTP/1.", 7) != 0 || atoi(line + 9) != 200) {
+        IPRINT("upstream answered: %.100s\n", line);
+        goto done;
+    }
+
+    /* the boundary may be quoted and may already start with "--" */
+    do {
+        if(read_line(u, line, sizeof(line)) < 0)
+            goto done;
+        if(strncasecmp(line, "Content-Type:", 13) == 0 && (p = strcasestr(line, "boundary=")) != NULL) {
+            p += 9 + (p[9] == '"');
+            snprintf(boundary, sizeof(boundary), "%.*s", (int)strcspn(p, "\";"), p);
+        }
+    } while(line[0] != '\0');
+
+    if(boundary[0] == '\0') {
+        IPRINT("upstream does not send a multipart stream\n");
+        goto done;
+    }
+    snprintf(delim, sizeof(delim), "\r\n%s%s", (strncmp(boundary, "--", 2) == 0) ? "" : "--", boundary);
+
+    IPRINT("receiving frames from %s:%s\n", upstream_url.host, upstream_url.port);
+
+    while(!pglobal->stop) {
+
+        /* the blank line after the previous frame, then the boundary */
+        do {
+            if(read_line(u, line, sizeof(line)) < 0)
+                goto done;
+        } while(strcmp(line, delim + 2) != 0);
+
+        length = -1;
+        seq = 0;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timestamp.tv_sec = now.tv_sec;
+        timestamp.tv_usec = now.tv_nsec / 1000;
+
+        for(;;) {
+            if(read_line(u, line, sizeof(line)) < 0)
+                goto done;
+            if(line[0] == '\0')
+                break;
+
+            if(strncasecmp(line, "Content-Length:", 15) == 0)
+                length = atoi(line + 15);
+            else if(strncasecmp(line, "X-Sequence:", 11) == 0)
+                seq = strtoul(line + 11, NULL, 10);
+            else if(strncasecmp(line, "X-Timestamp:", 12) == 0 && sscanf(line + 12, "%ld.%ld", &sec, &usec) == 2) {
+                timestamp.tv_sec = sec;
+                timestamp.tv_usec = usec;
+            }
+        }
+
+        /* if all slots are busy the frame is read anyway, but dropped */
+        if((slot = frame_begin(ring)) == NULL)
+            DBG("all frame slots are busy, dropping frame\n");
+
+        if(length >= 0) {
+            if(length > ring->capacity) {
+                DBG("dropping frame of %d bytes\n", length);
+                slot = NULL;
+            }
+            rc = read_body(u, (slot != NULL) ? frame_data(ring, slot) : NULL, length);
+            size = length;
+        } else {
+            rc = read_until(u, delim, (slot != NULL) ? frame_data(ring, slot) : NULL, ring->capacity, &size);
+            if(size > ring->capacity)
+                slot = NULL;
+        }
+        if(rc < 0)
+            goto done;
+
+        frames++;
+        if(slot == NULL || size == 0)
+            continue;
+
+        slot->size = size;
+        slot->timestamp = timestamp;
+        slot->source_seq = seq;
+        frame_publish(ring, slot);
+    }
+
+done:
+    close(u->fd);
+    mem_free(u);
+    return frames;
+}
+
+/******************************************************************************
+Description.: keeps the stream of the upstream server flowing, a lost
+              connection is retried with a growing delay
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *relay_frames(void *arg)
+{
+    frame_ring *ring = pglobal->in[plugin_id].ring;
+    int delay = INPUT_HTTP_BACKOFF_MIN;
+
+    while(!pglobal->stop) {
+        /* a connection that delivered frames starts the backoff again */
+        if(relay(ring) > 0)
+            delay = INPUT_HTTP_BACKOFF_MIN;
+        if(pglobal->stop)
+            break;
+
+        IPRINT("no frames from %s:%s, retrying in %d seconds\n", upstream_url.host, upstream_url.port, delay);
+        frame_event_post(ring, "error", "{\"input\": %d, \"message\": \"upstream server not reachable\"}", plugin_id);
+        sleep(delay);
+        delay = MIN(delay * 2, INPUT_HTTP_BACKOFF_MAX);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: registers the input and creates its frame ring
+Input Value.: -
+Return Value: 0 - succes, else - error
+******************************************************************************/
+int input_http_init(void)
+{
+    if(split_url(input_http_cfg.url, "80", &upstream_url) < 0 || strcmp(upstream_url.scheme, "http") != 0) {
+        IPRINT("invalid upstream URL: %s\n", input_http_cfg.url);
+        exit(EXIT_FAILURE);
+    }
+
+    plugin_id = pglobal->incnt;
+    pglobal->in[plugin_id].plugin = INPUT_PLUGIN_NAME;
+    pglobal->in[plugin_id].cmd = input_http_cmd;
+    pglobal->incnt++;
+
+    IPRINT("Upstream URL......: http://%s:%s%s\n", upstream_url.host, upstream_url.port, upstream_url.path);
+
+    /* sized like the ring of the camera, see input_uvc_init() */
+    pglobal->in[plugin_id].ring = frame_ring_create(pglobal->ring_slots,
+                                                    INPUT_HTTP_FRAME_SIZE, pglobal->workers > 0);
+    if(pglobal->in[plugin_id].ring == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts the thread receiving the frames
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int input_http_run(void)
+{
+    pthread_create(&relay_thread, NULL, relay_frames, NULL);
+    pthread_detach(relay_thread);
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops receiving frames
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int input_http_stop(void)
+{
+    pthread_cancel(relay_thread);
+    return 0;
+}
+
+/******************************************************************************
+Description.: the controls belong to the upstream camera, they are not
+              available here
+Input Value.: as for input_uvc_cmd()
+Return Value: always -1
+******************************************************************************/
+int input_http_cmd(int plugin_number, unsigned int control_id, unsigned int group, int value)
+{
+    return -1;
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef INPUT_HTTP_H
+#define INPUT_HTTP_H
+
+/*
+ * Relay input: instead of a camera the frames come from the MJPEG stream
+ * of an upstream server, e.g. another uvcstreamer. They are published
+ * unchanged, with the capture time and sequence number of the upstream.
+ */
+
+/* frames larger than this are skipped */
+#define INPUT_HTTP_FRAME_SIZE (1024*1024)
+
+/* receive buffer, the larger part of a frame is read straight into its slot */
+#define INPUT_HTTP_BUFFER (16*1024)
+
+/* seconds without data before the connection counts as lost */
+#define INPUT_HTTP_TIMEOUT 10
+
+/* the delay between reconnects doubles from the first to the last value */
+#define INPUT_HTTP_BACKOFF_MIN 1
+#define INPUT_HTTP_BACKOFF_MAX 30
+
+struct input_http_config {
+    char *url;          /* "http://[user:password@]host[:port]/path", NULL uses the camera */
+};
+
+extern struct input_http_config input_http_cfg;
+
+int input_http_init(void);
+int input_http_run(void);
+int input_http_stop(void);
+int input_http_cmd(int plugin_number, unsigned int control_id, unsigned int group, int value);
+
+#endif
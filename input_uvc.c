@@ -37,6 +37,7 @@
 #include <sys/stat.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "utils.h"
 #include "v4l2uvc.h" // this header will includes the ../../mjpg_streamer.h
@@ -45,6 +46,7 @@
 #include "dynctrl.h"
 
 #include "input_uvc.h"
+#include "shmexport.h"
 
 #define INPUT_PLUGIN_NAME "UVC webcam grabber"
 
@@ -57,9 +59,18 @@ struct input_uvc_config input_uvc_cfg = {
     .dynctrls = true,
     .gquality = 80,
     .minimum_size = 0,
-    .stop_camera = 0
+    .stop_camera = 0,
+    .fps_on_demand = 0,
+    .shm_name = NULL,
+    .shm_raw = 0
 };
 
+/*
+ * the camera runs at least this many seconds at a rate before it gets
+ * slower again
+ */
+#define FPS_HOLD 10
+
 /* private functions and variables to this plugin */
 extern struct _globals global;
 static globals *pglobal=&global;
@@ -92,7 +103,7 @@ int input_uvc_init(void)
     pglobal->incnt++;
 
     /* allocate webcam datastructure */
-    cam.videoIn = malloc(sizeof(struct vdIn));
+    cam.videoIn = mem_malloc(sizeof(struct vdIn));
     if(cam.videoIn == NULL) {
         IPRINT("not enough memory for videoIn\n");
         exit(EXIT_FAILURE);
@@ -107,6 +118,7 @@ int input_uvc_init(void)
     if(input_uvc_cfg.format == V4L2_PIX_FMT_YUYV)
         IPRINT("JPEG Quality......: %lu\n", input_uvc_cfg.gquality);
     IPRINT("Stop camera feat..: %s\n", (!input_uvc_cfg.stop_camera) ? "disabled" : "enabled");
+    IPRINT("Fps on demand.....: %s\n", (!input_uvc_cfg.fps_on_demand) ? "disabled" : "enabled");
     IPRINT("Dynctrls feat.....: %s\n", (!input_uvc_cfg.dynctrls) ? "disabled" : "enabled");
 
     DBG("vdIn pn: %d\n", cam.id);
@@ -132,6 +144,31 @@ int input_uvc_init(void)
         enumerateControls(cam.videoIn, cam.pglobal, cam.id);
     }
 
+    /*
+     * every reader pins at most one slot, the slots are counted by
+     * ring_slots(). The ring exists before the worker processes get forked.
+     */
+    cam.pglobal->in[cam.id].ring = frame_ring_create(pglobal->ring_slots,
+                                                     cam.videoIn->framesizeIn, pglobal->workers > 0);
+    if(cam.pglobal->in[cam.id].ring == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    cam.pglobal->in[cam.id].ring->demand.fps = cam.videoIn->fps_current;
+
+    /* local consumers read the frames from a named ring without any socket */
+    if(input_uvc_cfg.shm_name != NULL) {
+        if(input_uvc_cfg.shm_raw && input_uvc_cfg.format != V4L2_PIX_FMT_YUYV) {
+            IPRINT("raw pictures are only exported in YUV mode\n");
+            input_uvc_cfg.shm_raw = 0;
+        }
+        if(shmexport_init(input_uvc_cfg.shm_name, cam.pglobal->in[cam.id].ring->capacity,
+                          input_uvc_cfg.shm_raw ? cam.videoIn->framesizeIn : 0) < 0) {
+            IPRINT("could not export the frames to shared memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     return 0;
 }
 
@@ -142,12 +179,6 @@ Return Value: always 0
 ******************************************************************************/
 int input_uvc_run(void)
 {
-    cam.pglobal->in[0].buf = malloc(cam.videoIn->framesizeIn);
-    if(cam.pglobal->in[0].buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
-
     DBG("launching camera thread\n");
     /* create thread and pass context to thread function */
     pthread_create(&(cam.threadID), NULL, cam_thread, &(cam));
@@ -167,6 +198,82 @@ int input_uvc_stop(void)
     return 0;
 }
 
+/******************************************************************************
+Description.: adapts the camera frame rate to the fastest consumer. Faster
+              rates are applied at once, slower ones only after the demand
+              stayed low for FPS_HOLD seconds, so clients coming and going
+              do not restart the camera all the time.
+Input Value.: * pcontext...: context of the camera thread
+              * ring.......: frame ring of the camera
+              * checked....: second of the last check, updated
+              * lower_since: second the demand dropped below the current
+                             rate, 0 if it did not, updated
+Return Value: -
+******************************************************************************/
+static void adapt_framerate(context *pcontext, frame_ring *ring, long *checked, long *lower_since)
+{
+    struct vdIn *vd = pcontext->videoIn;
+    struct timespec now;
+    int fps;
+
+    /* the demand is polled once per second, that is cheap enough */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec == *checked)
+        return;
+    *checked = now.tv_sec;
+
+    fps = nearestFramerate(vd, frame_demand(ring, vd->fps));
+    if(fps == vd->fps_current) {
+        *lower_since = 0;
+        return;
+    }
+
+    if(fps < vd->fps_current) {
+        if(*lower_since == 0)
+            *lower_since = now.tv_sec;
+        if(now.tv_sec - *lower_since < FPS_HOLD)
+            return;
+    }
+    *lower_since = 0;
+
+    DBG("changing frame rate from %d to %d fps\n", vd->fps_current, fps);
+    if(setFramerate(vd, fps) < 0) {
+        IPRINT("could not change the frame rate to %d fps\n", fps);
+        frame_event_post(ring, "error", "{\"input\": %d, \"message\": \"could not change the frame rate to %d fps\"}",
+                         pcontext->id, fps);
+    } else {
+        frame_event_post(ring, "fps", "{\"input\": %d, \"fps\": %d}", pcontext->id, vd->fps_current);
+    }
+
+    __atomic_store_n(&ring->demand.fps, vd->fps_current, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+Description.: posts an event when the number of clients served from the ring
+              changed. It is checked once per second, so clients polling
+              snapshots do not cause an event for each request.
+Input Value.: * pcontext: context of the camera thread
+              * ring....: frame ring of the camera
+              * reported: second of the last check, updated
+              * clients.: number of clients reported last, updated
+Return Value: -
+******************************************************************************/
+static void report_clients(context *pcontext, frame_ring *ring, long *reported, int *clients)
+{
+    struct timespec now;
+    int count;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec == *reported)
+        return;
+    *reported = now.tv_sec;
+
+    if((count = frame_consumers(ring)) != *clients) {
+        *clients = count;
+        frame_event_post(ring, "clients", "{\"input\": %d, \"clients\": %d}", pcontext->id, count);
+    }
+}
+
 /******************************************************************************
 Description.: this thread worker grabs a frame and copies it to the global buffer
 Input Value.: unused
@@ -176,7 +283,12 @@ void *cam_thread(void *arg)
 {
 
     context *pcontext = arg;
+    frame_ring *ring;
+    frame_slot *slot;
+    long checked = 0, lower_since = 0, reported = 0;
+    int clients = 0;
     pglobal = pcontext->pglobal;
+    ring = pglobal->in[pcontext->id].ring;
 
     /* set cleanup handler to cleanup allocated ressources */
     pthread_cleanup_push(cam_cleanup, pcontext);
@@ -186,24 +298,25 @@ void *cam_thread(void *arg)
             usleep(1); // maybe not the best way so FIXME
         }
 
-        if(input_uvc_cfg.stop_camera == 1)
+        report_clients(pcontext, ring, &reported, &clients);
+
+        /* check active outputs, they may be served by other processes */
+        if(input_uvc_cfg.stop_camera == 1 && frame_consumers(ring) == 0)
         {
-			/* check active outputs */
-			pthread_mutex_lock(&pglobal->in[pcontext->id].out);
-			if(pglobal->in[pcontext->id].num_outs == 0)
-			{
-				/* stop camera */
-				uvcStopGrab(pcontext->videoIn);
-				/* wait for active outputs */
-				pthread_cond_wait(&pglobal->in[pcontext->id].out_update, &pglobal->in[pcontext->id].out);
-			}
-			/* allow others to access the global buffer again */
-			pthread_mutex_unlock(&pglobal->in[pcontext->id].out);
-		}
+            /* stop camera */
+            uvcStopGrab(pcontext->videoIn);
+            /* wait for active outputs */
+            while(!pglobal->stop && frame_consumers(ring) == 0)
+                frame_wait_consumers(ring, 1000);
+        }
+
+        if(input_uvc_cfg.fps_on_demand)
+            adapt_framerate(pcontext, ring, &checked, &lower_since);
 
         /* grab a frame */
         if(uvcGrab(pcontext->videoIn) < 0) {
             IPRINT("Error grabbing frames\n");
+            frame_event_post(ring, "error", "{\"input\": %d, \"message\": \"error grabbing frames\"}", pcontext->id);
             exit(EXIT_FAILURE);
         }
 
@@ -221,8 +334,14 @@ void *cam_thread(void *arg)
             continue;
         }
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[pcontext->id].db);
+        /*
+         * pick a slot no client is reading from, the capture thread never
+         * waits for clients, if all slots are busy this frame gets dropped
+         */
+        if((slot = frame_begin(ring)) == NULL) {
+            DBG("all frame slots are busy, dropping frame\n");
+            continue;
+        }
 
         /*
          * If capturing in YUV mode convert to JPEG now.
@@ -232,10 +351,10 @@ void *cam_thread(void *arg)
          */
         if(pcontext->videoIn->formatIn == V4L2_PIX_FMT_YUYV) {
             DBG("compressing frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = compress_yuyv_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framebuffer_sz, input_uvc_cfg.gquality);
+            slot->size = compress_yuyv_to_jpeg(pcontext->videoIn, frame_data(ring, slot), pcontext->videoIn->framebuffer_sz, input_uvc_cfg.gquality);
         } else {
             DBG("copying frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = memcpy_picture(pglobal->in[pcontext->id].buf, pcontext->videoIn->framebuffer, pcontext->videoIn->framebuffer_sz);
+            slot->size = memcpy_picture(frame_data(ring, slot), pcontext->videoIn->framebuffer, pcontext->videoIn->framebuffer_sz);
         }
 
 #if 0
@@ -247,12 +366,18 @@ void *cam_thread(void *arg)
 #endif
 
         /* copy this frame's timestamp to user space */
-        pglobal->in[pcontext->id].timestamp = pcontext->videoIn->timestamp;
+        slot->timestamp = pcontext->videoIn->timestamp;
 
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
-        pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+        /* make it the latest frame and signal fresh_frame */
+        frame_publish(ring, slot);
 
+        /* the latest frame is not written again until the next one is published */
+        if(input_uvc_cfg.shm_name != NULL) {
+            shmexport_publish(slot->seq, slot->timestamp, pcontext->videoIn->width, pcontext->videoIn->height,
+                              frame_data(ring, slot), slot->size,
+                              input_uvc_cfg.shm_raw ? pcontext->videoIn->framebuffer : NULL,
+                              pcontext->videoIn->framebuffer_sz, V4L2_PIX_FMT_YUYV);
+        }
 
         /* only use usleep if the fps is below 5, otherwise the overhead is too long */
         if(pcontext->videoIn->fps < 5) {
@@ -287,24 +412,21 @@ void cam_cleanup(void *arg)
     first_run = 0;
     IPRINT("cleaning up ressources allocated by input thread\n");
 
+    shmexport_close();
     close_v4l2(pcontext->videoIn);
-    if(pcontext->videoIn != NULL) free(pcontext->videoIn);
-    if(pglobal->in[pcontext->id].buf != NULL)
-        free(pglobal->in[pcontext->id].buf);
+    if(pcontext->videoIn != NULL) mem_free(pcontext->videoIn);
+    frame_ring_destroy(pglobal->in[pcontext->id].ring);
+    pglobal->in[pcontext->id].ring = NULL;
 }
 
 /******************************************************************************
-Description.: process commands, allows to set v4l2 controls
-Input Value.: * control specifies the selected v4l2 control's id
-                see struct v4l2_queryctr in the videodev2.h
-              * value is used for control that make use of a parameter.
-Return Value: depends in the command, for most cases 0 means no errors and
-              -1 signals an error. This is just rule of thumb, not more!
+Description.: executes a command, see input_uvc_cmd()
+Input Value.: as for input_uvc_cmd()
+Return Value: as for input_uvc_cmd()
 ******************************************************************************/
-int input_uvc_cmd(int plugin_number, unsigned int control_id, unsigned int group, int value)
+static int execute_cmd(int plugin_number, unsigned int control_id, unsigned int group, int value)
 {
     int ret = -1;
-    int i = 0;
     DBG("Requested cmd (id: %d) for the %d plugin. Group: %d value: %d\n", control_id, plugin_number, group, value);
     switch(group) {
     case IN_CMD_GENERIC: {
@@ -321,9 +443,10 @@ int input_uvc_cmd(int plugin_number, unsigned int control_id, unsigned int group
             return -1;
         } break;
     case IN_CMD_V4L2: {
+            /* v4l2SetControl() stores the new value of the control itself */
             ret = v4l2SetControl(cam.videoIn, control_id, value, plugin_number, pglobal);
             if(ret == 0) {
-                pglobal->in[plugin_number].in_parameters[i].value = value;
+                __atomic_add_fetch(&pglobal->in[plugin_number].json_version, 1, __ATOMIC_RELEASE);
             } else {
                 DBG("v4l2SetControl failed: %d\n", ret);
             }
@@ -340,14 +463,24 @@ int input_uvc_cmd(int plugin_number, unsigned int control_id, unsigned int group
         ret = setResolution(cam.videoIn, width, height);
         if(ret == 0) {
             pglobal->in[plugin_number].in_formats[pglobal->in[plugin_number].currentFormat].currentResolution = value;
+            __atomic_add_fetch(&pglobal->in[plugin_number].json_version, 1, __ATOMIC_RELEASE);
+            frame_event_post(pglobal->in[plugin_number].ring, "resolution",
+                             "{\"input\": %d, \"index\": %d, \"width\": %d, \"height\": %d}",
+                             plugin_number, value, width, height);
         }
         return ret;
     } break;
     case IN_CMD_JPEG_QUALITY:
-        if((value >= 0) && (value < 101)) {
+        if((value >= 0) && (value < 101) && (cam.videoIn->formatIn == V4L2_PIX_FMT_YUYV)) {
+            /* the frames are compressed here, the next one uses the new quality */
+            input_uvc_cfg.gquality = value;
+            DBG("JPEG quality of the compression is set to %d\n", value);
+            ret = 0;
+        } else if((value >= 0) && (value < 101)) {
             pglobal->in[plugin_number].jpegcomp.quality = value;
             if(IOCTL_VIDEO(cam.videoIn->fd, VIDIOC_S_JPEGCOMP, &pglobal->in[plugin_number].jpegcomp) != EINVAL) {
                 DBG("JPEG quality is set to %d\n", value);
+                __atomic_add_fetch(&pglobal->in[plugin_number].json_version, 1, __ATOMIC_RELEASE);
                 ret = 0;
             } else {
                 DBG("Setting the JPEG quality is not supported\n");
@@ -360,3 +493,28 @@ int input_uvc_cmd(int plugin_number, unsigned int control_id, unsigned int group
     return ret;
 }
 
+/******************************************************************************
+Description.: process commands, allows to set v4l2 controls
+Input Value.: * control specifies the selected v4l2 control's id
+                see struct v4l2_queryctr in the videodev2.h
+              * value is used for control that make use of a parameter.
+Return Value: depends in the command, for most cases 0 means no errors and
+              -1 signals an error. This is just rule of thumb, not more!
+******************************************************************************/
+int input_uvc_cmd(int plugin_number, unsigned int control_id, unsigned int group, int value)
+{
+    frame_ring *ring = pglobal->in[plugin_number].ring;
+    int ret = execute_cmd(plugin_number, control_id, group, value);
+
+    /* event streams are told about changes and failures, generic controls change nothing */
+    if(ret != 0)
+        frame_event_post(ring, "error", "{\"input\": %d, \"message\": \"command failed\", "
+                         "\"id\": %u, \"group\": %u, \"value\": %d, \"result\": %d}",
+                         plugin_number, control_id, group, value, ret);
+    else if(group == IN_CMD_V4L2 || group == IN_CMD_JPEG_QUALITY)
+        frame_event_post(ring, "control", "{\"input\": %d, \"id\": %u, \"group\": %u, \"value\": %d}",
+                         plugin_number, control_id, group, value);
+
+    return ret;
+}
+
@@ -31,6 +31,9 @@ struct input_uvc_config {
     size_t gquality;
     size_t minimum_size;
     int stop_camera;
+    int fps_on_demand;
+    char *shm_name;     /* frames are exported to this shared memory ring, NULL if not */
+    int shm_raw;        /* the raw YUYV pictures are exported too */
 };
 
 extern struct input_uvc_config input_uvc_cfg;
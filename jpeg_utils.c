@@ -28,9 +28,14 @@
 #include <stdlib.h>
 
 #include "v4l2uvc.h"
+#include "utils.h"
 
 #define OUTPUT_BUF_SIZE  4096
 
+/* one line of RGB pixels, kept between frames and only grown if the resolution grows */
+static unsigned char *line_buffer = NULL;
+static int line_buffer_size = 0;
+
 typedef struct {
     struct jpeg_destination_mgr pub; /* public fields */
 
@@ -139,11 +144,16 @@ int compress_yuyv_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
     JSAMPROW row_pointer[1];
-    unsigned char *line_buffer, *yuyv;
+    unsigned char *yuyv, *tmp;
     int z;
     static int written;
 
-    line_buffer = calloc(vd->width * 3, 1);
+    if(line_buffer_size < vd->width * 3) {
+        if((tmp = mem_realloc(line_buffer, vd->width * 3)) == NULL)
+            return 0;
+        line_buffer = tmp;
+        line_buffer_size = vd->width * 3;
+    }
     yuyv = vd->framebuffer;
 
     cinfo.err = jpeg_std_error(&jerr);
@@ -198,8 +208,6 @@ int compress_yuyv_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
 
-    free(line_buffer);
-
     return (written);
 }
 
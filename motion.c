@@ -0,0 +1,650 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syslog.h>
+#include <sys/mman.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "motion.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+/* Huffman codes up to this length are decoded with one table lookup */
+#define LOOKAHEAD 9
+
+struct motion_config motion_cfg = {
+    .threshold = 0,
+    .percent = 2,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static pthread_t threads[MAX_INPUT_PLUGINS];
+static int running[MAX_INPUT_PLUGINS];
+
+/* a Huffman table of a DHT segment */
+typedef struct {
+    unsigned char look_len[1 << LOOKAHEAD];     /* 0 if the code is longer than LOOKAHEAD */
+    unsigned char look_val[1 << LOOKAHEAD];
+    int maxcode[17];                            /* largest code of each length, -1 if none */
+    int valptr[17];                             /* index of the first value of each length */
+    int mincode[17];
+    unsigned char values[256];
+    int count;                                  /* number of values */
+    int defined;
+} huff_table;
+
+/* reads the entropy coded data, stuffed zero bytes are removed */
+typedef struct {
+    const unsigned char *p, *end;
+    unsigned long long bits;    /* left aligned */
+    int count;
+} bit_reader;
+
+/* what the DC decoder needs to know about a frame */
+typedef struct {
+    huff_table dc[4], ac[4];
+    int quant[4];               /* DC entry of the quantization tables */
+    int width, height;
+    int restart;                /* MCUs between restart markers, 0 without */
+    int ncomp;
+    struct {
+        int id, h, v, tq;
+    } comp[4];
+} jpeg_info;
+
+/******************************************************************************
+Description.: builds the decoding tables from the code lengths and values
+Input Value.: * t.....: the table
+              * counts: number of codes of each length 1..16
+              * values: the symbols, ordered by code
+              * n.....: number of symbols
+Return Value: 0 on success, -1 if the codes do not fit into their lengths
+******************************************************************************/
+static int build_table(huff_table *t, const unsigned char *counts, const unsigned char *values, int n)
+{
+    int len, i, k = 0, code = 0, fill;
+
+    t->defined = 0;
+    memset(t->look_len, 0, sizeof(t->look_len));
+    memcpy(t->values, values, n);
+    t->count = n;
+
+    for(len = 1; len <= 16; len++) {
+        t->valptr[len] = k;
+        t->mincode[len] = code;
+        for(i = 0; i < counts[len - 1]; i++, k++, code++) {
+            /* too many codes of this length, they would overrun the lookahead table */
+            if(code > (1 << len) - 1) {
+                DBG("Bad Huffman table\n");
+                return -1;
+            }
+            if(len > LOOKAHEAD)
+                continue;
+            for(fill = 0; fill < 1 << (LOOKAHEAD - len); fill++) {
+                t->look_len[(code << (LOOKAHEAD - len)) | fill] = len;
+                t->look_val[(code << (LOOKAHEAD - len)) | fill] = values[k];
+            }
+        }
+        t->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    t->defined = 1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: fills the bit buffer once less than 32 bits are left, that is
+              enough for a Huffman code and its extra bits. At a marker only
+              zeros follow.
+Input Value.: the reader
+Return Value: -
+******************************************************************************/
+static inline void fill_bits(bit_reader *br)
+{
+    unsigned long long byte;
+
+    if(br->count >= 32)
+        return;
+
+    while(br->count <= 56) {
+        byte = 0;
+        if(br->p < br->end) {
+            byte = *br->p;
+            if(byte == 0xFF) {
+                if(br->p + 1 < br->end && br->p[1] == 0x00)
+                    br->p += 2;
+                else
+                    byte = 0;       /* a marker, it is not consumed */
+            } else {
+                br->p++;
+            }
+        }
+        br->bits |= byte << (56 - br->count);
+        br->count += 8;
+    }
+}
+
+static inline int get_bits(bit_reader *br, int n)
+{
+    int v = br->bits >> (64 - n);
+
+    br->bits <<= n;
+    br->count -= n;
+    return v;
+}
+
+/******************************************************************************
+Description.: decodes one Huffman coded symbol
+Input Value.: * br: the reader
+              * t.: the table
+Return Value: the symbol or -1 for an invalid code
+******************************************************************************/
+static inline int decode(bit_reader *br, huff_table *t)
+{
+    int len, code, k;
+
+    fill_bits(br);
+    if((len = t->look_len[br->bits >> (64 - LOOKAHEAD)]) != 0) {
+        code = t->look_val[br->bits >> (64 - LOOKAHEAD)];
+        get_bits(br, len);
+        return code;
+    }
+
+    for(len = LOOKAHEAD + 1; len <= 16; len++) {
+        code = br->bits >> (64 - len);
+        if(code <= t->maxcode[len]) {
+            k = t->valptr[len] + code - t->mincode[len];
+            if(k < 0 || k >= t->count)
+                return -1;
+            get_bits(br, len);
+            return t->values[k];
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: decodes the coefficients of one 8x8 block, only the DC value
+              is kept, the AC coefficients are just skipped
+Input Value.: * br: the reader
+              * dc: table of the DC coefficient
+              * ac: table of the AC coefficients
+              * pred: DC value of the previous block of the component, updated
+Return Value: 0 on success, -1 for invalid data
+******************************************************************************/
+static int skip_block(bit_reader *br, huff_table *dc, huff_table *ac, int *pred)
+{
+    int s, r, k, v;
+
+    /* a code leaves at least 16 bits in the buffer, enough for its extra bits */
+    if((s = decode(br, dc)) < 0 || s > 11)
+        return -1;
+    if(s > 0) {
+        v = get_bits(br, s);
+        if(v < (1 << (s - 1)))
+            v -= (1 << s) - 1;
+        *pred += v;
+    }
+
+    for(k = 1; k < 64; k++) {
+        if((s = decode(br, ac)) < 0)
+            return -1;
+        r = s >> 4;
+        s &= 15;
+        if(s == 0) {
+            /* end of block, or 16 zeros */
+            if(r != 15)
+                break;
+            k += 15;
+        } else {
+            k += r;
+            get_bits(br, s);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads the segments of a JPEG up to the start of the scan
+Input Value.: * jpeg: the frame
+              * len.: its length
+              * info: stores tables and picture size
+              * scan: stores the position of the SOS segment
+Return Value: 0 on success, -1 if the frame is no baseline JPEG
+******************************************************************************/
+static int read_headers(const unsigned char *jpeg, size_t len, jpeg_info *info, const unsigned char **scan)
+{
+    const unsigned char *p = jpeg + 2, *seg, *end;
+    unsigned char counts[16];
+    int marker, seglen, i, n, tc, th, pq;
+
+    if(len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        return -1;
+
+    while(p + 4 <= jpeg + len) {
+        if(p[0] != 0xFF)
+            return -1;
+        marker = p[1];
+        if(marker == 0xFF) {
+            p++;
+            continue;
+        }
+        seglen = p[2] << 8 | p[3];
+        seg = p + 4;
+        end = p + 2 + seglen;
+        if(seglen < 2 || end > jpeg + len)
+            return -1;
+
+        switch(marker) {
+        case 0xC0:  /* baseline and extended sequential, Huffman coded */
+        case 0xC1:
+            if(seglen < 8 || seg[0] != 8)
+                return -1;
+            info->height = seg[1] << 8 | seg[2];
+            info->width = seg[3] << 8 | seg[4];
+            info->ncomp = seg[5];
+            if(info->ncomp < 1 || info->ncomp > 4 || seglen < 8 + 3 * info->ncomp)
+                return -1;
+            for(i = 0; i < info->ncomp; i++) {
+                info->comp[i].id = seg[6 + 3 * i];
+                info->comp[i].h = seg[7 + 3 * i] >> 4;
+                info->comp[i].v = seg[7 + 3 * i] & 15;
+                info->comp[i].tq = seg[8 + 3 * i] & 3;
+                if(info->comp[i].h < 1 || info->comp[i].h > 4 || info->comp[i].v < 1 || info->comp[i].v > 4)
+                    return -1;
+            }
+            break;
+
+        case 0xC4:  /* one or more Huffman tables */
+            while(seg + 17 <= end) {
+                tc = seg[0] >> 4;
+                th = seg[0] & 3;
+                memcpy(counts, seg + 1, 16);
+                for(i = 0, n = 0; i < 16; i++)
+                    n += counts[i];
+                if(tc > 1 || n > 256 || seg + 17 + n > end)
+                    return -1;
+                if(build_table(tc ? &info->ac[th] : &info->dc[th], counts, seg + 17, n) < 0)
+                    return -1;
+                seg += 17 + n;
+            }
+            break;
+
+        case 0xDB:  /* one or more quantization tables, only their DC entry is needed */
+            while(seg < end) {
+                pq = seg[0] >> 4;
+                if(seg + 1 + (pq ? 128 : 64) > end)
+                    return -1;
+                info->quant[seg[0] & 3] = pq ? (seg[1] << 8 | seg[2]) : seg[1];
+                seg += 1 + (pq ? 128 : 64);
+            }
+            break;
+
+        case 0xDD:  /* restart interval */
+            if(seglen < 4)
+                return -1;
+            info->restart = seg[0] << 8 | seg[1];
+            break;
+
+        case 0xDA:
+            *scan = p;
+            return (info->ncomp > 0) ? 0 : -1;
+
+        default:
+            /* progressive, arithmetic coded or lossless frames are not analysed */
+            if(marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+                return -1;
+            break;
+        }
+
+        p = end;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: computes the mean luma of every 8x8 block of a JPEG frame from
+              the DC coefficients of the first scan, no IDCT is done
+Input Value.: * jpeg.........: the frame, a baseline JPEG with Huffman tables
+              * len..........: its length
+              * grid.........: MOTION_MAX_COLS * MOTION_MAX_ROWS bytes, stores
+                               the luma of the blocks row by row
+              * width, height: store the size of the picture
+              * cols, rows...: store the size of the grid
+Return Value: 0 on success, -1 if the frame can not be analysed
+******************************************************************************/
+int motion_luma_grid(const unsigned char *jpeg, size_t len, unsigned char *grid, int *width, int *height,
+                     int *cols, int *rows)
+{
+    jpeg_info info;
+    bit_reader br;
+    const unsigned char *scan;
+    int ns, i, c, h, v, hmax = 1, vmax = 1, mcux, mcuy, mx, my, bx, by, mcus = 0, value, quant;
+    int order[4], td[4], ta[4], pred[4] = {0, 0, 0, 0};
+
+    memset(&info, 0, sizeof(info));
+    if(read_headers(jpeg, len, &info, &scan) < 0)
+        return -1;
+
+    /* the scan lists its components with their tables */
+    ns = scan[4];
+    if(ns < 1 || ns > info.ncomp || scan + 5 + 2 * ns + 3 > jpeg + len)
+        return -1;
+    for(i = 0; i < ns; i++) {
+        for(c = 0; c < info.ncomp && info.comp[c].id != scan[5 + 2 * i]; c++);
+        if(c == info.ncomp)
+            return -1;
+        order[i] = c;
+        td[i] = scan[6 + 2 * i] >> 4 & 3;
+        ta[i] = scan[6 + 2 * i] & 3;
+        if(!info.dc[td[i]].defined || !info.ac[ta[i]].defined)
+            return -1;
+    }
+
+    /* the luma is the first component, a scan without it has no use here */
+    if(order[0] != 0)
+        return -1;
+
+    for(c = 0; c < info.ncomp; c++) {
+        hmax = MAX(hmax, info.comp[c].h);
+        vmax = MAX(vmax, info.comp[c].v);
+    }
+
+    /* a scan of a single component has one block per MCU */
+    if(ns == 1) {
+        mcux = (info.width * info.comp[0].h / hmax + 7) / 8;
+        mcuy = (info.height * info.comp[0].v / vmax + 7) / 8;
+        info.comp[0].h = info.comp[0].v = 1;
+    } else {
+        mcux = (info.width + 8 * hmax - 1) / (8 * hmax);
+        mcuy = (info.height + 8 * vmax - 1) / (8 * vmax);
+    }
+    *cols = MIN(mcux * info.comp[0].h, (info.width + 7) / 8);
+    *rows = MIN(mcuy * info.comp[0].v, (info.height + 7) / 8);
+    if(*cols < 1 || *rows < 1 || *cols > MOTION_MAX_COLS || *rows > MOTION_MAX_ROWS)
+        return -1;
+
+    *width = info.width;
+    *height = info.height;
+    quant = info.quant[info.comp[0].tq] ? info.quant[info.comp[0].tq] : 1;
+
+    br.p = scan + 2 + (scan[2] << 8 | scan[3]);
+    br.end = jpeg + len;
+    br.bits = 0;
+    br.count = 0;
+
+    for(my = 0; my < mcuy; my++) {
+        for(mx = 0; mx < mcux; mx++) {
+            /* at a restart marker the bits and DC predictions start over */
+            if(info.restart > 0 && mcus > 0 && mcus % info.restart == 0) {
+                br.bits = 0;
+                br.count = 0;
+                if(br.p + 1 < br.end && br.p[0] == 0xFF && br.p[1] >= 0xD0 && br.p[1] <= 0xD7)
+                    br.p += 2;
+                memset(pred, 0, sizeof(pred));
+            }
+            mcus++;
+
+            for(i = 0; i < ns; i++) {
+                c = order[i];
+                for(v = 0; v < ((ns == 1) ? 1 : info.comp[c].v); v++) {
+                    for(h = 0; h < ((ns == 1) ? 1 : info.comp[c].h); h++) {
+                        if(skip_block(&br, &info.dc[td[i]], &info.ac[ta[i]], &pred[i]) < 0)
+                            return -1;
+                        if(c != 0)
+                            continue;
+
+                        /* the DC coefficient is eight times the mean of the block minus 128 */
+                        bx = mx * info.comp[0].h + h;
+                        by = my * info.comp[0].v + v;
+                        if(bx < *cols && by < *rows) {
+                            value = pred[i] * quant / 8 + 128;
+                            grid[by * *cols + bx] = MAX(MIN(value, 255), 0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: copies the latest result, it is written by another thread or
+              process meanwhile
+Input Value.: * m.....: state of the input
+              * result: stores the copy
+Return Value: -
+******************************************************************************/
+void motion_read(motion *m, motion_result *result)
+{
+    unsigned int version;
+
+    do {
+        while((version = LOAD(&m->version)) & 1)
+            sched_yield();
+        memcpy(result, &m->result, sizeof(*result));
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while(LOAD(&m->version) != version);
+}
+
+/******************************************************************************
+Description.: compares the block grid of a frame against the background and
+              publishes the result. The mean change of all blocks is taken
+              as a change of the lighting and not counted.
+Input Value.: * in...: the input
+              * slot.: the frame, its grid is in m->luma
+              * w, h.: size of the picture
+              * cols, rows: size of the grid
+Return Value: -
+******************************************************************************/
+static void compare(input *in, frame_slot *slot, int w, int h, int cols, int rows)
+{
+    motion *m = in->motion;
+    motion_result *r = &m->result;
+    int i, x, y, n = cols * rows, changed = 0, diff, shift, active, was_active = r->active, cx, cy;
+    int cells[MOTION_MASK_ROWS][MOTION_MASK_COLS];
+    long long sum = 0, luma = 0, ts = timeshift_usec(&slot->timestamp);
+    unsigned short mask[MOTION_MASK_ROWS];
+
+    memset(cells, 0, sizeof(cells));
+    memset(mask, 0, sizeof(mask));
+
+    /* a new picture size starts the background over */
+    if(cols != r->cols || rows != r->rows) {
+        for(i = 0; i < n; i++)
+            m->background[i] = m->luma[i] << 8;
+    }
+
+    for(i = 0; i < n; i++) {
+        sum += (m->luma[i] << 8) - m->background[i];
+        luma += m->luma[i];
+    }
+    shift = sum / n;
+
+    for(y = 0; y < rows; y++) {
+        for(x = 0; x < cols; x++) {
+            i = y * cols + x;
+            diff = (m->luma[i] << 8) - m->background[i] - shift;
+            if(abs(diff) > motion_cfg.threshold << 8) {
+                changed++;
+                cells[y * MOTION_MASK_ROWS / rows][x * MOTION_MASK_COLS / cols]++;
+            }
+            m->background[i] += ((m->luma[i] << 8) - m->background[i]) >> MOTION_LEARN;
+        }
+    }
+
+    /* a cell counts if an eighth of its blocks changed */
+    for(cy = 0; cy < MOTION_MASK_ROWS; cy++) {
+        for(cx = 0; cx < MOTION_MASK_COLS; cx++) {
+            if(cells[cy][cx] > 0 && cells[cy][cx] * 8 * MOTION_MASK_COLS * MOTION_MASK_ROWS >= n)
+                mask[cy] |= 1 << cx;
+        }
+    }
+
+    if(changed * 100 >= n * motion_cfg.percent)
+        m->last_motion = ts;
+    active = (m->last_motion != 0 && ts - m->last_motion < MOTION_QUIET * 1000LL);
+
+    STORE(&m->version, m->version + 1);
+    r->seq = slot->seq;
+    r->source_seq = slot->source_seq;
+    r->timestamp = slot->timestamp;
+    r->width = w;
+    r->height = h;
+    r->cols = cols;
+    r->rows = rows;
+    r->brightness = luma / n;
+    r->score = changed * 1000 / n;
+    r->active = active;
+    memcpy(r->mask, mask, sizeof(mask));
+    r->analysed++;
+    STORE(&m->version, m->version + 1);
+
+    if(active != was_active) {
+        frame_event_post(in->ring, "motion", "{\"input\": %d, \"active\": %s, \"score\": %d}",
+                         (int)(in - pglobal->in), active ? "true" : "false", r->score);
+    }
+}
+
+/******************************************************************************
+Description.: analyses every published frame of an input. The detection is a
+              permanent consumer, the camera keeps running at its full rate
+              for it.
+Input Value.: the input
+Return Value: always NULL
+******************************************************************************/
+static void *detect_motion(void *arg)
+{
+    input *in = arg;
+    unsigned int seq = 0;
+    frame_slot *slot;
+    int w, h, cols, rows, rc;
+
+    frame_consumer_add(in->ring, 1);
+    frame_demand_add(in->ring, 0, 1);
+
+    while(!pglobal->stop) {
+        /* waiting for frames is no cancellation point */
+        pthread_testcancel();
+
+        if((slot = frame_acquire(in->ring, seq, 0, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        /* only the grid is taken from the frame, the slot is released right after */
+        rc = motion_luma_grid(frame_data(in->ring, slot), slot->size, in->motion->luma, &w, &h, &cols, &rows);
+        if(rc == 0)
+            compare(in, slot, w, h, cols, rows);
+        else
+            in->motion->result.failed++;
+        frame_release(slot);
+    }
+
+    frame_demand_add(in->ring, 0, -1);
+    frame_consumer_add(in->ring, -1);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: allocates the state of every input, it must happen before the
+              worker processes are forked
+Input Value.: -
+Return Value: 0 on success, -1 if the memory could not be mapped
+******************************************************************************/
+int motion_init(void)
+{
+    int k;
+
+    for(k = 0; k < pglobal->incnt; k++) {
+        if(pglobal->in[k].ring == NULL)
+            continue;
+
+        if((pglobal->in[k].motion = frame_map(sizeof(motion), pglobal->workers > 0)) == MAP_FAILED) {
+            pglobal->in[k].motion = NULL;
+            OPRINT("could not allocate the motion detection\n");
+            return -1;
+        }
+    }
+
+    OPRINT("motion detection..: blocks changing by %d, motion at %d%% of them\n", motion_cfg.threshold, motion_cfg.percent);
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts analysing the frames of every input
+Input Value.: -
+Return Value: 0 on success, -1 if a thread could not be created
+******************************************************************************/
+int motion_run(void)
+{
+    int k;
+
+    for(k = 0; k < pglobal->incnt; k++) {
+        if(pglobal->in[k].motion == NULL)
+            continue;
+
+        if(pthread_create(&threads[k], NULL, detect_motion, &pglobal->in[k]) != 0)
+            return -1;
+        running[k] = 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops the detection, the last results stay readable
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int motion_stop(void)
+{
+    int k;
+
+    for(k = 0; k < MAX_INPUT_PLUGINS; k++) {
+        if(!running[k])
+            continue;
+
+        pthread_cancel(threads[k]);
+        pthread_join(threads[k], NULL);
+        running[k] = 0;
+    }
+
+    return 0;
+}
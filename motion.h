@@ -0,0 +1,96 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <sys/time.h>
+
+/*
+ * Motion detection on the published JPEG frames without decoding them:
+ * only the DC coefficients are taken from the entropy coded data, they are
+ * the mean brightness of each 8x8 block of the luma plane. The block grid
+ * is compared against a running background, a change of the brightness of
+ * the whole picture is not counted. This costs a fraction of decoding the
+ * frame, so every frame of every input gets analysed.
+ */
+
+/* blocks of the largest picture analysed, 2048x2048 pixels */
+#define MOTION_MAX_COLS 256
+#define MOTION_MAX_ROWS 256
+
+/* the region mask divides the picture into this many cells */
+#define MOTION_MASK_COLS 16
+#define MOTION_MASK_ROWS 12
+
+/* the background follows the picture by 1/2^MOTION_LEARN of the difference per frame */
+#define MOTION_LEARN 4
+
+/* motion ends once no frame was above the level for this many ms */
+#define MOTION_QUIET 1000
+
+/* result of the latest analysed frame */
+typedef struct {
+    unsigned int seq;           /* ring sequence number of the frame, 0 before the first one */
+    unsigned int source_seq;    /* X-Sequence */
+    struct timeval timestamp;   /* capture time */
+    int width, height;
+    int cols, rows;             /* 8x8 blocks of the luma plane */
+    int brightness;             /* mean luma 0..255 */
+    int score;                  /* changed blocks in permille */
+    int active;                 /* motion is going on */
+    unsigned short mask[MOTION_MASK_ROWS]; /* cells with changed blocks, bit 0 is the left column */
+    unsigned long analysed;     /* frames analysed */
+    unsigned long failed;       /* frames that could not be parsed */
+} motion_result;
+
+/*
+ * State of one input, in shared memory with worker processes. The result
+ * is written under a sequence counter, readers copy it with motion_read().
+ */
+typedef struct {
+    unsigned int version;       /* odd while the result gets written */
+    motion_result result;
+
+    /* only used by the detecting thread */
+    long long last_motion;      /* capture time in us of the last frame above the level */
+    unsigned short background[MOTION_MAX_COLS * MOTION_MAX_ROWS]; /* luma in 8.8 fixed point */
+    unsigned char luma[MOTION_MAX_COLS * MOTION_MAX_ROWS];
+} motion;
+
+struct motion_config {
+    int threshold;      /* luma difference of a changed block, 0 disables the detection */
+    int percent;        /* changed blocks of a frame with motion */
+};
+
+extern struct motion_config motion_cfg;
+
+int motion_luma_grid(const unsigned char *jpeg, size_t len, unsigned char *grid, int *width, int *height,
+                     int *cols, int *rows);
+void motion_read(motion *m, motion_result *result);
+
+int motion_init(void);
+int motion_run(void);
+int motion_stop(void);
+
+#endif
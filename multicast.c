@@ -0,0 +1,289 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "rtp.h"
+#include "multicast.h"
+
+#define OUTPUT_PLUGIN_NAME "multicast output plugin"
+
+struct multicast_config multicast_cfg = {
+    .address = NULL,
+    .ttl = MULTICAST_TTL,
+    .rate = 0,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static int sd = -1;
+static struct sockaddr_storage group[2];   /* RTP and RTCP destination */
+static socklen_t group_len;
+static pthread_t sender;
+static int running = 0;
+static rtp_stream stream;
+static struct timespec next_packet;         /* earliest time of the next paced packet */
+
+/******************************************************************************
+Description.: resolves the configured "group:port"
+Input Value.: * addr: stores the group address with the RTP port
+              * len.: stores the length of the address
+              * host: stores the numeric group address, INET6_ADDRSTRLEN bytes
+              * port: stores the port
+Return Value: 0 on success, -1 if the address is not a multicast group
+******************************************************************************/
+static int resolve_group(struct sockaddr_storage *addr, socklen_t *len, char *host, int *port)
+{
+    char service[INET6_ADDRSTRLEN];
+    struct addrinfo hints, *ai;
+    int multicast;
+
+    if(multicast_cfg.address == NULL ||
+       split_address(multicast_cfg.address, host, service, INET6_ADDRSTRLEN) < 0 || host[0] == '\0')
+        return -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host, service, &hints, &ai) != 0)
+        return -1;
+
+    memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+    *len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    if(addr->ss_family == AF_INET6) {
+        multicast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)addr)->sin6_addr);
+        *port = ntohs(((struct sockaddr_in6 *)addr)->sin6_port);
+    } else {
+        multicast = IN_MULTICAST(ntohl(((struct sockaddr_in *)addr)->sin_addr.s_addr));
+        *port = ntohs(((struct sockaddr_in *)addr)->sin_port);
+    }
+
+    /* RTP gets the even port, RTCP the one above */
+    return (multicast && *port > 0 && *port % 2 == 0) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: sends one packet to the group, used as rtp_send_fn. With a
+              configured rate it waits until the previous packets used up
+              their share of it, so a frame does not leave as one burst.
+Input Value.: * arg....: not used
+              * channel: 0 for RTP, 1 for RTCP
+              * iov....: parts of the packet
+              * iovcnt.: number of parts
+Return Value: always 0, receivers may come and go at any time
+******************************************************************************/
+static int send_packet(void *arg, int channel, struct iovec *iov, int iovcnt)
+{
+    struct timespec now;
+    struct msghdr msg;
+    long long gap;
+    size_t len = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if(multicast_cfg.rate > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec < next_packet.tv_sec || (now.tv_sec == next_packet.tv_sec && now.tv_nsec < next_packet.tv_nsec))
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_packet, NULL);
+        else
+            next_packet = now;
+
+        /* nanoseconds this packet takes at the configured rate */
+        gap = (long long)len * 8 * 1000000 / multicast_cfg.rate;
+        next_packet.tv_sec += (next_packet.tv_nsec + gap) / 1000000000;
+        next_packet.tv_nsec = (next_packet.tv_nsec + gap) % 1000000000;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &group[channel];
+    msg.msg_namelen = group_len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    if(sendmsg(sd, &msg, 0) < 0)
+        DBG("multicast packet not sent: %s\n", strerror(errno));
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: sends every published frame of the first input to the group
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *send_frames(void *arg)
+{
+    frame_ring *ring = pglobal->in[0].ring;
+    unsigned int seq = 0, skipped = 0;
+    time_t reported = 0, now;
+    frame_slot *slot;
+    rtp_jpeg j;
+
+    /* the receivers are unknown, so the multicast always counts as a client */
+    frame_consumer_add(ring, 1);
+    frame_demand_add(ring, 0, 1);
+
+    while(!pglobal->stop && __atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        if((slot = frame_acquire(ring, seq, 0, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        if(rtp_jpeg_parse(frame_data(ring, slot), slot->size, &j) < 0) {
+            frame_release(slot);
+            if(skipped++ == 0)
+                OPRINT("multicast: frames can not be sent as RTP/JPEG\n");
+            continue;
+        }
+
+        /* with pacing this takes a while, newer frames meanwhile are skipped */
+        rtp_send_jpeg(&stream, &j, slot->timestamp, send_packet, NULL);
+        frame_release(slot);
+
+        now = time(NULL);
+        if(now - reported >= RTCP_INTERVAL) {
+            reported = now;
+            rtp_send_sr(&stream, send_packet, NULL);
+        }
+    }
+
+    frame_demand_add(ring, 0, -1);
+    frame_consumer_add(ring, -1);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: opens the socket and starts sending to the group
+Input Value.: -
+Return Value: 0 on success, -1 otherwise
+******************************************************************************/
+int multicast_run(void)
+{
+    char host[INET6_ADDRSTRLEN];
+    unsigned char ttl;
+    int port, hops;
+
+    if(resolve_group(&group[0], &group_len, host, &port) < 0) {
+        OPRINT("not a multicast group with an even port: %s\n", multicast_cfg.address);
+        return -1;
+    }
+
+    group[1] = group[0];
+    if(group[1].ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&group[1])->sin6_port = htons(port + 1);
+    else
+        ((struct sockaddr_in *)&group[1])->sin_port = htons(port + 1);
+
+    if((sd = socket(group[0].ss_family, SOCK_DGRAM, 0)) < 0) {
+        OPRINT("multicast socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(group[0].ss_family == AF_INET6) {
+        hops = multicast_cfg.ttl;
+        setsockopt(sd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+    } else {
+        ttl = MIN(MAX(multicast_cfg.ttl, 0), 255);
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+
+    rtp_stream_init(&stream);
+
+    OPRINT("multicast group...: %s port %d, TTL %d\n", host, port, multicast_cfg.ttl);
+    if(multicast_cfg.rate > 0)
+        OPRINT("multicast pacing..: %d kbit/s\n", multicast_cfg.rate);
+
+    running = 1;
+    if(pthread_create(&sender, NULL, send_frames, NULL) != 0) {
+        running = 0;
+        close(sd);
+        sd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops sending, the sender finishes its frame first
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int multicast_stop(void)
+{
+    if(sd < 0)
+        return 0;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+    pthread_join(sender, NULL);
+    close(sd);
+    sd = -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: describes the multicast stream for the receivers
+Input Value.: * buf...: stores the description
+              * len...: size of buf
+              * origin: address of this host
+Return Value: length of the description, -1 without multicast
+******************************************************************************/
+int multicast_sdp(char *buf, size_t len, const char *origin)
+{
+    struct sockaddr_storage addr;
+    char host[INET6_ADDRSTRLEN], connection[INET6_ADDRSTRLEN + 8];
+    socklen_t addr_len;
+    int port;
+
+    if(resolve_group(&addr, &addr_len, host, &port) < 0)
+        return -1;
+
+    /* the TTL only belongs into IPv4 connection lines */
+    if(addr.ss_family == AF_INET6)
+        snprintf(connection, sizeof(connection), "%s", host);
+    else
+        snprintf(connection, sizeof(connection), "%s/%d", host, multicast_cfg.ttl);
+
+    return rtp_sdp(buf, len, origin, connection, port, NULL);
+}
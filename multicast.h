@@ -0,0 +1,50 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include <stddef.h>
+
+/*
+ * RTP/JPEG multicast of the first input: every frame leaves the host once,
+ * however many receivers there are. They get the stream description from
+ * the HTTP server at /cam.sdp.
+ */
+
+/* hop limit of the packets if none is configured, stays in the local network */
+#define MULTICAST_TTL 1
+
+struct multicast_config {
+    char *address;      /* "group:port", NULL disables the multicast */
+    int ttl;
+    int rate;           /* kbit/s the packets are spread to, 0 sends them in bursts */
+};
+
+extern struct multicast_config multicast_cfg;
+
+int multicast_run(void);
+int multicast_stop(void);
+int multicast_sdp(char *buf, size_t len, const char *origin);
+
+#endif
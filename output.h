@@ -47,6 +47,7 @@ struct _output {
     // input plugin parameters
     struct _control *out_parameters;
     int parametercount;
+    unsigned int json_version; // incremented whenever the controls change
 
     int (*init)(output_parameter *param, int id);
     int (*stop)(int);
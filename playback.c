@@ -0,0 +1,285 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "playback.h"
+
+static int is_recording(const struct dirent *de)
+{
+    return recorder_is_file(de->d_name, ".avi");
+}
+
+/******************************************************************************
+Description.: lists the AVI files of the recording folder
+Input Value.: stores the array of names, sorted by time
+Return Value: number of files, -1 in case of error
+******************************************************************************/
+int playback_list(struct dirent ***names)
+{
+    return scandir(recorder_cfg.folder, names, is_recording, alphasort);
+}
+
+void playback_free_list(struct dirent **names, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+}
+
+/******************************************************************************
+Description.: builds the path of the sidecar index of a file
+Input Value.: * path: buffer of PATH_MAX bytes
+              * name: name of the AVI file
+Return Value: -
+******************************************************************************/
+static void index_path(char *path, const char *name)
+{
+    snprintf(path, PATH_MAX, "%s/%.*s.idx", recorder_cfg.folder, (int)strlen(name) - 4, name);
+}
+
+/******************************************************************************
+Description.: maps the complete sidecar index of a file, a previous mapping
+              is replaced
+Input Value.: the file, its name is set
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+static int map_index(playback_file *pf)
+{
+    recorder_index_header header;
+    char path[PATH_MAX];
+    struct stat st;
+    void *map = NULL;
+    int fd;
+
+    index_path(path, pf->name);
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+       memcmp(header.magic, RECORDER_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+       header.entry_size != sizeof(recorder_index_entry) ||
+       (st.st_size > sizeof(header) && (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if(pf->map != NULL)
+        munmap(pf->map, pf->mapsize);
+
+    /* an entry being appended right now is left out */
+    pf->map = map;
+    pf->mapsize = st.st_size;
+    pf->index = (map != NULL) ? (recorder_index_entry *)((char *)map + sizeof(header)) : NULL;
+    pf->count = (map != NULL) ? (st.st_size - sizeof(header)) / sizeof(recorder_index_entry) : 0;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads the time of the first frame of a file without mapping
+              its index
+Input Value.: name of the AVI file
+Return Value: time in us, LLONG_MAX if the file has no frames yet
+******************************************************************************/
+static long long first_usec(const char *name)
+{
+    recorder_index_entry e;
+    char path[PATH_MAX];
+    int fd;
+
+    index_path(path, name);
+    if((fd = open(path, O_RDONLY)) < 0)
+        return LLONG_MAX;
+
+    if(pread(fd, &e, sizeof(e), sizeof(recorder_index_header)) != sizeof(e))
+        e.usec = LLONG_MAX;
+    close(fd);
+
+    return e.usec;
+}
+
+/******************************************************************************
+Description.: opens a file of the recording folder and maps its index
+Input Value.: * pf..: the file, it must not be open
+              * name: name of the AVI file
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+int playback_open(playback_file *pf, const char *name)
+{
+    char path[PATH_MAX];
+
+    memset(pf, 0, sizeof(*pf));
+    strncpy(pf->name, name, sizeof(pf->name) - 1);
+
+    snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, pf->name);
+    if((pf->fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(map_index(pf) < 0) {
+        playback_close(pf);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: closes a file, closing it twice does no harm
+Input Value.: the file
+Return Value: -
+******************************************************************************/
+void playback_close(playback_file *pf)
+{
+    if(pf->map != NULL)
+        munmap(pf->map, pf->mapsize);
+    if(pf->fd >= 0)
+        close(pf->fd);
+
+    pf->map = NULL;
+    pf->index = NULL;
+    pf->count = 0;
+    pf->fd = -1;
+}
+
+/******************************************************************************
+Description.: maps the index again if the recorder appended entries since
+Input Value.: the open file
+Return Value: 1 if there are new entries, 0 otherwise
+******************************************************************************/
+int playback_refresh(playback_file *pf)
+{
+    unsigned int count = pf->count;
+    char path[PATH_MAX];
+    struct stat st;
+
+    index_path(path, pf->name);
+    if(stat(path, &st) < 0 || st.st_size == pf->mapsize || map_index(pf) < 0)
+        return 0;
+
+    return pf->count > count;
+}
+
+/******************************************************************************
+Description.: binary search for the first frame of a file at or after a time
+Input Value.: * pf..: the open file
+              * usec: wall clock time in us
+Return Value: index of the entry, pf->count if all frames are older
+******************************************************************************/
+unsigned int playback_search(playback_file *pf, long long usec)
+{
+    unsigned int lo = 0, hi = pf->count, mid;
+
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(pf->index[mid].usec < usec)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/******************************************************************************
+Description.: finds the first recorded frame at or after a time, the files
+              are searched by the time of their first frame and the index of
+              the one that may hold it afterwards
+Input Value.: * pf...: stores the open file, it must not be open
+              * usec.: wall clock time in us
+              * index: stores the index of the frame
+Return Value: 0 if there is such a frame, -1 otherwise
+******************************************************************************/
+int playback_seek(playback_file *pf, long long usec, unsigned int *index)
+{
+    struct dirent **names;
+    int n, lo, hi, mid, rc = -1;
+
+    if((n = playback_list(&names)) <= 0)
+        return -1;
+
+    /* the last file that starts at or before the time */
+    lo = 0;
+    hi = n - 1;
+    while(lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if(first_usec(names[mid]->d_name) <= usec)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    /* a time after its last frame belongs to the next file */
+    for(; lo < n && rc < 0; lo++) {
+        if(playback_open(pf, names[lo]->d_name) < 0)
+            continue;
+        if((*index = playback_search(pf, usec)) < pf->count)
+            rc = 0;
+        else
+            playback_close(pf);
+    }
+
+    playback_free_list(names, n);
+    return rc;
+}
+
+/******************************************************************************
+Description.: opens the file recorded after or before another one
+Input Value.: * name.....: name of the AVI file to start from
+              * direction: 1 for the next file, -1 for the previous one
+              * pf.......: stores the open file, it must not be open
+Return Value: 0 on success, -1 if there is no such file
+******************************************************************************/
+int playback_neighbour(const char *name, int direction, playback_file *pf)
+{
+    struct dirent **names;
+    int n, k, rc = -1;
+
+    if((n = playback_list(&names)) <= 0)
+        return -1;
+
+    /* the first file after the name or the last one before it */
+    for(k = 0; k < n && strcmp(names[k]->d_name, name) <= 0; k++);
+    if(direction < 0)
+        for(k--; k >= 0 && strcmp(names[k]->d_name, name) >= 0; k--);
+
+    for(; k >= 0 && k < n && rc < 0; k += direction)
+        rc = playback_open(pf, names[k]->d_name);
+
+    playback_free_list(names, n);
+    return rc;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <dirent.h>
+
+#include "recorder.h"
+
+/*
+ * Playback of the files of the recorder output. A point in time is found
+ * with a binary search over the files, which sort by their names, and one
+ * over the mapped sidecar index of the file. The frames are sent from the
+ * AVI file as they are, nothing gets decoded or copied.
+ */
+
+/* a playback that reached the newest recorded frame waits this many seconds for the next one */
+#define PLAYBACK_IDLE 10
+
+/* a file of the recorder, opened for reading with its index mapped */
+typedef struct {
+    char name[RECORDER_NAME_MAX + 1];
+    int fd;                         /* the AVI file, -1 if nothing is open */
+    recorder_index_entry *index;    /* entries of the frames */
+    unsigned int count;             /* entries in the mapping */
+    void *map;
+    size_t mapsize;
+} playback_file;
+
+int playback_list(struct dirent ***names);
+void playback_free_list(struct dirent **names, int n);
+int playback_open(playback_file *pf, const char *name);
+void playback_close(playback_file *pf);
+int playback_refresh(playback_file *pf);
+unsigned int playback_search(playback_file *pf, long long usec);
+int playback_seek(playback_file *pf, long long usec, unsigned int *index);
+int playback_neighbour(const char *name, int direction, playback_file *pf);
+
+#endif
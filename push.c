@@ -0,0 +1,250 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "httpd.h"
+#include "push.h"
+
+#define OUTPUT_PLUGIN_NAME "push output plugin"
+
+struct push_config push_cfg = {
+    .url = NULL,
+    .rate = 0,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static url_parts target;
+static int chunked;             /* HTTP POST, otherwise the bare stream over TCP */
+static pthread_t push_thread;
+static int running = 0;
+
+/******************************************************************************
+Description.: reads what the server answered, it only answers a POST that it
+              rejects or ends
+Input Value.: connection
+Return Value: -
+******************************************************************************/
+static void report_answer(int fd)
+{
+    char answer[REQUEST_STRING_LEN];
+    ssize_t rc;
+
+    if((rc = read(fd, answer, sizeof(answer) - 1)) <= 0) {
+        OPRINT("push: %s:%s closed the connection\n", target.host, target.port);
+        return;
+    }
+
+    answer[rc] = '\0';
+    answer[strcspn(answer, "\r\n")] = '\0';
+    OPRINT("push: %s:%s answered: %s\n", target.host, target.port, answer);
+}
+
+/******************************************************************************
+Description.: connects to the ingest server and sends frames until the
+              connection fails. The pinned slots are sent directly, every
+              frame that arrives while the previous ones are still on their
+              way or while the rate limit is used up is skipped.
+Input Value.: ring to take the frames from
+Return Value: number of frames sent
+******************************************************************************/
+static unsigned long push(frame_ring *ring)
+{
+    char header[BUFFER_SIZE], chunk[16];
+    struct timeval timeout = { .tv_sec = PUSH_TIMEOUT };
+    struct timespec now;
+    struct pollfd pfd;
+    struct iovec iov[4];
+    unsigned long frames = 0, skipped = 0;
+    unsigned int seq = 0;
+    long long next = 0, t;
+    frame_slot *slot;
+    int fd, len, size, rc;
+
+    if((fd = connect_tcp(target.host, target.port, PUSH_TIMEOUT)) < 0)
+        return 0;
+
+    /* a stalled uplink must not block the thread forever */
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if(chunked) {
+        snprintf(header, sizeof(header), "POST %s HTTP/1.1\r\n" \
+                 "Host: %s\r\n" \
+                 "User-Agent: " SOURCE_NAME "/" SOURCE_VERSION "\r\n" \
+                 "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
+                 "Transfer-Encoding: chunked\r\n" \
+                 "%s%s%s" \
+                 "\r\n", target.path, target.host, (target.auth[0] != '\0') ? "Authorization: Basic " : "",
+                 target.auth, (target.auth[0] != '\0') ? "\r\n" : "");
+        if(write(fd, header, strlen(header)) < 0) {
+            close(fd);
+            return 0;
+        }
+    }
+
+    OPRINT("push: sending frames to %s:%s\n", target.host, target.port);
+
+    frame_consumer_add(ring, 1);
+    frame_demand_add(ring, 0, 1);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while(!pglobal->stop && __atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        if(poll(&pfd, 1, 0) > 0) {
+            report_answer(fd);
+            break;
+        }
+
+        if((slot = frame_acquire(ring, seq, fd, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        t = now.tv_sec * 1000000000LL + now.tv_nsec;
+        if(socket_congested(fd) || t < next) {
+            frame_release(slot);
+            skipped++;
+            continue;
+        }
+
+        len = snprintf(header, sizeof(header), "--" BOUNDARY "\r\n" \
+                       "Content-Type: image/jpeg\r\n" \
+                       "Content-Length: %d\r\n" \
+                       "X-Timestamp: %d.%06d\r\n" \
+                       "X-Sequence: %u\r\n" \
+                       "\r\n", slot->size, (int)slot->timestamp.tv_sec, (int)slot->timestamp.tv_usec, slot->source_seq);
+        size = len + slot->size + 2;
+
+        /* one chunk holds the part header, the frame and the CRLF in front of the next boundary */
+        iov[0].iov_base = chunk;
+        iov[0].iov_len = chunked ? snprintf(chunk, sizeof(chunk), "%x\r\n", size) : 0;
+        iov[1].iov_base = header;
+        iov[1].iov_len = len;
+        iov[2].iov_base = frame_data(ring, slot);
+        iov[2].iov_len = slot->size;
+        iov[3].iov_base = "\r\n\r\n";
+        iov[3].iov_len = chunked ? 4 : 2;
+
+        rc = write_iov(fd, iov, 4);
+        frame_release(slot);
+        if(rc < 0)
+            break;
+        frames++;
+
+        /* the next frame may go out once this one used up its share of the rate */
+        if(push_cfg.rate > 0)
+            next = MAX(next, t) + (long long)size * 8 * 1000000 / push_cfg.rate;
+    }
+
+    frame_demand_add(ring, 0, -1);
+    frame_consumer_add(ring, -1);
+    close(fd);
+
+    DBG("pushed %lu frames, skipped %lu\n", frames, skipped);
+    return frames;
+}
+
+/******************************************************************************
+Description.: keeps the connection to the ingest server up, a lost
+              connection is retried with a growing delay
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *push_frames(void *arg)
+{
+    frame_ring *ring = pglobal->in[0].ring;
+    int delay = PUSH_BACKOFF_MIN;
+
+    while(!pglobal->stop && __atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        if(push(ring) > 0)
+            delay = PUSH_BACKOFF_MIN;
+        if(pglobal->stop || !__atomic_load_n(&running, __ATOMIC_RELAXED))
+            break;
+
+        OPRINT("push: connection to %s:%s failed, retrying in %d seconds\n", target.host, target.port, delay);
+        sleep(delay);
+        delay = MIN(delay * 2, PUSH_BACKOFF_MAX);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: starts pushing the frames of the first input
+Input Value.: -
+Return Value: 0 on success, -1 if the URL is not usable
+******************************************************************************/
+int push_run(void)
+{
+    if(split_url(push_cfg.url, "80", &target) < 0 ||
+       (strcmp(target.scheme, "http") != 0 && strcmp(target.scheme, "tcp") != 0)) {
+        OPRINT("invalid push URL: %s\n", push_cfg.url);
+        return -1;
+    }
+    chunked = (strcmp(target.scheme, "http") == 0);
+
+    OPRINT("push URL..........: %s://%s:%s%s\n", target.scheme, target.host, target.port, chunked ? target.path : "");
+    if(push_cfg.rate > 0)
+        OPRINT("push rate.........: %d kbit/s\n", push_cfg.rate);
+
+    running = 1;
+    if(pthread_create(&push_thread, NULL, push_frames, NULL) != 0) {
+        running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops pushing
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int push_stop(void)
+{
+    if(!__atomic_load_n(&running, __ATOMIC_RELAXED))
+        return 0;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+    pthread_cancel(push_thread);
+    pthread_join(push_thread, NULL);
+
+    return 0;
+}
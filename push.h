@@ -0,0 +1,51 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef PUSH_H
+#define PUSH_H
+
+/*
+ * Push output: for cameras that can not be reached from outside, the
+ * frames are sent to an ingest server over an outgoing connection, as a
+ * chunked HTTP POST of a multipart stream or as the bare multipart stream
+ * over TCP. Frames are skipped instead of queued when the uplink is slow.
+ */
+
+/* seconds a connect or a blocked send may take before the connection is given up */
+#define PUSH_TIMEOUT 10
+
+/* the delay between reconnects doubles from the first to the last value */
+#define PUSH_BACKOFF_MIN 1
+#define PUSH_BACKOFF_MAX 30
+
+struct push_config {
+    char *url;          /* "http://[user:password@]host[:port]/path" or "tcp://host:port", NULL disables it */
+    int rate;           /* kbit/s the frames may use, 0 for no limit */
+};
+
+extern struct push_config push_cfg;
+
+int push_run(void);
+int push_stop(void);
+
+#endif
@@ -0,0 +1,323 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/* F_SETPIPE_SZ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "rawout.h"
+
+#define OUTPUT_PLUGIN_NAME "raw output plugin"
+
+/* a frame fits into the pipe, so a reader that keeps up never blocks the writer */
+#define RAWOUT_PIPE_SIZE (1024*1024)
+
+struct rawout_config rawout_cfg = {
+    .port = 0,
+    .fifo = NULL,
+    .header = 0,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static int sd[RAWOUT_MAX_SD];
+static int sd_len = 0;
+static pthread_t accept_thread, fifo_thread;
+static int fifo_running = 0;
+static int clients = 0;
+
+/******************************************************************************
+Description.: tells whether the reader did not take all data written so far,
+              for a pipe these are the bytes it has not read yet
+Input Value.: * fd.....: socket or pipe
+              * is_pipe: fd is a pipe
+Return Value: 1 if new data would queue up behind older data, 0 otherwise
+******************************************************************************/
+static int congested(int fd, int is_pipe)
+{
+    int unread = 0;
+
+    if(!is_pipe)
+        return socket_congested(fd);
+
+    return ioctl(fd, FIONREAD, &unread) == 0 && unread > 0;
+}
+
+/******************************************************************************
+Description.: writes all parts to the non-blocking pipe, a reader that does
+              not make room within RAWOUT_TIMEOUT seconds is given up like a
+              stalled TCP reader
+Input Value.: * fd....: the pipe
+              * iov...: parts, they are changed while writing
+              * iovcnt: number of parts
+Return Value: 0 if everything was written, -1 otherwise
+******************************************************************************/
+static int write_pipe(int fd, struct iovec *iov, int iovcnt)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    ssize_t rc;
+
+    while(iovcnt > 0) {
+        if((rc = writev(fd, iov, iovcnt)) < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN || poll(&pfd, 1, RAWOUT_TIMEOUT * 1000) <= 0)
+                return -1;
+            continue;
+        }
+
+        while(iovcnt > 0 && rc >= iov->iov_len) {
+            rc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: writes the frames of the first input to one reader until it
+              goes away. The pinned slots are written directly, frames that
+              arrive while the reader is behind are skipped as for the
+              WebSocket stream.
+Input Value.: * fd.....: socket or pipe of the reader
+              * is_pipe: fd is a pipe
+Return Value: -
+******************************************************************************/
+static void serve(int fd, int is_pipe)
+{
+    frame_ring *ring = pglobal->in[0].ring;
+    unsigned int seq = 0;
+    raw_header head;
+    struct iovec iov[2];
+    frame_slot *slot;
+    int rc;
+
+    frame_consumer_add(ring, 1);
+    frame_demand_add(ring, 0, 1);
+
+    while(!pglobal->stop) {
+        if((slot = frame_acquire(ring, seq, fd, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        if(congested(fd, is_pipe)) {
+            frame_release(slot);
+            continue;
+        }
+
+        head.length = htonl(slot->size);
+        head.sequence = htonl(slot->source_seq);
+        head.tv_sec = htonl(slot->timestamp.tv_sec);
+        head.tv_usec = htonl(slot->timestamp.tv_usec);
+
+        iov[0].iov_base = &head;
+        iov[0].iov_len = rawout_cfg.header ? sizeof(head) : 0;
+        iov[1].iov_base = frame_data(ring, slot);
+        iov[1].iov_len = slot->size;
+
+        rc = is_pipe ? write_pipe(fd, iov, 2) : write_iov(fd, iov, 2);
+        frame_release(slot);
+        if(rc < 0)
+            break;
+    }
+
+    frame_demand_add(ring, 0, -1);
+    frame_consumer_add(ring, -1);
+}
+
+static void *client_thread(void *arg)
+{
+    int fd = (int)(long)arg;
+
+    serve(fd, 0);
+
+    DBG("closing raw connection %d\n", fd);
+    close(fd);
+    __atomic_sub_fetch(&clients, 1, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: accepts the clients of the TCP port, every one gets a thread
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *accept_clients(void *arg)
+{
+    struct timeval timeout = { .tv_sec = RAWOUT_TIMEOUT };
+    struct pollfd pfd[RAWOUT_MAX_SD];
+    pthread_t client;
+    int i, fd;
+
+    for(i = 0; i < sd_len; i++) {
+        pfd[i].fd = sd[i];
+        pfd[i].events = POLLIN;
+    }
+
+    while(!pglobal->stop) {
+        if(poll(pfd, sd_len, 1000) <= 0)
+            continue;
+
+        for(i = 0; i < sd_len; i++) {
+            if(!(pfd[i].revents & POLLIN) || (fd = accept(sd[i], NULL, NULL)) < 0)
+                continue;
+
+            if(__atomic_load_n(&clients, __ATOMIC_RELAXED) >= pglobal->max_clients) {
+                DBG("too many raw clients, dropping connection %d\n", fd);
+                close(fd);
+                continue;
+            }
+
+            /* a reader that stopped reading in the middle of a frame is dropped */
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            __atomic_add_fetch(&clients, 1, __ATOMIC_RELAXED);
+            if(pthread_create(&client, NULL, client_thread, (void *)(long)fd) != 0) {
+                __atomic_sub_fetch(&clients, 1, __ATOMIC_RELAXED);
+                close(fd);
+                continue;
+            }
+            pthread_detach(client);
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: feeds the named pipe whenever a reader has it open
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *feed_fifo(void *arg)
+{
+    int fd;
+
+    while(!pglobal->stop) {
+        /* without a reader the open fails, so it is tried again a second later */
+        if((fd = open(rawout_cfg.fifo, O_WRONLY | O_NONBLOCK)) < 0) {
+            sleep(1);
+            continue;
+        }
+
+        /* the pipe stays non-blocking, write_pipe() waits with a timeout */
+        fcntl(fd, F_SETPIPE_SZ, RAWOUT_PIPE_SIZE);
+
+        DBG("reader opened %s\n", rawout_cfg.fifo);
+        serve(fd, 1);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: opens the TCP port and the named pipe, the pipe is created if
+              it does not exist
+Input Value.: -
+Return Value: 0 on success, -1 if one of them could not be opened
+******************************************************************************/
+int rawout_run(void)
+{
+    struct stat st;
+
+    if(rawout_cfg.port > 0) {
+        if((sd_len = listen_port(rawout_cfg.port, sd, RAWOUT_MAX_SD)) == 0) {
+            OPRINT("could not bind to the raw TCP port %d\n", rawout_cfg.port);
+            return -1;
+        }
+
+        OPRINT("raw TCP port......: %d%s\n", rawout_cfg.port, rawout_cfg.header ? ", with frame headers" : "");
+        if(pthread_create(&accept_thread, NULL, accept_clients, NULL) != 0) {
+            while(sd_len > 0)
+                close(sd[--sd_len]);
+            return -1;
+        }
+    }
+
+    if(rawout_cfg.fifo != NULL) {
+        if(stat(rawout_cfg.fifo, &st) < 0 && mkfifo(rawout_cfg.fifo, 0666) < 0) {
+            OPRINT("could not create the named pipe %s: %s\n", rawout_cfg.fifo, strerror(errno));
+            return -1;
+        }
+        if(stat(rawout_cfg.fifo, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+            OPRINT("%s is not a named pipe\n", rawout_cfg.fifo);
+            return -1;
+        }
+
+        OPRINT("named pipe........: %s%s\n", rawout_cfg.fifo, rawout_cfg.header ? ", with frame headers" : "");
+        if(pthread_create(&fifo_thread, NULL, feed_fifo, NULL) != 0)
+            return -1;
+        fifo_running = 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops accepting clients and feeding the pipe
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int rawout_stop(void)
+{
+    if(sd_len > 0) {
+        pthread_cancel(accept_thread);
+        pthread_join(accept_thread, NULL);
+        while(sd_len > 0)
+            close(sd[--sd_len]);
+    }
+
+    if(fifo_running) {
+        pthread_cancel(fifo_thread);
+        pthread_join(fifo_thread, NULL);
+        fifo_running = 0;
+    }
+
+    return 0;
+}
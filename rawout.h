@@ -0,0 +1,60 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RAWOUT_H
+#define RAWOUT_H
+
+/*
+ * Raw outputs for machine consumers like ffmpeg (-f mjpeg): the JPEG
+ * frames of the first input are written back to back, without multipart
+ * boundaries or headers, to the clients of a TCP port and to a named pipe.
+ * Optionally every frame starts with a raw_header, then a reader does not
+ * have to search the data for the end of a frame.
+ */
+
+/* maximum number of listening sockets, one per protocol family */
+#define RAWOUT_MAX_SD 8
+
+/* seconds a blocked write may take before the reader is dropped */
+#define RAWOUT_TIMEOUT 10
+
+/* the optional header in front of every frame, all fields big endian */
+typedef struct {
+    unsigned int length;        /* bytes of the JPEG that follows */
+    unsigned int sequence;      /* like X-Sequence of the HTTP stream */
+    unsigned int tv_sec;        /* capture time, like X-Timestamp */
+    unsigned int tv_usec;
+} raw_header;
+
+struct rawout_config {
+    int port;           /* TCP port, 0 disables it */
+    char *fifo;         /* path of the named pipe, NULL disables it */
+    int header;         /* write a raw_header in front of every frame */
+};
+
+extern struct rawout_config rawout_cfg;
+
+int rawout_run(void);
+int rawout_stop(void);
+
+#endif
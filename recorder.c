@@ -0,0 +1,857 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/* O_DIRECT, fallocate() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "avi.h"
+#include "recorder.h"
+
+#define OUTPUT_PLUGIN_NAME "recorder output plugin"
+
+/* idx1 entries are converted from the sidecar index this many at a time */
+#define INDEX_CHUNK 256
+
+/* a frame size this many standard deviations from the average fires a trigger */
+#define SIZE_SIGMAS 4
+
+/* queued frames start at multiples of this */
+#define QUEUE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct recorder_config recorder_cfg = {
+    .folder = NULL,
+    .segment = RECORDER_SEGMENT,
+    .keep_mb = 0,
+    .keep_hours = 0,
+    .preroll = -1,
+    .postroll = RECORDER_POSTROLL,
+};
+
+recorder_trigger *recorder_triggers = NULL;
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+/* a frame waiting in the queue, its JPEG data follows */
+typedef struct {
+    int size;                   /* -1 marks the unused end of the queue memory */
+    unsigned int seq;
+    struct timeval timestamp;   /* capture time on the wall clock, as in X-Timestamp */
+} queued_frame;
+
+/*
+ * the grabbing thread appends frames at head, the writing thread takes
+ * them from tail, both count the bytes ever passed through the queue
+ */
+static struct {
+    unsigned char *data;
+    unsigned long long head;
+    unsigned long long tail;
+    int closing;
+    unsigned long dropped;
+    long long newest;           /* capture time of the latest frame queued */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* the file being written, only touched by the writing thread */
+static struct {
+    int fd;
+    char path[PATH_MAX];
+    unsigned char *block;           /* RECORDER_BLOCK bytes, aligned for O_DIRECT */
+    size_t fill;                    /* bytes of the block not yet written */
+    unsigned long long flushed;     /* bytes written to the file */
+    unsigned long long allocated;   /* bytes reserved with fallocate() */
+    unsigned long long estimate;    /* size of the last file, reserved at once for the next */
+    unsigned int movi_len;
+    int index_fd;                   /* the sidecar index */
+    recorder_index_entry *index;    /* entries of the frames */
+    unsigned int frames;
+    unsigned int index_size;        /* entries the index has room for */
+    unsigned int indexed;           /* entries already in the sidecar index */
+    int width, height;
+    long long first, last;          /* capture times of the first and last frame */
+    long long retry;                /* capture time a new file may be tried after a failure */
+} seg = { .fd = -1, .index_fd = -1 };
+
+/* the event being recorded in triggered mode, only touched by the writing thread */
+static struct {
+    int active;
+    int reason;
+    long long start, end;       /* wall clock times of the first and last frame */
+    unsigned int frames;
+    char file[RECORDER_NAME_MAX + 1];
+} event;
+
+static pthread_t grab_thread, write_thread;
+static int grabbing = 0, writing = 0;
+
+/******************************************************************************
+Description.: copies a frame into the queue, it is dropped if the writer is
+              too far behind
+Input Value.: * ring: ring the frame was published on
+              * slot: the pinned frame
+Return Value: -
+******************************************************************************/
+static void queue_frame(frame_ring *ring, frame_slot *slot)
+{
+    size_t need = QUEUE_ALIGN(sizeof(queued_frame) + slot->size), off, skip = 0;
+    unsigned long long head = queue.head;
+    queued_frame *q;
+
+    /* a frame does not wrap around the end of the queue memory */
+    off = head % RECORDER_QUEUE;
+    if(off + need > RECORDER_QUEUE)
+        skip = RECORDER_QUEUE - off;
+
+    if(need > RECORDER_QUEUE / 2 || head + skip + need - __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE) > RECORDER_QUEUE) {
+        queue.dropped++;
+        return;
+    }
+
+    if(skip >= sizeof(queued_frame))
+        ((queued_frame *)(queue.data + off))->size = -1;
+
+    q = (queued_frame *)(queue.data + (head + skip) % RECORDER_QUEUE);
+    q->size = slot->size;
+    q->seq = slot->source_seq;
+    q->timestamp = slot->timestamp;
+    memcpy(q + 1, frame_data(ring, slot), slot->size);
+
+    pthread_mutex_lock(&queue.mutex);
+    queue.head = head + skip + need;
+    queue.newest = timeshift_usec(&q->timestamp);
+    pthread_cond_signal(&queue.cond);
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+/******************************************************************************
+Description.: fires the trigger for frames with motion, without motion
+              detection for frames whose size jumps away from the average,
+              since a changing picture compresses differently
+Input Value.: the size of the frame just queued
+Return Value: -
+******************************************************************************/
+static void detect_event(int size)
+{
+    static double mean = 0, variance = 0;
+    static unsigned int frames = 0;
+    motion *m = pglobal->in[0].motion;
+    motion_result r;
+    double d;
+
+    /* frames the motion detection can not analyse fall back to the size */
+    if(m != NULL) {
+        motion_read(m, &r);
+        if(r.analysed > 0) {
+            if(r.active)
+                recorder_fire(RECORDER_MOTION, recorder_cfg.postroll);
+            return;
+        }
+    }
+
+    if(frames == 0) {
+        mean = size;
+        frames = 1;
+        return;
+    }
+
+    d = size - mean;
+    if(frames >= 16 && d * d > SIZE_SIGMAS * SIZE_SIGMAS * variance && (d < 0 ? -d : d) > mean / 32)
+        recorder_fire(RECORDER_SIZE, recorder_cfg.postroll);
+
+    /* a moving average, the first frames only learn */
+    if(frames < 16)
+        frames++;
+    mean += d / frames;
+    variance += (d * d - variance) / frames;
+}
+
+/******************************************************************************
+Description.: copies every published frame of the first input into the queue
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *grab_frames(void *arg)
+{
+    frame_ring *ring = pglobal->in[0].ring;
+    unsigned int seq = 0;
+    frame_slot *slot;
+
+    frame_consumer_add(ring, 1);
+    frame_demand_add(ring, 0, 1);
+
+    while(!pglobal->stop) {
+        /* waiting for frames is no cancellation point */
+        pthread_testcancel();
+
+        if((slot = frame_acquire(ring, seq, 0, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        queue_frame(ring, slot);
+        if(recorder_triggers != NULL)
+            detect_event(slot->size);
+        frame_release(slot);
+    }
+
+    frame_demand_add(ring, 0, -1);
+    frame_consumer_add(ring, -1);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: appends the entries of the frames that are completely on disk
+              to the sidecar index
+Input Value.: -
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+static int write_index(void)
+{
+    unsigned int n = seg.indexed;
+    size_t len;
+
+    while(n < seg.frames && seg.index[n].offset + seg.index[n].size <= seg.flushed)
+        n++;
+    if(n == seg.indexed)
+        return 0;
+
+    len = (n - seg.indexed) * sizeof(recorder_index_entry);
+    if(write(seg.index_fd, seg.index + seg.indexed, len) != len)
+        return -1;
+
+    seg.indexed = n;
+    return 0;
+}
+
+/******************************************************************************
+Description.: writes the first bytes of the block to the file, disk space is
+              reserved ahead of them
+Input Value.: len, a multiple of RECORDER_ALIGN
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+static int flush_block(size_t len)
+{
+    unsigned long long step;
+    size_t done = 0;
+    ssize_t rc;
+
+    if(seg.flushed + len > seg.allocated) {
+        step = MAX(seg.estimate, RECORDER_PREALLOC);
+        if(fallocate(seg.fd, FALLOC_FL_KEEP_SIZE, seg.allocated, step) == 0)
+            seg.allocated += step;
+        else
+            seg.allocated = ULLONG_MAX;     /* not supported, the file grows as it is written */
+        seg.estimate = 0;
+    }
+
+    while(done < len) {
+        if((rc = pwrite(seg.fd, seg.block + done, len - done, seg.flushed + done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += rc;
+    }
+
+    seg.flushed += len;
+    seg.fill = 0;
+    return write_index();
+}
+
+/******************************************************************************
+Description.: appends bytes to the file through the block buffer
+Input Value.: data and its length
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+static int put_bytes(const void *data, size_t len)
+{
+    size_t n;
+
+    while(len > 0) {
+        n = MIN(len, RECORDER_BLOCK - seg.fill);
+        memcpy(seg.block + seg.fill, data, n);
+        seg.fill += n;
+        data = (const unsigned char *)data + n;
+        len -= n;
+
+        if(seg.fill == RECORDER_BLOCK && flush_block(RECORDER_BLOCK) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: checks if a name is one of the files the recorder writes, so
+              it can be taken from a request without leaving the folder
+Input Value.: * name.....: filename without folder
+              * extension: ".avi" or ".idx"
+Return Value: 1 for "YYYYmmdd-HHMMSS<extension>" or
+              "YYYYmmdd-HHMMSS_NN<extension>", 0 otherwise
+******************************************************************************/
+int recorder_is_file(const char *name, const char *extension)
+{
+    if(strspn(name, "0123456789") != 8 || name[8] != '-' || strspn(name + 9, "0123456789") != 6)
+        return 0;
+
+    /* the suffix of a further file of the same second */
+    name += 15;
+    if(name[0] == '_' && strspn(name + 1, "0123456789") == 2)
+        name += 3;
+
+    return strcmp(name, extension) == 0;
+}
+
+static int is_segment(const struct dirent *de)
+{
+    return recorder_is_file(de->d_name, ".avi");
+}
+
+/******************************************************************************
+Description.: deletes the oldest files until the folder is within the limits
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void apply_retention(void)
+{
+    unsigned long long total = 0, limit = (unsigned long long)recorder_cfg.keep_mb * 1024 * 1024;
+    time_t oldest = time(NULL) - recorder_cfg.keep_hours * 3600;
+    char path[PATH_MAX];
+    struct dirent **names;
+    struct stat *st;
+    int i, n;
+
+    if(recorder_cfg.keep_mb <= 0 && recorder_cfg.keep_hours <= 0)
+        return;
+
+    if((n = scandir(recorder_cfg.folder, &names, is_segment, alphasort)) < 0)
+        return;
+
+    if((st = mem_calloc(MAX(n, 1), sizeof(struct stat))) != NULL) {
+        for(i = 0; i < n; i++) {
+            snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, names[i]->d_name);
+            if(stat(path, &st[i]) == 0)
+                total += st[i].st_size;
+        }
+
+        /* the names sort by time */
+        for(i = 0; i < n; i++) {
+            if(!(recorder_cfg.keep_mb > 0 && total > limit) && !(recorder_cfg.keep_hours > 0 && st[i].st_mtime < oldest))
+                break;
+
+            snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, names[i]->d_name);
+            DBG("deleting %s\n", path);
+            if(unlink(path) == 0)
+                total -= st[i].st_size;
+
+            /* the index goes along with its file */
+            strcpy(path + strlen(path) - 4, ".idx");
+            unlink(path);
+        }
+        mem_free(st);
+    }
+
+    for(i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+}
+
+/******************************************************************************
+Description.: starts a new file with a placeholder for the AVI header
+Input Value.: the first frame of the file
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+static int open_segment(queued_frame *q)
+{
+    unsigned char header[AVI_HEADER_LEN] = {0};
+    recorder_index_header index_header = { RECORDER_INDEX_MAGIC, sizeof(recorder_index_entry), 0 };
+    time_t t = q->timestamp.tv_sec;
+    char name[RECORDER_NAME_MAX + 1], path[PATH_MAX];
+    struct tm tm;
+    int suffix;
+
+    gmtime_r(&t, &tm);
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+
+    /*
+     * an existing file is never overwritten, it was started within the same
+     * second, e.g. by a trigger right after the last event ended
+     */
+    for(suffix = 0, seg.fd = -1; seg.fd < 0 && suffix <= RECORDER_SUFFIXES; suffix++) {
+        if(suffix == 0)
+            snprintf(seg.path, sizeof(seg.path), "%s/%s.avi", recorder_cfg.folder, name);
+        else
+            snprintf(seg.path, sizeof(seg.path), "%s/%s_%02d.avi", recorder_cfg.folder, name, suffix);
+
+        /* O_DIRECT keeps the recording out of the page cache, not every file system has it */
+        if((seg.fd = open(seg.path, O_WRONLY | O_CREAT | O_EXCL | O_DIRECT, 0644)) < 0 && errno == EINVAL)
+            seg.fd = open(seg.path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(seg.fd < 0 && errno != EEXIST)
+            break;
+    }
+    if(seg.fd < 0) {
+        OPRINT("could not create %.200s: %s\n", seg.path, strerror(errno));
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%.*s.idx", (int)strlen(seg.path) - 4, seg.path);
+    if((seg.index_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+       write(seg.index_fd, &index_header, sizeof(index_header)) != sizeof(index_header))
+        return -1;
+
+    if(avi_jpeg_size((unsigned char *)(q + 1), q->size, &seg.width, &seg.height) < 0)
+        seg.width = seg.height = 0;
+
+    seg.fill = 0;
+    seg.flushed = 0;
+    seg.allocated = 0;
+    seg.movi_len = 0;
+    seg.frames = 0;
+    seg.indexed = 0;
+    seg.first = timeshift_usec(&q->timestamp);
+
+    DBG("recording to %s\n", seg.path);
+    return put_bytes(header, sizeof(header));
+}
+
+/******************************************************************************
+Description.: gives up a file after a write error, what was written stays
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void fail_segment(void)
+{
+    OPRINT("could not write %.200s: %s\n", seg.path, strerror(errno));
+    frame_event_post(pglobal->in[0].ring, "error", "{\"input\": 0, \"error\": \"recording to %.60s failed\"}", seg.path);
+
+    close(seg.fd);
+    seg.fd = -1;
+    if(seg.index_fd >= 0)
+        close(seg.index_fd);
+    seg.index_fd = -1;
+    seg.retry = seg.last + RECORDER_RETRY * 1000000LL;
+}
+
+/******************************************************************************
+Description.: finishes a file: appends the idx1 index, writes the last
+              block, returns the unused reserved space and fills in the header
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void close_segment(void)
+{
+    unsigned char header[AVI_HEADER_LEN], chunk[AVI_CHUNK_LEN], entries[INDEX_CHUNK * AVI_INDEX_ENTRY_LEN];
+    unsigned long long total;
+    unsigned int usec_per_frame, i, k, n;
+    size_t padded;
+
+    avi_index_header(chunk, seg.frames);
+    if(put_bytes(chunk, sizeof(chunk)) < 0) {
+        fail_segment();
+        return;
+    }
+
+    /* idx1 counts from the "movi" fourcc, which ends the header */
+    for(i = 0; i < seg.frames; i += n) {
+        n = MIN(seg.frames - i, INDEX_CHUNK);
+        for(k = 0; k < n; k++)
+            avi_index_entry(entries + k * AVI_INDEX_ENTRY_LEN,
+                            seg.index[i + k].offset - AVI_CHUNK_LEN - (AVI_HEADER_LEN - 4), seg.index[i + k].size);
+        if(put_bytes(entries, n * AVI_INDEX_ENTRY_LEN) < 0) {
+            fail_segment();
+            return;
+        }
+    }
+
+    total = seg.flushed + seg.fill;
+    padded = (seg.fill + RECORDER_ALIGN - 1) & ~((size_t)RECORDER_ALIGN - 1);
+    memset(seg.block + seg.fill, 0, padded - seg.fill);
+    if((padded > 0 && flush_block(padded) < 0) || ftruncate(seg.fd, total) < 0) {
+        fail_segment();
+        return;
+    }
+
+    usec_per_frame = (seg.frames > 1) ? (seg.last - seg.first) / (seg.frames - 1) : 1000000;
+    avi_header(header, seg.width, seg.height, seg.frames, usec_per_frame, seg.movi_len, seg.frames * AVI_INDEX_ENTRY_LEN);
+
+    /* the header is too small for O_DIRECT */
+    fcntl(seg.fd, F_SETFL, fcntl(seg.fd, F_GETFL) & ~O_DIRECT);
+    if(pwrite(seg.fd, header, sizeof(header), 0) != sizeof(header)) {
+        fail_segment();
+        return;
+    }
+
+    close(seg.fd);
+    seg.fd = -1;
+    close(seg.index_fd);
+    seg.index_fd = -1;
+    seg.estimate = total;
+
+    /* frames dropped by the queue count since the start */
+    frame_event_post(pglobal->in[0].ring, "record", "{\"file\": \"%.40s\", \"frames\": %u, \"bytes\": %llu, \"dropped\": %lu}",
+                     seg.path + strlen(recorder_cfg.folder) + 1, seg.frames, total, queue.dropped);
+
+    apply_retention();
+}
+
+/******************************************************************************
+Description.: appends a frame to the current file, a new file is started when
+              the current one is long enough
+Input Value.: the queued frame
+Return Value: -
+******************************************************************************/
+static void write_frame(queued_frame *q)
+{
+    long long ts = timeshift_usec(&q->timestamp);
+    unsigned char chunk[AVI_CHUNK_LEN];
+    recorder_index_entry *index, *e;
+    static const unsigned char pad = 0;
+
+    if(seg.fd >= 0 && ts - seg.first >= recorder_cfg.segment * 1000000LL)
+        close_segment();
+
+    if(seg.fd < 0) {
+        if(ts < seg.retry)
+            return;
+        if(open_segment(q) < 0) {
+            if(seg.fd >= 0)
+                fail_segment();
+            seg.retry = ts + RECORDER_RETRY * 1000000LL;
+            return;
+        }
+    }
+
+    if(seg.frames == seg.index_size) {
+        if((index = mem_realloc(seg.index, (seg.index_size + 1024) * sizeof(recorder_index_entry))) == NULL)
+            return;
+        seg.index = index;
+        seg.index_size += 1024;
+    }
+
+    e = &seg.index[seg.frames];
+    e->usec = timeshift_usec(&q->timestamp);
+    e->offset = seg.flushed + seg.fill + AVI_CHUNK_LEN;
+    e->size = q->size;
+    e->seq = q->seq;
+    e->reserved = 0;
+    avi_chunk(chunk, q->size);
+
+    if(put_bytes(chunk, sizeof(chunk)) < 0 || put_bytes(q + 1, q->size) < 0 ||
+       ((q->size & 1) && put_bytes(&pad, 1) < 0)) {
+        fail_segment();
+        return;
+    }
+
+    seg.movi_len += AVI_CHUNK_LEN + avi_padded(q->size);
+    seg.frames++;
+    seg.last = ts;
+}
+
+/******************************************************************************
+Description.: finishes the event being recorded: closes its file and appends
+              it to the event index
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void end_event(void)
+{
+    char path[PATH_MAX], line[256];
+    int fd, len;
+
+    if(seg.fd >= 0)
+        close_segment();
+    event.active = 0;
+
+    len = snprintf(line, sizeof(line),
+                   "{\"start\": %lld.%06lld, \"end\": %lld.%06lld, \"trigger\": \"%s\", \"file\": \"%s\", \"frames\": %u}\n",
+                   event.start / 1000000, event.start % 1000000, event.end / 1000000, event.end % 1000000,
+                   recorder_reason(event.reason), event.file, event.frames);
+
+    snprintf(path, sizeof(path), "%s/%s", recorder_cfg.folder, RECORDER_EVENTS);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 || write(fd, line, len) != len)
+        OPRINT("could not write the event index %.200s: %s\n", path, strerror(errno));
+    if(fd >= 0)
+        close(fd);
+
+    frame_event_post(pglobal->in[0].ring, "trigger", "{\"active\": false, \"trigger\": \"%s\", \"file\": \"%s\", \"frames\": %u}",
+                     recorder_reason(event.reason), event.file, event.frames);
+}
+
+/******************************************************************************
+Description.: decides in triggered mode about the oldest queued frame: it is
+              written if a trigger covers it, dropped once it is older than
+              the pre-roll, otherwise it stays in the queue for a trigger
+Input Value.: * q......: the oldest queued frame
+              * newest.: capture time of the latest frame queued
+              * used...: bytes of the queue in use
+              * closing: the recorder stops, no frame stays
+Return Value: 1 to write the frame, 0 to drop it, -1 to keep it
+******************************************************************************/
+static int triggered(queued_frame *q, long long newest, unsigned long long used, int closing)
+{
+    long long ts = timeshift_usec(&q->timestamp);
+
+    if(ts <= __atomic_load_n(&recorder_triggers->until, __ATOMIC_ACQUIRE)) {
+        if(!event.active) {
+            event.active = 1;
+            event.reason = __atomic_load_n(&recorder_triggers->reason, __ATOMIC_RELAXED);
+            event.start = ts;
+            event.frames = 0;
+            event.file[0] = '\0';
+
+            /* every event gets files of its own */
+            if(seg.fd >= 0)
+                close_segment();
+            frame_event_post(pglobal->in[0].ring, "trigger", "{\"active\": true, \"trigger\": \"%s\"}",
+                             recorder_reason(event.reason));
+        }
+        event.end = ts;
+        event.frames++;
+        return 1;
+    }
+
+    /* an event goes on if a trigger comes while its last frames are still pre-roll */
+    if(closing || newest - ts > recorder_cfg.preroll * 1000000LL || used > RECORDER_QUEUE / 2) {
+        if(event.active)
+            end_event();
+        return 0;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: takes the frames from the queue and writes them, when the
+              recorder stops the queue gets drained and the file finished
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *write_frames(void *arg)
+{
+    unsigned long long head = 0, tail = 0;
+    long long newest;
+    queued_frame *q;
+    size_t off;
+    int closing, action;
+
+    apply_retention();
+
+    for(;;) {
+        /* in triggered mode frames stay queued, so only new ones are waited for */
+        pthread_mutex_lock(&queue.mutex);
+        while(queue.head == head && !queue.closing)
+            pthread_cond_wait(&queue.cond, &queue.mutex);
+        head = queue.head;
+        newest = queue.newest;
+        closing = queue.closing;
+        pthread_mutex_unlock(&queue.mutex);
+
+        if(head == tail && closing)
+            break;
+
+        while(tail != head) {
+            off = tail % RECORDER_QUEUE;
+            q = (queued_frame *)(queue.data + off);
+            if(off + sizeof(queued_frame) > RECORDER_QUEUE || q->size < 0) {
+                tail += RECORDER_QUEUE - off;
+                continue;
+            }
+
+            action = (recorder_triggers != NULL) ? triggered(q, newest, head - tail, closing) : 1;
+            if(action < 0)
+                break;
+            if(action > 0) {
+                write_frame(q);
+                if(recorder_triggers != NULL && event.file[0] == '\0' && seg.fd >= 0)
+                    snprintf(event.file, sizeof(event.file), "%s", seg.path + strlen(recorder_cfg.folder) + 1);
+            }
+
+            tail += QUEUE_ALIGN(sizeof(queued_frame) + q->size);
+            __atomic_store_n(&queue.tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+
+    if(event.active)
+        end_event();
+    if(seg.fd >= 0)
+        close_segment();
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: names the source of a trigger
+Input Value.: RECORDER_MOTION, RECORDER_SIZE or RECORDER_HTTP
+Return Value: the name as used in events and the event index
+******************************************************************************/
+const char *recorder_reason(int reason)
+{
+    switch(reason) {
+    case RECORDER_MOTION: return "motion";
+    case RECORDER_SIZE:   return "size";
+    case RECORDER_HTTP:   return "http";
+    }
+    return "unknown";
+}
+
+/******************************************************************************
+Description.: fires the trigger of the triggered recording, the frames until
+              this many seconds from now get recorded, callable from any
+              thread and worker process
+Input Value.: * reason.: source of the trigger
+              * seconds: the post-roll
+Return Value: -
+******************************************************************************/
+void recorder_fire(int reason, int seconds)
+{
+    recorder_trigger *t = recorder_triggers;
+    long long now, until, old;
+
+    if(t == NULL)
+        return;
+
+    now = frame_clock_now();
+    until = now + seconds * 1000000LL;
+
+    old = __atomic_load_n(&t->until, __ATOMIC_ACQUIRE);
+    if(old < now) {
+        __atomic_store_n(&t->reason, reason, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&t->fired, 1, __ATOMIC_RELAXED);
+    }
+
+    /* the trigger reaching furthest wins */
+    while(old < until && !__atomic_compare_exchange_n(&t->until, &old, until, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+}
+
+/******************************************************************************
+Description.: sets up the trigger state of the triggered recording, before
+              the worker processes get forked
+Input Value.: -
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+int recorder_init(void)
+{
+    if(recorder_cfg.preroll < 0)
+        return 0;
+
+    if((recorder_triggers = frame_map(sizeof(recorder_trigger), pglobal->workers > 0)) == MAP_FAILED) {
+        recorder_triggers = NULL;
+        OPRINT("could not allocate the recording triggers\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts recording to the folder, it is created if it is missing
+Input Value.: -
+Return Value: 0 on success, -1 in case of error
+******************************************************************************/
+int recorder_run(void)
+{
+    if(mkdir(recorder_cfg.folder, 0755) < 0 && errno != EEXIST) {
+        OPRINT("could not create the recording folder %s: %s\n", recorder_cfg.folder, strerror(errno));
+        return -1;
+    }
+    if(access(recorder_cfg.folder, W_OK) < 0) {
+        OPRINT("can not write to the recording folder %s\n", recorder_cfg.folder);
+        return -1;
+    }
+
+    if((queue.data = mem_malloc(RECORDER_QUEUE)) == NULL ||
+       posix_memalign((void **)&seg.block, RECORDER_ALIGN, RECORDER_BLOCK) != 0) {
+        OPRINT("not enough memory for the recorder\n");
+        return -1;
+    }
+
+    OPRINT("recording folder..: %s, %d seconds per file\n", recorder_cfg.folder, recorder_cfg.segment);
+    if(recorder_cfg.keep_mb > 0)
+        OPRINT("keep recordings...: up to %d MB\n", recorder_cfg.keep_mb);
+    if(recorder_cfg.keep_hours > 0)
+        OPRINT("keep recordings...: for %d hours\n", recorder_cfg.keep_hours);
+    if(recorder_triggers != NULL)
+        OPRINT("record on triggers: %d seconds before, %d seconds after\n", recorder_cfg.preroll, recorder_cfg.postroll);
+
+    if(pthread_create(&write_thread, NULL, write_frames, NULL) != 0)
+        return -1;
+    writing = 1;
+
+    if(pthread_create(&grab_thread, NULL, grab_frames, NULL) != 0) {
+        recorder_stop();
+        return -1;
+    }
+    grabbing = 1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops recording, the frames already queued are written and the
+              current file gets finished
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int recorder_stop(void)
+{
+    if(grabbing) {
+        pthread_cancel(grab_thread);
+        pthread_join(grab_thread, NULL);
+        grabbing = 0;
+    }
+
+    if(!writing)
+        return 0;
+
+    pthread_mutex_lock(&queue.mutex);
+    queue.closing = 1;
+    pthread_cond_signal(&queue.cond);
+    pthread_mutex_unlock(&queue.mutex);
+    pthread_join(write_thread, NULL);
+    writing = 0;
+
+    return 0;
+}
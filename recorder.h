@@ -0,0 +1,134 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+/*
+ * Recorder output: the frames of the first input are written to a folder
+ * as MJPEG AVI files of a fixed duration. A thread copies the published
+ * frames into a queue and never waits for the disk, another one writes
+ * them in large aligned blocks. Frames that find the queue full are not
+ * recorded. The oldest files are deleted to keep the folder below a size
+ * or age.
+ */
+
+/* seconds of one file if none are given */
+#define RECORDER_SEGMENT 60
+
+/* memory of the frames waiting for the disk */
+#define RECORDER_QUEUE (16*1024*1024)
+
+/*
+ * files are written in blocks of this size with O_DIRECT where the file
+ * system supports it, the buffer and all offsets are aligned for it
+ */
+#define RECORDER_BLOCK (1024*1024)
+#define RECORDER_ALIGN 4096
+
+/* disk space is reserved ahead of the data in steps of at least this size */
+#define RECORDER_PREALLOC (16*1024*1024)
+
+/* after a failed write no new file is tried for this many seconds */
+#define RECORDER_RETRY 5
+
+/*
+ * files are named "YYYYmmdd-HHMMSS.avi" after the UTC time of their first
+ * frame, so the names sort by time even across daylight saving changes, a
+ * further file started within the same second is "YYYYmmdd-HHMMSS_NN.avi"
+ */
+#define RECORDER_NAME_LEN 19
+#define RECORDER_NAME_MAX (RECORDER_NAME_LEN + 3)
+#define RECORDER_SUFFIXES 99
+
+/*
+ * Every file gets a sidecar index "YYYYmmdd-HHMMSS.idx": this header and
+ * one entry per frame in the order of recording. An entry is appended once
+ * the frame data is on disk, so the file being written can be played back
+ * as it grows. The entries have a fixed size and increasing times, the
+ * index is mapped and searched in place.
+ */
+#define RECORDER_INDEX_MAGIC "UVCIDX1"
+
+typedef struct {
+    char magic[8];              /* RECORDER_INDEX_MAGIC */
+    unsigned int entry_size;    /* sizeof(recorder_index_entry) */
+    unsigned int reserved;
+} recorder_index_header;
+
+typedef struct {
+    long long usec;             /* capture time of the frame in us since the epoch, as in X-Timestamp */
+    unsigned int offset;        /* position of the JPEG data in the AVI file */
+    unsigned int size;          /* length of the JPEG data */
+    unsigned int seq;           /* X-Sequence of the frame */
+    unsigned int reserved;
+} recorder_index_entry;
+
+/*
+ * Triggered recording: with a pre-roll only the frames around events are
+ * recorded. The queue keeps the frames of the last pre-roll seconds, at
+ * most half of its memory. A trigger writes them and the following frames
+ * until the post-roll passed without another trigger. Triggers come from
+ * the motion detection, without it from a jump of the frame size, and from
+ * HTTP clients. Every event starts a new file and gets a line in the event
+ * index of the folder.
+ */
+#define RECORDER_POSTROLL 10
+
+/* the event index, one JSON object per line */
+#define RECORDER_EVENTS "events.log"
+
+/* sources of triggers */
+enum {
+    RECORDER_MOTION,
+    RECORDER_SIZE,
+    RECORDER_HTTP,
+};
+
+/* state of the triggers, in shared memory for the worker processes */
+typedef struct {
+    long long until;        /* wall clock time in us the recording goes on to */
+    int reason;             /* source of the trigger that started the event */
+    unsigned long fired;    /* events started so far */
+} recorder_trigger;
+
+struct recorder_config {
+    char *folder;       /* NULL disables the recorder */
+    int segment;        /* seconds per file */
+    int keep_mb;        /* the files may take this many MB, 0 for no limit */
+    int keep_hours;     /* files older than this are deleted, 0 for no limit */
+    int preroll;        /* seconds recorded before a trigger, -1 records all frames */
+    int postroll;       /* seconds recorded after the last trigger */
+};
+
+extern struct recorder_config recorder_cfg;
+extern recorder_trigger *recorder_triggers;
+
+int recorder_is_file(const char *name, const char *extension);
+const char *recorder_reason(int reason);
+void recorder_fire(int reason, int seconds);
+int recorder_init(void);
+int recorder_run(void);
+int recorder_stop(void);
+
+#endif
@@ -0,0 +1,343 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "rtp.h"
+
+/* seconds between 1900, the NTP epoch, and 1970 */
+#define NTP_OFFSET 2208988800UL
+
+/* canonical name in the SDES part of the sender reports */
+#define RTCP_CNAME "uvcstreamer"
+
+/******************************************************************************
+Description.: starts a new stream with random identifiers
+Input Value.: stream
+Return Value: -
+******************************************************************************/
+void rtp_stream_init(rtp_stream *s)
+{
+    static unsigned int seed = 0;
+
+    if(seed == 0)
+        seed = time(NULL) ^ getpid();
+
+    memset(s, 0, sizeof(*s));
+    s->ssrc = rand_r(&seed) ^ (rand_r(&seed) << 16);
+    s->seq = rand_r(&seed);
+    s->ts_offset = rand_r(&seed) ^ (rand_r(&seed) << 16);
+}
+
+/******************************************************************************
+Description.: finds the headers of a baseline JPEG frame RFC 2435 can carry:
+              three components, 4:2:2 or 4:2:0 sampling and 8 bit tables
+Input Value.: * jpeg: the frame
+              * size: its length
+              * j...: stores the headers
+Return Value: 0 if the frame can be sent, -1 otherwise
+******************************************************************************/
+int rtp_jpeg_parse(const unsigned char *jpeg, size_t size, rtp_jpeg *j)
+{
+    const unsigned char *tables[4] = { NULL, NULL, NULL, NULL }, *seg;
+    int sampling[3] = { 0, 0, 0 }, tq[3] = { 0, 0, 0 }, components = 0, marker, c;
+    size_t i = 2, len, k;
+
+    memset(j, 0, sizeof(*j));
+    if(size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        return -1;
+
+    while(j->scan == NULL && i + 4 <= size) {
+        if(jpeg[i] != 0xFF)
+            return -1;
+        marker = jpeg[i + 1];
+
+        /* fill bytes and markers without a length */
+        if(marker == 0xFF) {
+            i++;
+            continue;
+        }
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            i += 2;
+            continue;
+        }
+
+        len = jpeg[i + 2] << 8 | jpeg[i + 3];
+        if(len < 2 || i + 2 + len > size)
+            return -1;
+        seg = jpeg + i + 4;
+        len -= 2;
+
+        switch(marker) {
+        case 0xDB: /* DQT, only 8 bit precision */
+            for(k = 0; k < len; k += 65) {
+                if((seg[k] >> 4) != 0 || (seg[k] & 0x0F) > 3 || k + 65 > len)
+                    return -1;
+                tables[seg[k] & 0x0F] = seg + k + 1;
+            }
+            break;
+        case 0xC0: /* SOF0, baseline */
+            if(len < 6 || seg[0] != 8)
+                return -1;
+            j->height = seg[1] << 8 | seg[2];
+            j->width = seg[3] << 8 | seg[4];
+            components = seg[5];
+            if(components != 3 || len < 6 + 3 * 3)
+                return -1;
+            for(c = 0; c < 3; c++) {
+                sampling[c] = seg[6 + 3 * c + 1];
+                tq[c] = seg[6 + 3 * c + 2] & 3;
+            }
+            break;
+        case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            /* progressive, lossless and arithmetic coding are not covered */
+            return -1;
+        case 0xDD: /* DRI */
+            if(len < 2)
+                return -1;
+            j->dri = seg[0] << 8 | seg[1];
+            break;
+        case 0xDA: /* SOS, the entropy coded data follows its header */
+            j->scan = seg + len;
+            j->scan_len = size - (i + 4 + len);
+            break;
+        }
+
+        i += 4 + len;
+    }
+
+    if(j->scan == NULL || components != 3)
+        return -1;
+
+    /* the receiver appends the end of image marker itself */
+    if(j->scan_len >= 2 && j->scan[j->scan_len - 2] == 0xFF && j->scan[j->scan_len - 1] == 0xD9)
+        j->scan_len -= 2;
+
+    if(sampling[1] != 0x11 || sampling[2] != 0x11 || tq[1] != tq[2])
+        return -1;
+    if(sampling[0] == 0x21)
+        j->type = 0;
+    else if(sampling[0] == 0x22)
+        j->type = 1;
+    else
+        return -1;
+    if(j->dri != 0)
+        j->type += 64;
+
+    if(j->width <= 0 || j->height <= 0 || j->width > RTP_JPEG_MAX_SIZE || j->height > RTP_JPEG_MAX_SIZE ||
+       tables[tq[0]] == NULL || tables[tq[1]] == NULL)
+        return -1;
+
+    memcpy(j->qtables, tables[tq[0]], 64);
+    memcpy(j->qtables + 64, tables[tq[1]], 64);
+    return 0;
+}
+
+/******************************************************************************
+Description.: RTP timestamp of a frame, derived from its capture time
+Input Value.: * s......: stream
+              * capture: capture time of the frame
+Return Value: timestamp in units of RTP_CLOCK
+******************************************************************************/
+unsigned int rtp_timestamp(rtp_stream *s, struct timeval capture)
+{
+    uint64_t ts = (uint64_t)capture.tv_sec * RTP_CLOCK + (uint64_t)capture.tv_usec * (RTP_CLOCK / 1000) / 1000;
+
+    return (unsigned int)ts + s->ts_offset;
+}
+
+/******************************************************************************
+Description.: sends a frame as RTP packets, the data goes out straight from
+              the frame, only the headers are written here
+Input Value.: * s......: stream
+              * j......: headers of the frame from rtp_jpeg_parse()
+              * capture: capture time of the frame
+              * send...: sends a packet
+              * arg....: passed on to send
+Return Value: 0 if the frame was sent, -1 if the receiver is gone
+******************************************************************************/
+int rtp_send_jpeg(rtp_stream *s, rtp_jpeg *j, struct timeval capture, rtp_send_fn send, void *arg)
+{
+    unsigned char header[12 + 8 + 4 + 4 + sizeof(j->qtables)], *p;
+    unsigned int ts = rtp_timestamp(s, capture);
+    size_t offset = 0, n, hlen;
+    struct iovec iov[2];
+
+    while(offset < j->scan_len) {
+        p = header;
+
+        /* RTP header, the marker bit is set on the last packet of a frame */
+        *p++ = 0x80;
+        *p++ = RTP_PT_JPEG;
+        *p++ = s->seq >> 8;
+        *p++ = s->seq & 0xFF;
+        *p++ = ts >> 24; *p++ = ts >> 16; *p++ = ts >> 8; *p++ = ts;
+        *p++ = s->ssrc >> 24; *p++ = s->ssrc >> 16; *p++ = s->ssrc >> 8; *p++ = s->ssrc;
+
+        /* JPEG header */
+        *p++ = 0;
+        *p++ = offset >> 16; *p++ = offset >> 8; *p++ = offset;
+        *p++ = j->type;
+        *p++ = 255;
+        *p++ = (j->width + 7) / 8;
+        *p++ = (j->height + 7) / 8;
+
+        /* packets need not end at restart intervals, so the count is 0x3FFF */
+        if(j->dri != 0) {
+            *p++ = j->dri >> 8;
+            *p++ = j->dri & 0xFF;
+            *p++ = 0xFF;
+            *p++ = 0xFF;
+        }
+
+        /* the tables travel with the first packet of every frame */
+        if(offset == 0) {
+            *p++ = 0;
+            *p++ = 0;
+            *p++ = sizeof(j->qtables) >> 8;
+            *p++ = sizeof(j->qtables) & 0xFF;
+            memcpy(p, j->qtables, sizeof(j->qtables));
+            p += sizeof(j->qtables);
+        }
+
+        hlen = p - header;
+        n = MIN(RTP_MTU - hlen, j->scan_len - offset);
+        if(offset + n == j->scan_len)
+            header[1] |= 0x80;
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = (void *)(j->scan + offset);
+        iov[1].iov_len = n;
+        if(send(arg, 0, iov, 2) < 0)
+            return -1;
+
+        s->seq++;
+        s->packets++;
+        s->octets += hlen - 12 + n;
+        offset += n;
+    }
+
+    s->last_ts = ts;
+    s->last_capture = capture;
+    return 0;
+}
+
+/******************************************************************************
+Description.: sends a sender report with the canonical name. It maps the
+              timestamp of the last frame to the wall clock time of its
+              capture, which the frames carry, so receivers can synchronize
+              to the camera.
+Input Value.: * s...: stream
+              * send: sends a packet
+              * arg.: passed on to send
+Return Value: 0 if the report was sent or nothing was sent yet, -1 if the
+              receiver is gone
+******************************************************************************/
+int rtp_send_sr(rtp_stream *s, rtp_send_fn send, void *arg)
+{
+    unsigned char packet[28 + 8 + ((2 + sizeof(RTCP_CNAME) + 3) & ~3)], *p = packet;
+    struct timeval wall = s->last_capture;
+    uint32_t v[5];
+    struct iovec iov;
+    int i, sdes_words;
+
+    if(s->packets == 0)
+        return 0;
+
+    v[0] = s->ssrc;
+    v[1] = (uint32_t)(wall.tv_sec + NTP_OFFSET);
+    v[2] = (uint32_t)(((uint64_t)wall.tv_usec << 32) / 1000000);
+    v[3] = s->last_ts;
+    v[4] = s->packets;
+
+    /* SR without report blocks */
+    *p++ = 0x80;
+    *p++ = 200;
+    *p++ = 0;
+    *p++ = 6;
+    for(i = 0; i < 5; i++) {
+        *p++ = v[i] >> 24; *p++ = v[i] >> 16; *p++ = v[i] >> 8; *p++ = v[i];
+    }
+    *p++ = s->octets >> 24; *p++ = s->octets >> 16; *p++ = s->octets >> 8; *p++ = s->octets;
+
+    /* SDES with the CNAME item, padded with zeros to full words */
+    sdes_words = (4 + 2 + strlen(RTCP_CNAME) + 1 + 3) / 4;
+    memset(p, 0, packet + sizeof(packet) - p);
+    *p++ = 0x81;
+    *p++ = 202;
+    *p++ = 0;
+    *p++ = sdes_words;
+    *p++ = s->ssrc >> 24; *p++ = s->ssrc >> 16; *p++ = s->ssrc >> 8; *p++ = s->ssrc;
+    *p++ = 1;
+    *p++ = strlen(RTCP_CNAME);
+    memcpy(p, RTCP_CNAME, strlen(RTCP_CNAME));
+
+    iov.iov_base = packet;
+    iov.iov_len = 28 + 4 + 4 * sdes_words;
+    return send(arg, 1, &iov, 1);
+}
+
+/******************************************************************************
+Description.: describes an RTP/JPEG stream in SDP
+Input Value.: * buf.......: stores the description
+              * len.......: size of buf
+              * origin....: address of this host
+              * connection: address the receivers get the stream from,
+                            "group/ttl" for multicast
+              * port......: port of the stream, 0 if it is set up by RTSP
+              * control...: RTSP control URL of the track, NULL without RTSP
+Return Value: length of the description, -1 if buf is too small
+******************************************************************************/
+int rtp_sdp(char *buf, size_t len, const char *origin, const char *connection, int port, const char *control)
+{
+    int n;
+
+    n = snprintf(buf, len,
+                 "v=0\r\n"
+                 "o=- %lu 1 IN %s %s\r\n"
+                 "s=" SOURCE_NAME "\r\n"
+                 "c=IN %s %s\r\n"
+                 "t=0 0\r\n"
+                 "%s"
+                 "m=video %d RTP/AVP %d\r\n"
+                 "a=rtpmap:%d JPEG/%d\r\n"
+                 "%s%s%s",
+                 (unsigned long)time(NULL), (strchr(origin, ':') != NULL) ? "IP6" : "IP4", origin,
+                 (strchr(connection, ':') != NULL) ? "IP6" : "IP4", connection,
+                 (control != NULL) ? "a=control:*\r\n" : "",
+                 port, RTP_PT_JPEG, RTP_PT_JPEG, RTP_CLOCK,
+                 (control != NULL) ? "a=control:" : "", (control != NULL) ? control : "", (control != NULL) ? "\r\n" : "");
+
+    return (n < 0 || n >= len) ? -1 : n;
+}
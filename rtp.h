@@ -0,0 +1,83 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RTP_H
+#define RTP_H
+
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+/*
+ * RTP/JPEG (RFC 2435): the published JPEG frames are split into RTP
+ * packets without decoding them, only the headers are parsed. The
+ * quantization tables are sent in band with every frame (Q = 255).
+ */
+#define RTP_PT_JPEG 26
+#define RTP_CLOCK 90000
+
+/* RTP payload per packet, keeps the datagrams below common MTUs */
+#define RTP_MTU 1400
+
+/* the largest picture RFC 2435 can describe */
+#define RTP_JPEG_MAX_SIZE 2040
+
+/* a sender report goes out after this many seconds */
+#define RTCP_INTERVAL 5
+
+/* headers of a JPEG frame, the pointers point into the frame */
+typedef struct {
+    int type;                           /* RFC 2435 type, +64 with restart markers */
+    int width, height;
+    int dri;                            /* restart interval, 0 if none */
+    unsigned char qtables[128];         /* luma and chroma table, zigzag order */
+    const unsigned char *scan;          /* entropy coded data */
+    size_t scan_len;
+} rtp_jpeg;
+
+/* state of one RTP stream */
+typedef struct {
+    unsigned int ssrc;
+    unsigned short seq;
+    unsigned int ts_offset;             /* random start of the timestamps */
+    unsigned int last_ts;               /* timestamp of the last frame */
+    struct timeval last_capture;        /* capture time of the last frame */
+    unsigned int packets;               /* counters of the sender reports */
+    unsigned int octets;
+} rtp_stream;
+
+/*
+ * sends one packet made of the given parts, channel 0 is RTP and 1 is
+ * RTCP. Returns 0 if the packet was sent or dropped on purpose, -1 if
+ * the receiver is gone.
+ */
+typedef int (*rtp_send_fn)(void *arg, int channel, struct iovec *iov, int iovcnt);
+
+void rtp_stream_init(rtp_stream *s);
+int rtp_jpeg_parse(const unsigned char *jpeg, size_t size, rtp_jpeg *j);
+unsigned int rtp_timestamp(rtp_stream *s, struct timeval capture);
+int rtp_send_jpeg(rtp_stream *s, rtp_jpeg *j, struct timeval capture, rtp_send_fn send, void *arg);
+int rtp_send_sr(rtp_stream *s, rtp_send_fn send, void *arg);
+int rtp_sdp(char *buf, size_t len, const char *origin, const char *connection, int port, const char *control);
+
+#endif
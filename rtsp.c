@@ -0,0 +1,729 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "httpd.h"
+#include "rtp.h"
+#include "rtsp.h"
+
+#define OUTPUT_PLUGIN_NAME "RTSP output plugin"
+
+struct rtsp_config rtsp_cfg = {
+    .port = 0,
+    .sessions = RTSP_SESSIONS,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+typedef enum {
+    RTSP_INIT,
+    RTSP_READY,         /* set up, not playing */
+    RTSP_PLAYING,
+} rtsp_state;
+
+/* one client connection, it carries at most one session */
+typedef struct {
+    int fd;
+    iobuffer iobuf;
+    rtsp_state state;
+    int input;
+    char session[16];
+    int interleaved;                    /* RTP and RTCP go over the RTSP connection */
+    int channel[2];                     /* their interleaved channels */
+    int udp[2];                         /* UDP sockets of RTP and RTCP, -1 if closed */
+    struct sockaddr_storage peer[2];    /* UDP addresses of the client */
+    socklen_t peer_len;
+    rtp_stream rtp;
+    time_t heard;                       /* last request or receiver report */
+    time_t reported;                    /* last sender report */
+} rtsp_session;
+
+/* the parts of a request the server looks at */
+typedef struct {
+    char method[16];
+    char url[REQUEST_STRING_LEN];
+    int cseq;
+    char transport[REQUEST_STRING_LEN];
+    char session[32];
+    char auth[REQUEST_STRING_LEN];
+    int content_length;
+} rtsp_request;
+
+static int sd[RTSP_MAX_SD];
+static int sd_len = 0;
+static pthread_t accept_thread;
+static int sessions = 0;
+
+/******************************************************************************
+Description.: sends a packet over the RTSP connection or as UDP datagram,
+              used as rtp_send_fn
+Input Value.: * arg....: the session
+              * channel: 0 for RTP, 1 for RTCP
+              * iov....: parts of the packet
+              * iovcnt.: number of parts, at most 2
+Return Value: 0 if the packet was sent or dropped by the network stack,
+              -1 if the client is gone
+******************************************************************************/
+static int send_packet(void *arg, int channel, struct iovec *iov, int iovcnt)
+{
+    rtsp_session *s = arg;
+    unsigned char header[4];
+    struct iovec all[3];
+    struct msghdr msg;
+    size_t len = 0, sent = 0, skip;
+    ssize_t rc;
+    int i, n;
+
+    for(i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if(!s->interleaved) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &s->peer[channel];
+        msg.msg_namelen = s->peer_len;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        /* a full socket buffer or an unreachable port only loses this packet */
+        if(sendmsg(s->udp[channel], &msg, 0) < 0 && errno != EAGAIN && errno != ECONNREFUSED && errno != ENOBUFS)
+            return -1;
+        return 0;
+    }
+
+    /* RFC 2326 10.12: "$", channel and length in front of the packet */
+    header[0] = '$';
+    header[1] = s->channel[channel];
+    header[2] = len >> 8;
+    header[3] = len & 0xFF;
+    all[0].iov_base = header;
+    all[0].iov_len = sizeof(header);
+    for(i = 0; i < iovcnt; i++)
+        all[i + 1] = iov[i];
+    len += sizeof(header);
+
+    /* writev() may return early on a signal, continue where it stopped */
+    while(sent < len) {
+        struct iovec part[3];
+
+        for(i = 0, n = 0, skip = sent; i < iovcnt + 1; i++) {
+            if(skip >= all[i].iov_len) {
+                skip -= all[i].iov_len;
+                continue;
+            }
+            part[n].iov_base = (char *)all[i].iov_base + skip;
+            part[n].iov_len = all[i].iov_len - skip;
+            skip = 0;
+            n++;
+        }
+
+        if((rc = writev(s->fd, part, n)) <= 0)
+            return -1;
+        sent += rc;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads the next request, interleaved packets of the client,
+              its receiver reports, are skipped
+Input Value.: * s......: the session
+              * r......: stores the request
+              * timeout: seconds to wait for each part
+Return Value: 0 if a request was read, 1 if only a packet was skipped, -1 if
+              the connection failed
+******************************************************************************/
+static int read_request(rtsp_session *s, rtsp_request *r, int timeout)
+{
+    char line[BUFFER_SIZE], *p;
+    unsigned char c, header[3];
+    int len;
+
+    do {
+        if(_read(s->fd, &s->iobuf, &c, 1, timeout) != 1)
+            return -1;
+    } while(c == '\r' || c == '\n');
+
+    if(c == '$') {
+        if(_read(s->fd, &s->iobuf, header, 3, timeout) != 3)
+            return -1;
+        for(len = header[1] << 8 | header[2]; len > 0; len -= sizeof(line)) {
+            if(_read(s->fd, &s->iobuf, line, MIN(len, sizeof(line)), timeout) != MIN(len, sizeof(line)))
+                return -1;
+        }
+        return 1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->cseq = -1;
+    line[0] = c;
+    if(_readline(s->fd, &s->iobuf, line + 1, sizeof(line) - 1, timeout) < 0)
+        return -1;
+    if(sscanf(line, "%15s %255s", r->method, r->url) != 2)
+        return -1;
+
+    /* the header ends with an empty line */
+    for(;;) {
+        if(_readline(s->fd, &s->iobuf, line, sizeof(line) - 1, timeout) < 0)
+            return -1;
+        if(line[0] == '\r' || line[0] == '\n')
+            break;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if((p = strchr(line, ':')) == NULL)
+            continue;
+        for(p++; *p == ' '; p++);
+
+        if(strncasecmp(line, "CSeq:", 5) == 0)
+            r->cseq = atoi(p);
+        else if(strncasecmp(line, "Transport:", 10) == 0)
+            snprintf(r->transport, sizeof(r->transport), "%s", p);
+        else if(strncasecmp(line, "Session:", 8) == 0)
+            snprintf(r->session, sizeof(r->session), "%.*s", (int)strcspn(p, "; "), p);
+        else if(strncasecmp(line, "Content-Length:", 15) == 0)
+            r->content_length = atoi(p);
+        else if(strncasecmp(line, "Authorization: Basic ", 21) == 0) {
+            strncpy(r->auth, line + 21, sizeof(r->auth) - 1);
+            decodeBase64(r->auth);
+        }
+    }
+
+    /* parameters of GET_PARAMETER and SET_PARAMETER are not used */
+    for(len = r->content_length; len > 0; len -= sizeof(line)) {
+        if(_read(s->fd, &s->iobuf, line, MIN(len, sizeof(line)), timeout) != MIN(len, sizeof(line)))
+            return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: sends a response
+Input Value.: * s.....: the session
+              * r.....: the request to answer
+              * status: status code and reason, e.g. "200 OK"
+              * extra.: additional header lines, may be empty
+              * body..: SDP body, NULL if there is none
+Return Value: 0 if it was sent, -1 otherwise
+******************************************************************************/
+static int reply(rtsp_session *s, rtsp_request *r, const char *status, const char *extra, const char *body)
+{
+    char buffer[BUFFER_SIZE * 2], content[64] = "";
+
+    if(body != NULL)
+        snprintf(content, sizeof(content), "Content-Type: application/sdp\r\nContent-Length: %d\r\n", (int)strlen(body));
+
+    snprintf(buffer, sizeof(buffer), "RTSP/1.0 %s\r\n" \
+             "CSeq: %d\r\n" \
+             "Server: " SOURCE_NAME "/" SOURCE_VERSION "\r\n" \
+             "%s" \
+             "%s" \
+             "\r\n" \
+             "%s", status, r->cseq, extra, content, (body != NULL) ? body : "");
+
+    return (write(s->fd, buffer, strlen(buffer)) < 0) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: finds the input plugin of a stream URL, "rtsp://host:port/" is
+              the first one and "rtsp://host:port/input_1" the second one
+Input Value.: URL of the request, the control part "/track0" is ignored
+Return Value: number of the input plugin or -1
+******************************************************************************/
+static int url_input(const char *url)
+{
+    const char *path, *p;
+    int input = 0;
+
+    /* skip scheme and authority */
+    path = ((p = strstr(url, "://")) != NULL) ? strchr(p + 3, '/') : url;
+    if(path == NULL)
+        return 0;
+
+    if((p = strstr(path, "input_")) != NULL)
+        input = atoi(p + 6);
+
+    return (input >= 0 && input < pglobal->incnt) ? input : -1;
+}
+
+static void set_port(struct sockaddr_storage *addr, int port)
+{
+    if(addr->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+}
+
+static int get_port(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if(getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+        return -1;
+    return ntohs((addr.ss_family == AF_INET6) ? ((struct sockaddr_in6 *)&addr)->sin6_port :
+                 ((struct sockaddr_in *)&addr)->sin_port);
+}
+
+static void close_udp(rtsp_session *s)
+{
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if(s->udp[i] >= 0)
+            close(s->udp[i]);
+        s->udp[i] = -1;
+    }
+}
+
+/******************************************************************************
+Description.: opens the UDP sockets of a session, RTP gets an even port and
+              RTCP the next one as RFC 3550 recommends
+Input Value.: * s.........: the session
+              * client_rtp: ports the client receives RTP and RTCP at
+              * client_rtcp
+Return Value: RTP port of the server or -1
+******************************************************************************/
+static int open_udp(rtsp_session *s, int client_rtp, int client_rtcp)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int attempt, port;
+
+    if(getpeername(s->fd, (struct sockaddr *)&addr, &len) < 0 ||
+       (addr.ss_family != AF_INET && addr.ss_family != AF_INET6))
+        return -1;
+
+    for(attempt = 0; attempt < 16; attempt++) {
+        close_udp(s);
+
+        /* the kernel picks the RTP port, RTCP tries to get the one above */
+        if((s->udp[0] = socket(addr.ss_family, SOCK_DGRAM, 0)) < 0 ||
+           (s->udp[1] = socket(addr.ss_family, SOCK_DGRAM, 0)) < 0)
+            break;
+
+        memset(&s->peer[0], 0, sizeof(s->peer[0]));
+        s->peer[0].ss_family = addr.ss_family;
+        set_port(&s->peer[0], 0);
+        if(bind(s->udp[0], (struct sockaddr *)&s->peer[0], len) < 0 || (port = get_port(s->udp[0])) < 0)
+            break;
+        if(port % 2 != 0)
+            continue;
+
+        set_port(&s->peer[0], port + 1);
+        if(bind(s->udp[1], (struct sockaddr *)&s->peer[0], len) < 0)
+            continue;
+
+        /* packets go to the address the RTSP connection comes from */
+        s->peer[0] = s->peer[1] = addr;
+        s->peer_len = len;
+        set_port(&s->peer[0], client_rtp);
+        set_port(&s->peer[1], client_rtcp);
+
+        fcntl(s->udp[0], F_SETFL, O_NONBLOCK);
+        fcntl(s->udp[1], F_SETFL, O_NONBLOCK);
+        return port;
+    }
+
+    close_udp(s);
+    return -1;
+}
+
+static void start_playing(rtsp_session *s)
+{
+    if(s->state == RTSP_PLAYING)
+        return;
+
+    s->state = RTSP_PLAYING;
+    frame_consumer_add(pglobal->in[s->input].ring, 1);
+    frame_demand_add(pglobal->in[s->input].ring, 0, 1);
+}
+
+static void stop_playing(rtsp_session *s)
+{
+    if(s->state != RTSP_PLAYING)
+        return;
+
+    s->state = RTSP_READY;
+    frame_demand_add(pglobal->in[s->input].ring, 0, -1);
+    frame_consumer_add(pglobal->in[s->input].ring, -1);
+}
+
+/******************************************************************************
+Description.: answers the SETUP request, the transport is either UDP unicast
+              or interleaved in the RTSP connection
+Input Value.: * s....: the session
+              * r....: the request
+              * input: input plugin of the URL
+Return Value: 0 if the answer was sent, -1 otherwise
+******************************************************************************/
+static int setup(rtsp_session *s, rtsp_request *r, int input)
+{
+    char extra[BUFFER_SIZE], transport[REQUEST_STRING_LEN];
+    int a, b, port;
+    char *p;
+
+    if(s->state == RTSP_PLAYING)
+        return reply(s, r, "455 Method Not Valid in This State", "", NULL);
+    if(s->session[0] != '\0' && strcmp(r->session, s->session) != 0)
+        return reply(s, r, "459 Aggregate Operation Not Allowed", "", NULL);
+    if(strstr(r->transport, "multicast") != NULL)
+        return reply(s, r, "461 Unsupported Transport", "", NULL);
+
+    if(strstr(r->transport, "RTP/AVP/TCP") != NULL) {
+        a = 0;
+        b = 1;
+        if((p = strstr(r->transport, "interleaved=")) != NULL && sscanf(p + 12, "%d-%d", &a, &b) == 1)
+            b = a + 1;
+
+        close_udp(s);
+        s->interleaved = 1;
+        s->channel[0] = a;
+        s->channel[1] = b;
+        snprintf(transport, sizeof(transport), "RTP/AVP/TCP;unicast;interleaved=%d-%d", a, b);
+    } else if((p = strstr(r->transport, "client_port=")) != NULL && sscanf(p + 12, "%d", &a) == 1) {
+        if(sscanf(p + 12, "%*d-%d", &b) != 1)
+            b = a + 1;
+
+        s->interleaved = 0;
+        if((port = open_udp(s, a, b)) < 0)
+            return reply(s, r, "500 Internal Server Error", "", NULL);
+        snprintf(transport, sizeof(transport), "RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d", a, b, port, port + 1);
+    } else {
+        return reply(s, r, "461 Unsupported Transport", "", NULL);
+    }
+
+    if(s->session[0] == '\0')
+        snprintf(s->session, sizeof(s->session), "%08lX%04lX", random(), random() & 0xFFFF);
+
+    rtp_stream_init(&s->rtp);
+    s->input = input;
+    s->state = RTSP_READY;
+
+    snprintf(extra, sizeof(extra), "Transport: %s;ssrc=%08X\r\n" \
+             "Session: %s;timeout=%d\r\n", transport, s->rtp.ssrc, s->session, RTSP_SESSION_TIMEOUT);
+    return reply(s, r, "200 OK", extra, NULL);
+}
+
+/******************************************************************************
+Description.: answers the PLAY request, RTP-Info tells the client the
+              timestamp of the newest frame, the first one it will get
+Input Value.: * s: the session
+              * r: the request
+Return Value: 0 if the answer was sent, -1 otherwise
+******************************************************************************/
+static int play(rtsp_session *s, rtsp_request *r)
+{
+    char extra[BUFFER_SIZE], rtptime[32] = "";
+    frame_slot *slot;
+
+    if((slot = frame_acquire(pglobal->in[s->input].ring, 0, s->fd, 0)) != NULL) {
+        snprintf(rtptime, sizeof(rtptime), ";rtptime=%u", rtp_timestamp(&s->rtp, slot->timestamp));
+        frame_release(slot);
+    }
+
+    snprintf(extra, sizeof(extra), "Session: %s;timeout=%d\r\n" \
+             "Range: npt=0.000-\r\n" \
+             "RTP-Info: url=%s;seq=%u%s\r\n", s->session, RTSP_SESSION_TIMEOUT, r->url, s->rtp.seq, rtptime);
+
+    start_playing(s);
+    return reply(s, r, "200 OK", extra, NULL);
+}
+
+/******************************************************************************
+Description.: answers a request
+Input Value.: * s: the session
+              * r: the request
+Return Value: 0 if the connection stays open, -1 otherwise
+******************************************************************************/
+static int handle_request(rtsp_session *s, rtsp_request *r)
+{
+    char extra[BUFFER_SIZE], sdp[BUFFER_SIZE], origin[NI_MAXHOST];
+    int input;
+
+    DBG("RTSP request: %s %s\n", r->method, r->url);
+
+    if(server.conf.auth != NULL && strcmp(server.conf.auth, r->auth) != 0)
+        return reply(s, r, "401 Unauthorized", "WWW-Authenticate: Basic realm=\"" SOURCE_NAME "\"\r\n", NULL);
+
+    if(strcmp(r->method, "OPTIONS") == 0)
+        return reply(s, r, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER, SET_PARAMETER\r\n", NULL);
+
+    if((input = url_input(r->url)) < 0)
+        return reply(s, r, "404 Not Found", "", NULL);
+
+    if(strcmp(r->method, "DESCRIBE") == 0) {
+        socket_local_address(s->fd, origin, sizeof(origin));
+        if(rtp_sdp(sdp, sizeof(sdp), origin, (strchr(origin, ':') != NULL) ? "::" : "0.0.0.0", 0, "track0") < 0)
+            return reply(s, r, "500 Internal Server Error", "", NULL);
+
+        snprintf(extra, sizeof(extra), "Content-Base: %s%s\r\n", r->url,
+                 (r->url[strlen(r->url) - 1] == '/') ? "" : "/");
+        return reply(s, r, "200 OK", extra, sdp);
+    }
+
+    if(strcmp(r->method, "SETUP") == 0)
+        return setup(s, r, input);
+
+    /* keep-alive of clients that do not send receiver reports */
+    if(strcmp(r->method, "GET_PARAMETER") == 0 || strcmp(r->method, "SET_PARAMETER") == 0)
+        return reply(s, r, "200 OK", "", NULL);
+
+    if(strcmp(r->method, "PLAY") != 0 && strcmp(r->method, "PAUSE") != 0 && strcmp(r->method, "TEARDOWN") != 0)
+        return reply(s, r, "501 Not Implemented", "", NULL);
+
+    if(s->state == RTSP_INIT || strcmp(r->session, s->session) != 0)
+        return reply(s, r, "454 Session Not Found", "", NULL);
+
+    if(strcmp(r->method, "PLAY") == 0)
+        return play(s, r);
+
+    snprintf(extra, sizeof(extra), "Session: %s\r\n", s->session);
+
+    if(strcmp(r->method, "PAUSE") == 0) {
+        stop_playing(s);
+        return reply(s, r, "200 OK", extra, NULL);
+    }
+
+    /* TEARDOWN */
+    stop_playing(s);
+    close_udp(s);
+    s->state = RTSP_INIT;
+    s->session[0] = '\0';
+    return reply(s, r, "200 OK", extra, NULL);
+}
+
+/******************************************************************************
+Description.: serves one RTSP connection, while playing it sends every
+              published frame unless the connection is congested
+Input Value.: the session
+Return Value: always NULL
+******************************************************************************/
+static void *session_thread(void *arg)
+{
+    rtsp_session *s = arg;
+    struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+    unsigned int seq = 0, skipped = 0;
+    unsigned char report[BUFFER_SIZE];
+    frame_ring *ring;
+    frame_slot *slot;
+    rtsp_request r;
+    rtp_jpeg j;
+    time_t now;
+    int rc;
+
+    while(!pglobal->stop) {
+
+        /* requests first, a playing session only looks whether there are some */
+        rc = 0;
+        while(rc >= 0 && (s->iobuf.level > 0 || poll(&pfd, 1, (s->state == RTSP_PLAYING) ? 0 : 1000) > 0)) {
+            if((rc = read_request(s, &r, 5)) < 0)
+                break;
+            s->heard = time(NULL);
+            if(rc == 0)
+                rc = handle_request(s, &r);
+        }
+        if(rc < 0)
+            break;
+
+        /* UDP clients prove they are still there with receiver reports */
+        now = time(NULL);
+        if(s->udp[1] >= 0) {
+            while(recv(s->udp[1], report, sizeof(report), 0) > 0)
+                s->heard = now;
+        }
+        if(s->state != RTSP_INIT && !s->interleaved && now - s->heard > RTSP_SESSION_TIMEOUT) {
+            DBG("RTSP session %s timed out\n", s->session);
+            break;
+        }
+
+        if(s->state != RTSP_PLAYING)
+            continue;
+
+        /* the wait is short, so requests are not delayed for long */
+        ring = pglobal->in[s->input].ring;
+        if((slot = frame_acquire(ring, seq, s->fd, RTSP_POLL_MS)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        /* a frame is sent completely or not at all, a slow client just gets fewer */
+        if(s->interleaved && socket_congested(s->fd)) {
+            frame_release(slot);
+            continue;
+        }
+
+        if(rtp_jpeg_parse(frame_data(ring, slot), slot->size, &j) < 0) {
+            frame_release(slot);
+            if(skipped++ == 0)
+                OPRINT("RTSP: frames of input %d can not be sent as RTP/JPEG\n", s->input);
+            continue;
+        }
+
+        rc = rtp_send_jpeg(&s->rtp, &j, slot->timestamp, send_packet, s);
+        frame_release(slot);
+        if(rc < 0)
+            break;
+
+        if(now - s->reported >= RTCP_INTERVAL) {
+            s->reported = now;
+            if(rtp_send_sr(&s->rtp, send_packet, s) < 0)
+                break;
+        }
+    }
+
+    DBG("closing RTSP connection %d\n", s->fd);
+    stop_playing(s);
+    close_udp(s);
+    close(s->fd);
+    mem_free(s);
+    __atomic_sub_fetch(&sessions, 1, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: accepts RTSP clients, every connection gets its own thread
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *accept_clients(void *arg)
+{
+    struct pollfd pfd[RTSP_MAX_SD];
+    rtsp_session *s;
+    pthread_t client;
+    int i, fd;
+
+    for(i = 0; i < sd_len; i++) {
+        pfd[i].fd = sd[i];
+        pfd[i].events = POLLIN;
+    }
+
+    while(!pglobal->stop) {
+        if(poll(pfd, sd_len, 1000) <= 0)
+            continue;
+
+        for(i = 0; i < sd_len; i++) {
+            if(!(pfd[i].revents & POLLIN) || (fd = accept(sd[i], NULL, NULL)) < 0)
+                continue;
+
+            if(__atomic_load_n(&sessions, __ATOMIC_RELAXED) >= rtsp_cfg.sessions ||
+               (s = mem_calloc(1, sizeof(rtsp_session))) == NULL) {
+                DBG("too many RTSP clients, dropping connection %d\n", fd);
+                close(fd);
+                continue;
+            }
+
+            s->fd = fd;
+            s->udp[0] = s->udp[1] = -1;
+            s->heard = time(NULL);
+            __atomic_add_fetch(&sessions, 1, __ATOMIC_RELAXED);
+
+            if(pthread_create(&client, NULL, session_thread, s) != 0) {
+                __atomic_sub_fetch(&sessions, 1, __ATOMIC_RELAXED);
+                close(fd);
+                mem_free(s);
+                continue;
+            }
+            pthread_detach(client);
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: opens the RTSP port on all protocol families and starts to
+              accept clients
+Input Value.: -
+Return Value: 0 on success, -1 if no socket could be opened
+******************************************************************************/
+int rtsp_run(void)
+{
+    if((sd_len = listen_port(rtsp_cfg.port, sd, RTSP_MAX_SD)) == 0) {
+        OPRINT("could not bind to the RTSP port %d\n", rtsp_cfg.port);
+        return -1;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    OPRINT("RTSP TCP port.....: %d, at most %d sessions\n", rtsp_cfg.port, rtsp_cfg.sessions);
+
+    if(pthread_create(&accept_thread, NULL, accept_clients, NULL) != 0) {
+        while(sd_len > 0)
+            close(sd[--sd_len]);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops accepting clients, running sessions end with global.stop
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int rtsp_stop(void)
+{
+    int i;
+
+    if(sd_len == 0)
+        return 0;
+
+    pthread_cancel(accept_thread);
+    pthread_join(accept_thread, NULL);
+
+    for(i = 0; i < sd_len; i++)
+        close(sd[i]);
+    sd_len = 0;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reports the number of RTSP connections
+Input Value.: -
+Return Value: number of connections
+******************************************************************************/
+int rtsp_sessions(void)
+{
+    return __atomic_load_n(&sessions, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RTSP_H
+#define RTSP_H
+
+/*
+ * RTSP server next to the HTTP server, it sends the published frames as
+ * RTP/JPEG over UDP or interleaved in the RTSP connection.
+ * This header needs httpd.h.
+ */
+
+/* sessions without requests or receiver reports for this long are closed */
+#define RTSP_SESSION_TIMEOUT 60
+
+/* milliseconds a playing session waits for a frame before it looks for requests */
+#define RTSP_POLL_MS 100
+
+/* maximum number of listening sockets, one per protocol family */
+#define RTSP_MAX_SD 8
+
+/* sessions served at the same time if no other number is given */
+#define RTSP_SESSIONS 10
+
+struct rtsp_config {
+    int port;           /* 0 disables the RTSP server */
+    int sessions;       /* maximum number of sessions, each pins a frame slot while sending */
+};
+
+extern struct rtsp_config rtsp_cfg;
+
+int rtsp_run(void);
+int rtsp_stop(void);
+int rtsp_sessions(void);
+
+#endif
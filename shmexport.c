@@ -0,0 +1,166 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "uvcstreamer.h"
+#include "uvcshm.h"
+#include "shmexport.h"
+
+#define ALIGN(x) (((x) + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1))
+
+static uvcshm_ring *ring = NULL;
+static char path[NAME_MAX];
+
+/******************************************************************************
+Description.: creates the named ring local consumers read from, a ring left
+              behind by an earlier run is replaced
+Input Value.: * name.........: name of the shared memory object
+              * jpeg_capacity: maximum size of a JPG frame
+              * raw_capacity.: maximum size of a raw picture, 0 if not exported
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+int shmexport_init(const char *name, size_t jpeg_capacity, size_t raw_capacity)
+{
+    size_t header, map_size;
+    int fd, i;
+
+    if(name[0] == '/')
+        name++;
+    if(snprintf(path, sizeof(path), "/%s", name) >= sizeof(path))
+        return -1;
+
+    jpeg_capacity = ALIGN(jpeg_capacity);
+    raw_capacity = ALIGN(raw_capacity);
+    header = ALIGN(sizeof(uvcshm_ring) + SHMEXPORT_SLOTS * sizeof(uvcshm_slot));
+    map_size = header + SHMEXPORT_SLOTS * (jpeg_capacity + raw_capacity);
+
+    shm_unlink(path);
+    if((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    if(ftruncate(fd, map_size) < 0 ||
+       (ring = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror(path);
+        ring = NULL;
+        close(fd);
+        shm_unlink(path);
+        return -1;
+    }
+    close(fd);
+
+    ring->version = UVCSHM_VERSION;
+    ring->slot_count = SHMEXPORT_SLOTS;
+    ring->jpeg_capacity = jpeg_capacity;
+    ring->raw_capacity = raw_capacity;
+    ring->map_size = map_size;
+    for(i = 0; i < SHMEXPORT_SLOTS; i++) {
+        ring->slots[i].jpeg_offset = header + i * (jpeg_capacity + raw_capacity);
+        ring->slots[i].raw_offset = ring->slots[i].jpeg_offset + jpeg_capacity;
+    }
+
+    /* readers check the magic last, the ring is complete once it is set */
+    __atomic_store_n(&ring->magic, UVCSHM_MAGIC, __ATOMIC_RELEASE);
+
+    IPRINT("shared memory ring: %s, %lu bytes\n", path, (unsigned long)map_size);
+    return 0;
+}
+
+/******************************************************************************
+Description.: copies a frame into the next slot and wakes up the readers,
+              it never waits for them
+Input Value.: * seq.......: sequence number of the frame
+              * timestamp.: capture time
+              * width.....: picture size
+              * height....:
+              * jpeg......: the JPG frame
+              * jpeg_size.: its size
+              * raw.......: the raw picture, NULL if there is none
+              * raw_size..: its size
+              * raw_format: V4L2 fourcc of the raw picture
+Return Value: -
+******************************************************************************/
+void shmexport_publish(unsigned int seq, struct timeval timestamp, int width, int height,
+                       const unsigned char *jpeg, size_t jpeg_size,
+                       const unsigned char *raw, size_t raw_size, unsigned int raw_format)
+{
+    uvcshm_slot *s;
+    int idx;
+
+    if(ring == NULL || jpeg_size > ring->jpeg_capacity)
+        return;
+
+    /* a raw picture that does not fit, e.g. after a resolution change, is left out */
+    if(raw == NULL || raw_size > ring->raw_capacity)
+        raw_size = 0;
+
+    idx = (ring->latest + 1) % ring->slot_count;
+    s = &ring->slots[idx];
+
+    __atomic_store_n(&s->lock, s->lock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->seq = seq;
+    s->ts_sec = timestamp.tv_sec;
+    s->ts_usec = timestamp.tv_usec;
+    s->width = width;
+    s->height = height;
+    s->jpeg_size = jpeg_size;
+    s->raw_size = raw_size;
+    s->raw_format = raw_format;
+    memcpy((unsigned char *)ring + s->jpeg_offset, jpeg, jpeg_size);
+    if(raw_size != 0)
+        memcpy((unsigned char *)ring + s->raw_offset, raw, raw_size);
+
+    __atomic_store_n(&s->lock, s->lock + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->latest, idx, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->seq, seq, __ATOMIC_RELEASE);
+
+    /* readers map the ring read-only and can not announce themselves, so wake always */
+    syscall(SYS_futex, &ring->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/******************************************************************************
+Description.: removes the ring, mapped readers keep their mapping
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void shmexport_close(void)
+{
+    if(ring == NULL)
+        return;
+
+    munmap(ring, ring->map_size);
+    ring = NULL;
+    shm_unlink(path);
+}
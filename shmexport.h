@@ -0,0 +1,38 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef SHMEXPORT_H
+#define SHMEXPORT_H
+
+#include <sys/time.h>
+
+/* number of slots of an exported ring, readers have this many frames time */
+#define SHMEXPORT_SLOTS 8
+
+int shmexport_init(const char *name, size_t jpeg_capacity, size_t raw_capacity);
+void shmexport_publish(unsigned int seq, struct timeval timestamp, int width, int height,
+                       const unsigned char *jpeg, size_t jpeg_size,
+                       const unsigned char *raw, size_t raw_size, unsigned int raw_format);
+void shmexport_close(void);
+
+#endif
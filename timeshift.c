@@ -0,0 +1,428 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/mman.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "timeshift.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define INC(p) __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+
+struct timeshift_config timeshift_cfg = {
+    .seconds = 0,
+    .megabytes = TIMESHIFT_DEFAULT_MB,
+};
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+static pthread_t threads[MAX_INPUT_PLUGINS];
+static int running[MAX_INPUT_PLUGINS];
+
+/******************************************************************************
+Description.: allocates the history with its index and data area as one
+              mapping
+Input Value.: * seconds.: how long frames are kept at most
+              * capacity: size of the data area
+              * shared..: 1 if forked worker processes read from the history
+Return Value: the history or NULL in case of error
+******************************************************************************/
+timeshift *timeshift_create(int seconds, size_t capacity, int shared)
+{
+    timeshift *ts;
+    size_t header, mapsize;
+    int entry_count;
+
+    entry_count = MAX(MIN((size_t)seconds * TIMESHIFT_MAX_FPS, capacity / TIMESHIFT_MIN_FRAME), 2);
+
+    capacity = (capacity + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+    header = sizeof(timeshift) + entry_count * sizeof(timeshift_frame);
+    header = (header + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+    mapsize = header + capacity;
+
+    if((ts = frame_map(mapsize, shared)) == MAP_FAILED)
+        return NULL;
+
+    ts->seconds = seconds;
+    ts->entry_count = entry_count;
+    ts->capacity = capacity;
+    ts->data = header;
+    ts->mapsize = mapsize;
+
+    return ts;
+}
+
+/******************************************************************************
+Description.: releases the memory of the history, no reader may use it anymore
+Input Value.: history
+Return Value: -
+******************************************************************************/
+void timeshift_destroy(timeshift *ts)
+{
+    if(ts != NULL)
+        munmap(ts, ts->mapsize);
+}
+
+static int is_pinned(timeshift_frame *f)
+{
+    int i;
+
+    for(i = 0; i < FRAME_MAX_OWNERS; i++) {
+        if(LOAD(&f->pins[i]) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: drops the oldest stored frame unless a reader pins it
+Input Value.: * ts: history
+              * f.: its oldest frame
+Return Value: 0 if the frame was dropped, -1 if it is pinned
+******************************************************************************/
+static int evict(timeshift *ts, timeshift_frame *f)
+{
+    unsigned int seq = f->seq;
+
+    /*
+     * a reader pins first and checks the sequence number afterwards, so
+     * either it sees 0 and lets go or its pin is seen here
+     */
+    STORE(&f->seq, 0);
+    if(is_pinned(f)) {
+        STORE(&f->seq, seq);
+        return -1;
+    }
+
+    ts->w.bytes -= f->size;
+    STORE(&ts->w.first, ts->w.first + 1);
+    return 0;
+}
+
+/******************************************************************************
+Description.: copies a published frame into the history. The oldest frames
+              make room for it, if one of them is pinned the frame is not
+              stored. Only one thread may store frames.
+Input Value.: * ts..: history
+              * ring: ring the frame was published on
+              * slot: the pinned frame
+Return Value: 0 if the frame was stored, -1 otherwise
+******************************************************************************/
+int timeshift_store(timeshift *ts, frame_ring *ring, frame_slot *slot)
+{
+    long long oldest = timeshift_usec(&slot->timestamp) - ts->seconds * 1000000LL;
+    unsigned long long pos = ts->w.pos;
+    unsigned int next = ts->w.next;
+    timeshift_frame *f;
+
+    if(slot->size <= 0 || (size_t)slot->size > ts->capacity / 2) {
+        ts->w.skipped++;
+        return -1;
+    }
+
+    /* a frame does not wrap around the end of the data area */
+    if(pos % ts->capacity + slot->size > ts->capacity)
+        pos += ts->capacity - pos % ts->capacity;
+
+    while(ts->w.first != next) {
+        f = &ts->entries[ts->w.first % ts->entry_count];
+
+        /* the new frame fits, only frames that are too old are dropped now */
+        if(next - ts->w.first < (unsigned int)ts->entry_count && pos + slot->size <= f->pos + ts->capacity) {
+            if(timeshift_usec(&f->timestamp) >= oldest || evict(ts, f) < 0)
+                break;
+            continue;
+        }
+
+        if(evict(ts, f) < 0) {
+            ts->w.skipped++;
+            return -1;
+        }
+    }
+
+    f = &ts->entries[next % ts->entry_count];
+    f->source_seq = slot->source_seq;
+    f->timestamp = slot->timestamp;
+    f->size = slot->size;
+    f->pos = pos;
+    memcpy(timeshift_data(ts, f), frame_data(ring, slot), slot->size);
+    STORE(&f->index, next);
+    STORE(&f->seq, slot->seq);
+
+    ts->w.pos = pos + slot->size;
+    ts->w.bytes += slot->size;
+    ts->w.stored++;
+    STORE(&ts->w.next, next + 1);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: pins a stored frame, the storing thread does not replace it
+              until it is released
+Input Value.: * ts...: history
+              * index: index of the frame
+Return Value: the pinned frame or NULL if it is not stored (anymore)
+******************************************************************************/
+timeshift_frame *timeshift_at(timeshift *ts, unsigned int index)
+{
+    timeshift_frame *f = &ts->entries[index % ts->entry_count];
+
+    if((int)(index - LOAD(&ts->w.first)) < 0 || (int)(LOAD(&ts->w.next) - index) <= 0)
+        return NULL;
+
+    INC(&f->pins[frame_owner]);
+    if(LOAD(&f->seq) != 0 && LOAD(&f->index) == index)
+        return f;
+    DEC(&f->pins[frame_owner]);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: binary search through the stored frames, their capture times
+              and sequence numbers grow with the index
+Input Value.: * ts...: history
+              * lo/hi: range of indexes to search
+              * key..: the searched capture time or sequence number
+              * seq..: 1 to compare sequence numbers, 0 for capture times
+              * upper: 1 to find the first frame after key, 0 to find the
+                       first frame at or after key
+Return Value: index of that frame, hi if there is none
+******************************************************************************/
+static unsigned int search(timeshift *ts, unsigned int lo, unsigned int hi, long long key, int seq, int upper)
+{
+    timeshift_frame *f;
+    unsigned int mid;
+    long long value;
+
+    while(lo != hi) {
+        mid = lo + (hi - lo) / 2;
+        f = &ts->entries[mid % ts->entry_count];
+        value = seq ? (long long)f->source_seq : timeshift_usec(&f->timestamp);
+
+        if(value < key || (upper && value == key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/******************************************************************************
+Description.: finds and pins a stored frame by its capture time
+Input Value.: * ts....: history
+              * usec..: capture time in microseconds
+              * before: 1 for the newest frame captured at or before usec,
+                        0 for the oldest frame captured at or after it
+Return Value: the pinned frame or NULL if there is none
+******************************************************************************/
+timeshift_frame *timeshift_by_time(timeshift *ts, long long usec, int before)
+{
+    unsigned int first, next, index;
+    timeshift_frame *f;
+
+    for(;;) {
+        first = LOAD(&ts->w.first);
+        next = LOAD(&ts->w.next);
+
+        index = search(ts, first, next, usec, 0, before);
+        if(before) {
+            if(index == first)
+                return NULL;
+            index--;
+        } else if(index == next) {
+            return NULL;
+        }
+
+        /* the frame got replaced during the search, look again */
+        if((f = timeshift_at(ts, index)) != NULL)
+            return f;
+    }
+}
+
+/******************************************************************************
+Description.: finds and pins a stored frame by its X-Sequence number
+Input Value.: * ts........: history
+              * source_seq: the sequence number
+Return Value: the pinned frame or NULL if it is not stored
+******************************************************************************/
+timeshift_frame *timeshift_by_seq(timeshift *ts, unsigned int source_seq)
+{
+    unsigned int first, next, index;
+    timeshift_frame *f;
+
+    do {
+        first = LOAD(&ts->w.first);
+        next = LOAD(&ts->w.next);
+
+        if((index = search(ts, first, next, source_seq, 1, 0)) == next)
+            return NULL;
+    } while((f = timeshift_at(ts, index)) == NULL);
+
+    if(f->source_seq == source_seq)
+        return f;
+
+    timeshift_release(f);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: unpins a frame
+Input Value.: frame returned by one of the functions above
+Return Value: -
+******************************************************************************/
+void timeshift_release(timeshift_frame *f)
+{
+    DEC(&f->pins[frame_owner]);
+}
+
+/******************************************************************************
+Description.: drops the pins of a worker process that died
+Input Value.: * ts...: history
+              * owner: owner number of the process
+Return Value: -
+******************************************************************************/
+void timeshift_owner_reset(timeshift *ts, int owner)
+{
+    int i;
+
+    if(owner <= 0 || owner >= FRAME_MAX_OWNERS)
+        return;
+
+    for(i = 0; i < ts->entry_count; i++)
+        STORE(&ts->entries[i].pins[owner], 0);
+}
+
+/******************************************************************************
+Description.: copies every published frame of an input into its history.
+              The history is a permanent consumer, the camera keeps running
+              at its full rate for it.
+Input Value.: the input
+Return Value: always NULL
+******************************************************************************/
+static void *keep_frames(void *arg)
+{
+    input *in = arg;
+    unsigned int seq = 0;
+    frame_slot *slot;
+
+    frame_consumer_add(in->ring, 1);
+    frame_demand_add(in->ring, 0, 1);
+
+    while(!pglobal->stop) {
+        /* waiting for frames is no cancellation point */
+        pthread_testcancel();
+
+        if((slot = frame_acquire(in->ring, seq, 0, 1000)) == NULL)
+            continue;
+        seq = slot->seq;
+
+        timeshift_store(in->history, in->ring, slot);
+        frame_release(slot);
+    }
+
+    frame_demand_add(in->ring, 0, -1);
+    frame_consumer_add(in->ring, -1);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: allocates the history of every input, it must happen before
+              the worker processes are forked
+Input Value.: -
+Return Value: 0 on success, -1 if the memory could not be mapped
+******************************************************************************/
+int timeshift_init(void)
+{
+    int k;
+
+    for(k = 0; k < pglobal->incnt; k++) {
+        if(pglobal->in[k].ring == NULL)
+            continue;
+
+        if((pglobal->in[k].history = timeshift_create(timeshift_cfg.seconds,
+                                     (size_t)timeshift_cfg.megabytes * 1024 * 1024, pglobal->workers > 0)) == NULL) {
+            OPRINT("could not allocate %d MB for the timeshift history\n", timeshift_cfg.megabytes);
+            return -1;
+        }
+    }
+
+    OPRINT("timeshift.........: %d seconds, at most %d MB per input\n", timeshift_cfg.seconds, timeshift_cfg.megabytes);
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts storing the frames of every input with a history
+Input Value.: -
+Return Value: 0 on success, -1 if a thread could not be created
+******************************************************************************/
+int timeshift_run(void)
+{
+    int k;
+
+    for(k = 0; k < pglobal->incnt; k++) {
+        if(pglobal->in[k].history == NULL)
+            continue;
+
+        if(pthread_create(&threads[k], NULL, keep_frames, &pglobal->in[k]) != 0)
+            return -1;
+        running[k] = 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops storing frames, the histories stay readable
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int timeshift_stop(void)
+{
+    int k;
+
+    for(k = 0; k < MAX_INPUT_PLUGINS; k++) {
+        if(!running[k])
+            continue;
+
+        pthread_cancel(threads[k]);
+        pthread_join(threads[k], NULL);
+        running[k] = 0;
+    }
+
+    return 0;
+}
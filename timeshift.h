@@ -0,0 +1,130 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include "frame.h"
+
+/*
+ * The frame ring only keeps the few latest frames, so the history of an
+ * input keeps copies of the published frames for a number of seconds or
+ * up to a memory limit, whatever is reached first. Clients stream or fetch
+ * past frames from it by sequence number or capture time.
+ */
+
+/* memory limit of the history of one input if none is given */
+#define TIMESHIFT_DEFAULT_MB 64
+
+/*
+ * the index has room for the given seconds at this rate, but for no more
+ * frames than fit into the data area if they had at least the minimum size
+ */
+#define TIMESHIFT_MAX_FPS FRAME_DEMAND_MAX
+#define TIMESHIFT_MIN_FRAME 4096
+
+/*
+ * Index entry of one stored frame. Only the oldest frames get replaced and
+ * only while nobody pins them, so a pinned frame and its data stay intact
+ * until timeshift_release().
+ */
+typedef struct _timeshift_frame timeshift_frame;
+struct _timeshift_frame {
+    unsigned int seq;           /* sequence number in the frame ring, 0 while the entry is unused */
+    unsigned int source_seq;    /* X-Sequence of the frame */
+    struct timeval timestamp;   /* capture time */
+    unsigned int index;         /* counts up for every stored frame, the entry is index % entry_count */
+    int size;
+    unsigned long long pos;     /* start of the data, counts up through the data area */
+    int pins[FRAME_MAX_OWNERS]; /* readers of each owner that currently pin this frame */
+} CACHE_ALIGNED;
+
+/*
+ * The history is a single mapping: this header, the index and the data
+ * area. Frames are written one after the other into the data area and
+ * never wrap around its end.
+ */
+typedef struct _timeshift timeshift;
+struct _timeshift {
+    /* only written by the thread storing the frames */
+    struct {
+        unsigned int first;     /* index of the oldest stored frame */
+        unsigned int next;      /* index of the next frame, first == next if nothing is stored */
+        unsigned long long pos; /* data position of the next frame */
+        size_t bytes;           /* sum of the sizes of the stored frames */
+        unsigned long stored;
+        unsigned long skipped;  /* frames not stored because the space they needed was pinned */
+    } w CACHE_ALIGNED;
+
+    /* constant after timeshift_create() */
+    int seconds;
+    int entry_count;
+    size_t capacity;            /* size of the data area */
+    size_t data;                /* start of the data area, counted from the start of the mapping */
+    size_t mapsize;
+
+    timeshift_frame entries[];
+};
+
+struct timeshift_config {
+    int seconds;        /* 0 keeps no history */
+    int megabytes;      /* memory limit of the history of each input */
+};
+
+extern struct timeshift_config timeshift_cfg;
+
+timeshift *timeshift_create(int seconds, size_t capacity, int shared);
+void timeshift_destroy(timeshift *ts);
+int timeshift_store(timeshift *ts, frame_ring *ring, frame_slot *slot);
+
+timeshift_frame *timeshift_at(timeshift *ts, unsigned int index);
+timeshift_frame *timeshift_by_time(timeshift *ts, long long usec, int before);
+timeshift_frame *timeshift_by_seq(timeshift *ts, unsigned int source_seq);
+void timeshift_release(timeshift_frame *f);
+void timeshift_owner_reset(timeshift *ts, int owner);
+
+int timeshift_init(void);
+int timeshift_run(void);
+int timeshift_stop(void);
+
+/******************************************************************************
+Description.: returns the data of a stored frame
+Input Value.: history and one of its pinned frames
+Return Value: pointer to the JPG data
+******************************************************************************/
+static inline unsigned char *timeshift_data(timeshift *ts, timeshift_frame *f)
+{
+    return (unsigned char *)ts + ts->data + f->pos % ts->capacity;
+}
+
+/******************************************************************************
+Description.: capture time of a frame in microseconds
+Input Value.: timestamp
+Return Value: microseconds
+******************************************************************************/
+static inline long long timeshift_usec(const struct timeval *tv)
+{
+    return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+#endif
@@ -0,0 +1,222 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef UVCSHM_H
+#define UVCSHM_H
+
+/*
+ * Layout of the shared memory ring exported with -S and the functions a
+ * local consumer needs to read it. The header does not depend on any
+ * other file of uvcstreamer, copy it into the consumer and link with -lrt
+ * on older C libraries.
+ *
+ * The capture process writes the slots round robin and never waits for
+ * readers, readers map the ring read-only. Every slot is guarded by a
+ * sequence lock: a reader looks at a frame right in the ring and checks
+ * afterwards whether the slot was overwritten meanwhile.
+ *
+ *     uvcshm_ring *r = uvcshm_open("uvcstreamer");
+ *     uvcshm_frame f;
+ *     unsigned int seq = 0;
+ *
+ *     while(uvcshm_wait(r, seq, 1000) >= 0) {
+ *         if(uvcshm_begin(r, &f) < 0)
+ *             continue;
+ *         analyze(f.jpeg, f.jpeg_size, f.raw, f.raw_size);
+ *         if(uvcshm_valid(r, &f))
+ *             use_the_result();
+ *         seq = f.seq;
+ *     }
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define UVCSHM_MAGIC 0x52435655     /* "UVCR" */
+#define UVCSHM_VERSION 1
+
+typedef struct {
+    uint32_t lock;          /* sequence lock, odd while the slot gets written */
+    uint32_t seq;           /* sequence number of the frame */
+    int64_t ts_sec;         /* capture time of the frame */
+    int64_t ts_usec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t jpeg_size;
+    uint32_t raw_size;      /* 0 if the raw picture is not exported */
+    uint32_t raw_format;    /* V4L2 fourcc of the raw picture, e.g. YUYV */
+    uint32_t reserved;
+    uint64_t jpeg_offset;   /* counted from the start of the mapping */
+    uint64_t raw_offset;
+} uvcshm_slot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t seq;           /* futex word, sequence number of the latest frame */
+    uint32_t latest;        /* slot holding it */
+    uint32_t reserved;
+    uint64_t jpeg_capacity; /* bytes per slot */
+    uint64_t raw_capacity;
+    uint64_t map_size;
+    uvcshm_slot slots[];
+} uvcshm_ring;
+
+/* one frame as seen by uvcshm_begin() */
+typedef struct {
+    const uvcshm_slot *slot;
+    uint32_t lock;
+    uint32_t seq;
+    int64_t ts_sec;
+    int64_t ts_usec;
+    uint32_t width;
+    uint32_t height;
+    const unsigned char *jpeg;
+    size_t jpeg_size;
+    const unsigned char *raw;   /* NULL if not exported */
+    size_t raw_size;
+    uint32_t raw_format;
+} uvcshm_frame;
+
+/******************************************************************************
+Description.: maps an exported ring read-only
+Input Value.: name given to -S
+Return Value: the ring or NULL, errno tells why
+******************************************************************************/
+static inline uvcshm_ring *uvcshm_open(const char *name)
+{
+    char path[NAME_MAX];
+    struct stat st;
+    uvcshm_ring *r;
+    int fd;
+
+    if(name[0] == '/')
+        name++;
+    if((size_t)snprintf(path, sizeof(path), "/%s", name) >= sizeof(path))
+        return NULL;
+
+    if((fd = shm_open(path, O_RDONLY, 0)) < 0)
+        return NULL;
+
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(uvcshm_ring)) {
+        close(fd);
+        return NULL;
+    }
+
+    r = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(r == MAP_FAILED)
+        return NULL;
+
+    if(r->magic != UVCSHM_MAGIC || r->version != UVCSHM_VERSION || r->map_size > (uint64_t)st.st_size) {
+        munmap(r, st.st_size);
+        return NULL;
+    }
+
+    return r;
+}
+
+static inline void uvcshm_close(uvcshm_ring *r)
+{
+    munmap(r, r->map_size);
+}
+
+/******************************************************************************
+Description.: waits for a frame newer than last_seq
+Input Value.: * r.........: the ring
+              * last_seq..: sequence number of the frame the reader has, 0 if none
+              * timeout_ms: maximum time to wait, <0 waits forever
+Return Value: sequence number of the latest frame, -1 on timeout
+******************************************************************************/
+static inline long uvcshm_wait(uvcshm_ring *r, uint32_t last_seq, int timeout_ms)
+{
+    struct timespec ts, *pts = NULL;
+    uint32_t seq;
+
+    if(timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        pts = &ts;
+    }
+
+    while((seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE)) == last_seq) {
+        if(syscall(SYS_futex, &r->seq, FUTEX_WAIT, seq, pts, NULL, 0) < 0 && timeout_ms >= 0 &&
+           __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == last_seq)
+            return -1;
+    }
+
+    return seq;
+}
+
+/******************************************************************************
+Description.: checks whether a frame was left alone while it was used, a
+              result computed from an overwritten frame must be dropped
+Input Value.: * r: the ring
+              * f: frame returned by uvcshm_begin()
+Return Value: 1 if the frame is still intact, 0 otherwise
+******************************************************************************/
+static inline int uvcshm_valid(uvcshm_ring *r, const uvcshm_frame *f)
+{
+    (void)r;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&f->slot->lock, __ATOMIC_RELAXED) == f->lock;
+}
+
+/******************************************************************************
+Description.: looks at the latest frame, the data stays in the ring
+Input Value.: * r: the ring
+              * f: stores the frame
+Return Value: 0 on success, -1 if the slot is being written right now
+******************************************************************************/
+static inline int uvcshm_begin(uvcshm_ring *r, uvcshm_frame *f)
+{
+    const uvcshm_slot *s = &r->slots[__atomic_load_n(&r->latest, __ATOMIC_ACQUIRE) % r->slot_count];
+
+    f->slot = s;
+    f->lock = __atomic_load_n(&s->lock, __ATOMIC_ACQUIRE);
+    if(f->lock & 1)
+        return -1;
+
+    f->seq = s->seq;
+    f->ts_sec = s->ts_sec;
+    f->ts_usec = s->ts_usec;
+    f->width = s->width;
+    f->height = s->height;
+    f->jpeg = (const unsigned char *)r + s->jpeg_offset;
+    f->jpeg_size = s->jpeg_size;
+    f->raw = (s->raw_size != 0) ? (const unsigned char *)r + s->raw_offset : NULL;
+    f->raw_size = s->raw_size;
+    f->raw_format = s->raw_format;
+
+    return uvcshm_valid(r, f) ? 0 : -1;
+}
+
+#endif
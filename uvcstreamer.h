@@ -44,6 +44,9 @@
 
 #define LOG(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
 
+#include "frame.h"
+#include "timeshift.h"
+#include "motion.h"
 #include "input.h"
 #include "output.h"
 
@@ -90,6 +93,15 @@ struct _globals {
     output out[MAX_OUTPUT_PLUGINS];
     int outcnt;
 
+    /* maximum number of concurrent clients, sizes the frame and connection pools */
+    int max_clients;
+
+    /* number of HTTP worker processes, 0 serves the clients from this process */
+    int workers;
+
+    /* slots of every frame ring, see ring_slots() */
+    int ring_slots;
+
     /* pointer to control functions */
     //int (*control)(int command, char *details);
 };
@@ -28,6 +28,7 @@
 #include "v4l2uvc.h"
 #include "huffman.h"
 #include "dynctrl.h"
+#include "utils.h"
 
 static int debug = 0;
 
@@ -69,9 +70,9 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
     vd->videodevice = NULL;
     vd->status = NULL;
     vd->pictName = NULL;
-    vd->videodevice = (char *) calloc(1, 16 * sizeof(char));
-    vd->status = (char *) calloc(1, 100 * sizeof(char));
-    vd->pictName = (char *) calloc(1, 80 * sizeof(char));
+    vd->videodevice = (char *) mem_calloc(1, 16 * sizeof(char));
+    vd->status = (char *) mem_calloc(1, 100 * sizeof(char));
+    vd->pictName = (char *) mem_calloc(1, 80 * sizeof(char));
 
     snprintf(vd->videodevice, 12, "%s", device);
 
@@ -107,9 +108,9 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         }
 
         if (pglobal->in[id].in_formats == NULL) {
-            pglobal->in[id].in_formats = (input_format*)calloc(1, sizeof(input_format));
+            pglobal->in[id].in_formats = (input_format*)mem_calloc(1, sizeof(input_format));
         } else {
-            pglobal->in[id].in_formats = (input_format*)realloc(pglobal->in[id].in_formats, (pglobal->in[id].formatCount + 1) * sizeof(input_format));
+            pglobal->in[id].in_formats = (input_format*)mem_realloc(pglobal->in[id].in_formats, (pglobal->in[id].formatCount + 1) * sizeof(input_format));
         }
 
         if (pglobal->in[id].in_formats == NULL) {
@@ -139,10 +140,10 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
                 pglobal->in[id].in_formats[pglobal->in[id].formatCount].resolutionCount++;
                 if (pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions == NULL) {
                     pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions =
-                        (input_resolution*)calloc(1, sizeof(input_resolution));
+                        (input_resolution*)mem_calloc(1, sizeof(input_resolution));
                 } else {
                     pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions =
-                        (input_resolution*)realloc(pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions, j * sizeof(input_resolution));
+                        (input_resolution*)mem_realloc(pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions, j * sizeof(input_resolution));
                 }
 
                 if (pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions == NULL) {
@@ -170,7 +171,7 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
     case V4L2_PIX_FMT_MJPEG:
     case V4L2_PIX_FMT_YUYV:
         vd->framebuffer =
-            (unsigned char *) calloc(1, (size_t) vd->framesizeIn);
+            (unsigned char *) mem_calloc(1, (size_t) vd->framesizeIn);
         vd->framebuffer_sz=0;
         vd->timestamp.tv_sec = 0;
         vd->timestamp.tv_usec = 0;
@@ -186,14 +187,105 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         goto error;
     return 0;
 error:
-    free(pglobal->in[id].in_parameters);
-    free(vd->videodevice);
-    free(vd->status);
-    free(vd->pictName);
+    mem_free(pglobal->in[id].in_parameters);
+    mem_free(vd->videodevice);
+    mem_free(vd->status);
+    mem_free(vd->pictName);
     CLOSE_VIDEO(vd->fd);
     return -1;
 }
 
+/******************************************************************************
+Description.: adds a frame rate to the sorted list of supported rates
+Input Value.: * vd..: video device
+              * fps.: frames per second
+Return Value: -
+******************************************************************************/
+static void add_framerate(struct vdIn *vd, int fps)
+{
+    int i, k;
+
+    if(fps <= 0 || vd->framerate_count == MAX_FRAMERATES)
+        return;
+
+    for(i = 0; i < vd->framerate_count && vd->framerates[i] < fps; i++);
+    if(i < vd->framerate_count && vd->framerates[i] == fps)
+        return;
+
+    for(k = vd->framerate_count; k > i; k--)
+        vd->framerates[k] = vd->framerates[k - 1];
+    vd->framerates[i] = fps;
+    vd->framerate_count++;
+}
+
+/******************************************************************************
+Description.: asks the driver which frame rates the current format and
+              resolution support, rates are rounded to whole frames
+Input Value.: video device
+Return Value: number of rates found, 0 if the driver does not tell
+******************************************************************************/
+static int enumFramerates(struct vdIn *vd)
+{
+    struct v4l2_frmivalenum fival;
+    int fps, min_fps, max_fps;
+
+    vd->framerate_count = 0;
+
+    memset(&fival, 0, sizeof(fival));
+    fival.pixel_format = vd->formatIn;
+    fival.width = vd->width;
+    fival.height = vd->height;
+
+    while(xioctl(vd->fd, VIDIOC_ENUM_FRAMEINTERVALS, &fival) == 0) {
+        if(fival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            if(fival.discrete.numerator != 0)
+                add_framerate(vd, (fival.discrete.denominator + fival.discrete.numerator / 2) / fival.discrete.numerator);
+            fival.index++;
+            continue;
+        }
+
+        /* continuous or stepwise intervals, offer every whole rate in between */
+        if(fival.stepwise.min.numerator == 0 || fival.stepwise.max.numerator == 0)
+            break;
+        max_fps = fival.stepwise.min.denominator / fival.stepwise.min.numerator;
+        min_fps = (fival.stepwise.max.denominator + fival.stepwise.max.numerator - 1) / fival.stepwise.max.numerator;
+        for(fps = MAX(min_fps, 1); fps <= max_fps; fps++)
+            add_framerate(vd, fps);
+        break;
+    }
+
+    DBG("%d frame rates supported\n", vd->framerate_count);
+    return vd->framerate_count;
+}
+
+/******************************************************************************
+Description.: sets the frame interval, the device must not be streaming
+Input Value.: * vd..: video device
+              * fps.: frames per second
+Return Value: 0 on success, -1 if the driver refused
+******************************************************************************/
+static int set_framerate(struct vdIn *vd, int fps)
+{
+    struct v4l2_streamparm setfps;
+
+    memset(&setfps, 0, sizeof(struct v4l2_streamparm));
+    setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    setfps.parm.capture.timeperframe.numerator = 1;
+    setfps.parm.capture.timeperframe.denominator = fps;
+    if(xioctl(vd->fd, VIDIOC_S_PARM, &setfps) < 0)
+        return -1;
+
+    /* the driver reports what it actually picked */
+    if(setfps.parm.capture.timeperframe.numerator != 0)
+        vd->fps_current = (setfps.parm.capture.timeperframe.denominator +
+                           setfps.parm.capture.timeperframe.numerator / 2) /
+                          setfps.parm.capture.timeperframe.numerator;
+    else
+        vd->fps_current = fps;
+
+    return 0;
+}
+
 static int init_v4l2(struct vdIn *vd)
 {
     int i;
@@ -268,13 +360,9 @@ static int init_v4l2(struct vdIn *vd)
     /*
      * set framerate
      */
-    struct v4l2_streamparm *setfps;
-    setfps = (struct v4l2_streamparm *) calloc(1, sizeof(struct v4l2_streamparm));
-    memset(setfps, 0, sizeof(struct v4l2_streamparm));
-    setfps->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    setfps->parm.capture.timeperframe.numerator = 1;
-    setfps->parm.capture.timeperframe.denominator = vd->fps;
-    ret = xioctl(vd->fd, VIDIOC_S_PARM, setfps);
+    enumFramerates(vd);
+    if(set_framerate(vd, vd->fps) < 0)
+        vd->fps_current = vd->fps;
 
     /*
      * request buffers
@@ -492,6 +580,9 @@ int uvcGrab(struct vdIn *vd)
     }
 #endif
 
+    /* capture time of this frame, clients pace their streams by it */
+    vd->timestamp = vd->buf.timestamp;
+
     ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
 
     if(ret < 0) {
@@ -518,11 +609,11 @@ int close_v4l2(struct vdIn *vd)
 {
     if(vd->streamingState == STREAMING_ON)
         video_disable(vd, STREAMING_OFF);
-    free(vd->framebuffer);
+    mem_free(vd->framebuffer);
     vd->framebuffer = NULL;
-    free(vd->videodevice);
-    free(vd->status);
-    free(vd->pictName);
+    mem_free(vd->videodevice);
+    mem_free(vd->status);
+    mem_free(vd->pictName);
     vd->videodevice = NULL;
     vd->status = NULL;
     vd->pictName = NULL;
@@ -645,6 +736,7 @@ int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number
                 return -1;
             } else {
                 DBG("control id: %d new value: %d\n", ext_ctrl.id, ext_ctrl.value);
+                pglobal->in[plugin_number].in_parameters[i].value = value;
             }
             return 0;
         }
@@ -680,10 +772,10 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
     struct v4l2_control c;
     c.id = ctrl->id;
     if (pglobal->in[id].in_parameters == NULL) {
-        pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
+        pglobal->in[id].in_parameters = (control*)mem_calloc(1, sizeof(control));
     } else {
         pglobal->in[id].in_parameters =
-        (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
+        (control*)mem_realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
     }
 
     if (pglobal->in[id].in_parameters == NULL) {
@@ -696,7 +788,7 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
     pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = c.value;
     if(ctrl->type == V4L2_CTRL_TYPE_MENU) {
         pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems =
-            (struct v4l2_querymenu*)malloc((ctrl->maximum + 1) * sizeof(struct v4l2_querymenu));
+            (struct v4l2_querymenu*)mem_malloc((ctrl->maximum + 1) * sizeof(struct v4l2_querymenu));
         int i;
         for(i = ctrl->minimum; i <= ctrl->maximum; i++) {
             struct v4l2_querymenu qm;
@@ -776,6 +868,54 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
     Close the filedescriptor
     Initialize the camera again with the new resolution
 */
+/******************************************************************************
+Description.: picks the supported frame rate for a requested one, that is
+              the slowest rate which still delivers enough frames
+Input Value.: * vd..: video device
+              * fps.: requested frames per second, 0 for the slowest rate
+Return Value: supported rate, never above the configured vd->fps
+******************************************************************************/
+int nearestFramerate(struct vdIn *vd, int fps)
+{
+    int i, best = vd->fps;
+
+    if(vd->framerate_count == 0 || fps >= vd->fps)
+        return vd->fps;
+
+    for(i = vd->framerate_count - 1; i >= 0; i--) {
+        if(vd->framerates[i] > vd->fps)
+            continue;
+        if(vd->framerates[i] < fps)
+            break;
+        best = vd->framerates[i];
+    }
+
+    return best;
+}
+
+/******************************************************************************
+Description.: changes the frame rate of a running camera, most drivers only
+              accept a new interval while the stream is off. The next
+              uvcGrab() starts streaming again.
+Input Value.: * vd..: video device
+              * fps.: frames per second
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+int setFramerate(struct vdIn *vd, int fps)
+{
+    DBG("setFramerate(%d)\n", fps);
+
+    if(vd->streamingState == STREAMING_ON && video_disable(vd, STREAMING_OFF) != 0)
+        return -1;
+
+    if(set_framerate(vd, fps) < 0) {
+        perror("Unable to set the frame rate");
+        return -1;
+    }
+
+    return 0;
+}
+
 int setResolution(struct vdIn *vd, int width, int height)
 {
     int ret;
@@ -870,9 +1010,9 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
         ctrl_jpeg.flags = 0;
         ctrl_jpeg.type = V4L2_CTRL_TYPE_INTEGER;
         if (pglobal->in[id].in_parameters == NULL) {
-            pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
+            pglobal->in[id].in_parameters = (control*)mem_calloc(1, sizeof(control));
         } else {
-            pglobal->in[id].in_parameters = (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
+            pglobal->in[id].in_parameters = (control*)mem_realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
         }
 
         if (pglobal->in[id].in_parameters == NULL) {
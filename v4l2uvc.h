@@ -41,6 +41,9 @@
 
 #define NB_BUFFER 4
 
+/* number of frame rates remembered per resolution */
+#define MAX_FRAMERATES 32
+
 
 #define IOCTL_RETRY 4
 
@@ -89,6 +92,9 @@ struct vdIn {
     int width;
     int height;
     int fps;
+    int fps_current;                    /* rate the camera runs at, at most fps */
+    int framerates[MAX_FRAMERATES];     /* rates supported at this resolution, ascending */
+    int framerate_count;                /* 0 if the driver does not report them */
     int formatIn;
     int formatOut;
     int framesizeIn;
@@ -108,6 +114,8 @@ int init_videoIn(struct vdIn *vd, char *device, int width, int height, int fps,
 void enumerateControls(struct vdIn *vd, globals *pglobal, int id);
 void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id);
 int setResolution(struct vdIn *vd, int width, int height);
+int nearestFramerate(struct vdIn *vd, int fps);
+int setFramerate(struct vdIn *vd, int fps);
 
 int memcpy_picture(unsigned char *out, unsigned char *buf, int size);
 int uvcGrab(struct vdIn *vd);
@@ -0,0 +1,302 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "httpd.h"
+#include "websocket.h"
+
+/* appended to the key of the client before it gets hashed */
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/******************************************************************************
+Description.: SHA-1 of a short string, the handshake is its only user
+Input Value.: * data: the input
+              * len.: its length
+              * hash: stores the 20 bytes of the digest
+Return Value: -
+******************************************************************************/
+static void sha1(const unsigned char *data, size_t len, unsigned char *hash)
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint32_t w[80], a, b, c, d, e, f, k, t;
+    unsigned char block[64];
+    size_t done = 0, n;
+    int i, last = 0;
+
+    while(!last) {
+        /* the final blocks carry the 0x80 marker and the length in bits */
+        n = MIN(len - MIN(done, len), 64);
+        memset(block, 0, sizeof(block));
+        memcpy(block, data + done, n);
+        if(n < 64 && done <= len)
+            block[n] = 0x80;
+        if(n < 56) {
+            uint64_t bits = (uint64_t)len * 8;
+            for(i = 0; i < 8; i++)
+                block[63 - i] = bits >> (8 * i);
+            last = 1;
+        }
+        done += 64;
+
+        for(i = 0; i < 16; i++)
+            w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+        for(i = 16; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for(i = 0; i < 80; i++) {
+            if(i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if(i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if(i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            t = ROL(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = ROL(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for(i = 0; i < 20; i++)
+        hash[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/******************************************************************************
+Description.: calculates the Sec-WebSocket-Accept answer of the handshake
+Input Value.: * key...: value of the Sec-WebSocket-Key header of the client
+              * accept: stores the answer, WS_KEY_LEN bytes
+Return Value: -
+******************************************************************************/
+void ws_accept_key(const char *key, char *accept)
+{
+    char buffer[WS_KEY_LEN + sizeof(WS_GUID)];
+    unsigned char hash[20];
+
+    snprintf(buffer, sizeof(buffer), "%.*s%s", WS_KEY_LEN - 1, key, WS_GUID);
+    sha1((unsigned char *)buffer, strlen(buffer), hash);
+    encode_base64(hash, sizeof(hash), accept);
+}
+
+/******************************************************************************
+Description.: sends one unfragmented message, the payload is made of two parts
+              so a frame can go out straight from its slot behind a small
+              header, without a copy
+Input Value.: * fd......: connected socket
+              * opcode..: WS_OP_*
+              * head....: first part of the payload, may be NULL
+              * head_len: its length
+              * data....: second part of the payload, may be NULL
+              * len.....: its length
+Return Value: 0 if everything was sent, -1 otherwise
+******************************************************************************/
+int ws_send(int fd, int opcode, const void *head, size_t head_len, const void *data, size_t len)
+{
+    unsigned char header[10];
+    size_t total = head_len + len, hlen = 2, sent = 0, want;
+    struct iovec iov[3];
+    ssize_t rc;
+    int i, n;
+
+    header[0] = 0x80 | opcode;
+    if(total < 126) {
+        header[1] = total;
+    } else if(total <= 0xFFFF) {
+        header[1] = 126;
+        header[2] = total >> 8;
+        header[3] = total;
+        hlen = 4;
+    } else {
+        header[1] = 127;
+        for(i = 0; i < 8; i++)
+            header[9 - i] = (uint64_t)total >> (8 * i);
+        hlen = 10;
+    }
+    want = hlen + total;
+
+    /* writev() may return early on a signal, continue where it stopped */
+    while(sent < want) {
+        size_t skip = sent;
+        const void *part[3] = { header, head, data };
+        size_t part_len[3] = { hlen, head_len, len };
+
+        for(i = 0, n = 0; i < 3; i++) {
+            if(skip >= part_len[i]) {
+                skip -= part_len[i];
+                continue;
+            }
+            iov[n].iov_base = (char *)part[i] + skip;
+            iov[n].iov_len = part_len[i] - skip;
+            skip = 0;
+            n++;
+        }
+
+        if((rc = writev(fd, iov, n)) <= 0)
+            return -1;
+        sent += rc;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: sends a close message
+Input Value.: * fd....: connected socket
+              * status: WS_CLOSE_*
+Return Value: 0 if it was sent, -1 otherwise
+******************************************************************************/
+int ws_close(int fd, int status)
+{
+    unsigned char payload[2] = { status >> 8, status & 0xFF };
+
+    return ws_send(fd, WS_OP_CLOSE, payload, sizeof(payload), NULL, 0);
+}
+
+/******************************************************************************
+Description.: reads what the client sent. Pings are answered right away,
+              fragments are put together, a fragmented message survives
+              calls that return 1. The call blocks until a frame arrived,
+              so it should only be called once data is available.
+Input Value.: * fd.....: connected socket
+              * iobuf..: buffer of the connection
+              * msg....: stores the message
+              * timeout: seconds to wait for each part of the message
+Return Value: 0 if a complete text, binary or close message was read,
+              1 if only a ping or pong arrived, -1 if the connection failed
+              or the client broke the protocol
+******************************************************************************/
+int ws_recv(int fd, iobuffer *iobuf, ws_message *msg, int timeout)
+{
+    unsigned char header[2], ext[8], mask[4], control[125];
+    unsigned long long plen;
+    unsigned char *dst;
+    int opcode, fin, i;
+    size_t j;
+
+    if(!msg->pending) {
+        msg->opcode = -1;
+        msg->len = 0;
+    }
+
+    for(;;) {
+        if(_read(fd, iobuf, header, 2, timeout) != 2)
+            return -1;
+
+        fin = header[0] & 0x80;
+        opcode = header[0] & 0x0F;
+        plen = header[1] & 0x7F;
+
+        /* clients must mask what they send */
+        if(!(header[1] & 0x80)) {
+            DBG("unmasked websocket frame\n");
+            ws_close(fd, WS_CLOSE_PROTOCOL);
+            return -1;
+        }
+
+        if(plen == 126) {
+            if(_read(fd, iobuf, ext, 2, timeout) != 2)
+                return -1;
+            plen = ext[0] << 8 | ext[1];
+        } else if(plen == 127) {
+            if(_read(fd, iobuf, ext, 8, timeout) != 8)
+                return -1;
+            /* the most significant bit of a 64 bit length must be 0 */
+            if(ext[0] & 0x80) {
+                ws_close(fd, WS_CLOSE_PROTOCOL);
+                return -1;
+            }
+            for(plen = 0, i = 0; i < 8; i++)
+                plen = plen << 8 | ext[i];
+        }
+
+        if(_read(fd, iobuf, mask, 4, timeout) != 4)
+            return -1;
+
+        if(opcode & 0x8) {
+            /* control frames are short, unfragmented and may arrive between fragments */
+            if(!fin || plen > sizeof(control)) {
+                ws_close(fd, WS_CLOSE_PROTOCOL);
+                return -1;
+            }
+            if(plen > 0 && _read(fd, iobuf, control, plen, timeout) != plen)
+                return -1;
+            for(j = 0; j < plen; j++)
+                control[j] ^= mask[j % 4];
+
+            if(opcode == WS_OP_PING)
+                return (ws_send(fd, WS_OP_PONG, control, plen, NULL, 0) < 0) ? -1 : 1;
+            if(opcode != WS_OP_CLOSE)
+                return 1;
+
+            msg->pending = 0;
+            msg->opcode = opcode;
+            msg->len = plen;
+            memcpy(msg->data, control, plen);
+            msg->data[plen] = '\0';
+            return 0;
+        }
+
+        /* a continuation needs a started message and a new message none */
+        if((opcode == WS_OP_CONTINUATION) != (msg->opcode != -1)) {
+            ws_close(fd, WS_CLOSE_PROTOCOL);
+            return -1;
+        }
+        /* msg->len is at most WS_MAX_MESSAGE, the subtraction cannot wrap as the sum could */
+        if(plen > WS_MAX_MESSAGE - msg->len) {
+            ws_close(fd, WS_CLOSE_TOO_BIG);
+            return -1;
+        }
+        if(opcode != WS_OP_CONTINUATION)
+            msg->opcode = opcode;
+
+        dst = (unsigned char *)msg->data + msg->len;
+        if(plen > 0 && _read(fd, iobuf, dst, plen, timeout) != plen)
+            return -1;
+        for(j = 0; j < plen; j++)
+            dst[j] ^= mask[j % 4];
+        msg->len += plen;
+        msg->data[msg->len] = '\0';
+
+        msg->pending = !fin;
+        if(fin)
+            return 0;
+    }
+}
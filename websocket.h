@@ -0,0 +1,68 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+
+/*
+ * Minimal WebSocket (RFC 6455) server side: the handshake, unfragmented
+ * messages to the client and reassembly of the small masked messages a
+ * client sends. This header needs httpd.h.
+ */
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT         0x1
+#define WS_OP_BINARY       0x2
+#define WS_OP_CLOSE        0x8
+#define WS_OP_PING         0x9
+#define WS_OP_PONG         0xA
+
+/* close status codes */
+#define WS_CLOSE_NORMAL    1000
+#define WS_CLOSE_PROTOCOL  1002
+#define WS_CLOSE_TOO_BIG   1009
+
+/* an idle client gets pinged, it is dropped after two intervals of silence */
+#define WS_PING_INTERVAL 15
+
+/* milliseconds a stream waits for a frame before it looks for client messages */
+#define WS_POLL_MS 100
+
+/* clients only send commands, longer messages close the connection */
+#define WS_MAX_MESSAGE 256
+
+/* message of the client, it must be zeroed before the first ws_recv() */
+typedef struct {
+    int opcode;
+    int pending;                    /* fragments of the message are missing */
+    size_t len;
+    char data[WS_MAX_MESSAGE + 1];  /* always zero terminated */
+} ws_message;
+
+void ws_accept_key(const char *key, char *accept);
+int ws_send(int fd, int opcode, const void *head, size_t head_len, const void *data, size_t len);
+int ws_close(int fd, int status);
+int ws_recv(int fd, iobuffer *iobuf, ws_message *msg, int timeout);
+
+#endif
@@ -0,0 +1,603 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+
+#include "uvcstreamer.h"
+#include "utils.h"
+#include "httpd.h"
+#include "worker.h"
+
+/* requests a worker sends to the capture process */
+typedef enum {
+    PROXY_COMMAND,
+    PROXY_INPUT_JSON,
+} proxy_type;
+
+typedef struct {
+    proxy_type type;
+    int plugin;
+    unsigned int control_id;
+    unsigned int group;
+    int value;
+} proxy_request;
+
+/* the answer, followed by len bytes of data */
+typedef struct {
+    int result;
+    int len;
+} proxy_reply;
+
+typedef struct {
+    pid_t pid;          /* 0 if the worker is not running, -1 while it gets forked */
+    int sd;             /* capture process end of the command socket */
+    time_t started;
+} worker;
+
+/*
+ * messages between the capture process and the spawner: a request to
+ * start worker n carries the worker end of its command socket, the
+ * spawner answers with the process id and reports the end of a worker
+ */
+typedef struct {
+    int n;              /* number of the worker */
+    int started;        /* 1 if the worker was forked, 0 if it ended */
+    pid_t pid;          /* -1 if the fork failed */
+    int status;         /* waitpid() status of an ended worker */
+} spawn_message;
+
+extern struct _globals global;
+static globals *pglobal = &global;
+
+/* capture process */
+static worker workers[MAX_WORKERS];
+static int worker_count = 0;
+static int spawner_sd = -1;
+static pid_t spawner_pid = 0;
+
+/* spawner process */
+static volatile sig_atomic_t spawner_stop = 0;
+
+/* worker process, one request at a time uses the command socket */
+static int command_sd = -1;
+static pthread_mutex_t command_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: reads or writes exactly len bytes
+Input Value.: * fd..: socket
+              * buf.: data
+              * len.: number of bytes
+Return Value: 0 on success, -1 on error or end of file
+******************************************************************************/
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t rc;
+
+    while(len > 0) {
+        if((rc = read(fd, buf, len)) <= 0) {
+            if(rc < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (char *)buf + rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    ssize_t rc;
+
+    while(len > 0) {
+        if((rc = write(fd, buf, len)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (const char *)buf + rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: answers the requests of one worker process in the capture
+              process, the thread ends when the worker dies
+Input Value.: capture process end of the command socket
+Return Value: always NULL
+******************************************************************************/
+static void *proxy_thread(void *arg)
+{
+    int sd = (int)(long)arg;
+    proxy_request rq;
+    proxy_reply rp;
+    json_doc *doc;
+
+    while(read_full(sd, &rq, sizeof(rq)) == 0) {
+        doc = NULL;
+        rp.result = -1;
+        rp.len = 0;
+
+        if(rq.plugin >= 0 && rq.plugin < pglobal->incnt) {
+            switch(rq.type) {
+            case PROXY_COMMAND:
+                rp.result = pglobal->in[rq.plugin].cmd(rq.plugin, rq.control_id, rq.group, rq.value);
+                break;
+            case PROXY_INPUT_JSON:
+                if((doc = httpd_input_json(rq.plugin)) != NULL) {
+                    rp.result = 0;
+                    rp.len = doc->len;
+                }
+                break;
+            }
+        }
+
+        rp.result = (write_full(sd, &rp, sizeof(rp)) < 0 ||
+                     (doc != NULL && write_full(sd, doc->data, doc->len) < 0)) ? -1 : 0;
+        if(doc != NULL)
+            httpd_put_json(doc);
+        if(rp.result < 0)
+            break;
+    }
+
+    close(sd);
+    DBG("command socket of a worker closed\n");
+    return NULL;
+}
+
+/******************************************************************************
+Description.: sends a request to the capture process and waits for the answer
+Input Value.: * rq..: the request
+              * doc.: stores the data of the answer as JSON document, may be
+                      NULL if no data is expected
+Return Value: result of the request, -1 if the capture process is not reachable
+******************************************************************************/
+static int proxy_request_send(proxy_request *rq, json_doc **doc)
+{
+    proxy_reply rp;
+    json_doc *d = NULL;
+
+    pthread_mutex_lock(&command_mutex);
+    if(write_full(command_sd, rq, sizeof(*rq)) < 0 || read_full(command_sd, &rp, sizeof(rp)) < 0) {
+        pthread_mutex_unlock(&command_mutex);
+        return -1;
+    }
+
+    if(rp.len > 0) {
+        /* the data has to be read in any case, the socket carries the next answer afterwards */
+        d = mem_malloc(sizeof(json_doc) + rp.len);
+        if(d == NULL || read_full(command_sd, d->data, rp.len) < 0) {
+            mem_free(d);
+            pthread_mutex_unlock(&command_mutex);
+            return -1;
+        }
+        d->refs = 1;
+        d->version = 0;
+        d->len = rp.len;
+    }
+    pthread_mutex_unlock(&command_mutex);
+
+    if(doc != NULL)
+        *doc = d;
+    else
+        mem_free(d);
+
+    return rp.result;
+}
+
+/******************************************************************************
+Description.: replaces the command function of the input plugins in worker
+              processes, the camera is controlled by the capture process
+Input Value.: same as the cmd function of the input plugins
+Return Value: result of the command
+******************************************************************************/
+int worker_cmd(int plugin, unsigned int control_id, unsigned int group, int value)
+{
+    proxy_request rq = { PROXY_COMMAND, plugin, control_id, group, value };
+
+    return proxy_request_send(&rq, NULL);
+}
+
+/******************************************************************************
+Description.: fetches the input plugin descriptor from the capture process,
+              the controls and their values live there
+Input Value.: number of the input plugin
+Return Value: the document with one reference or NULL
+******************************************************************************/
+json_doc *worker_input_json(int plugin)
+{
+    proxy_request rq = { PROXY_INPUT_JSON, plugin, 0, 0, 0 };
+    json_doc *doc = NULL;
+
+    if(proxy_request_send(&rq, &doc) < 0) {
+        mem_free(doc);
+        return NULL;
+    }
+
+    return doc;
+}
+
+/******************************************************************************
+Description.: runs a freshly forked worker process, it serves clients on the
+              inherited listening sockets until the capture process ends it
+Input Value.: * n......: number of the worker
+              * sd.....: worker end of the command socket
+              * parent.: process id of the spawner
+Return Value: does not return
+******************************************************************************/
+static void worker_main(int n, int sd, pid_t parent)
+{
+    int i;
+
+    frame_owner = n + 1;
+    command_sd = sd;
+
+    for(i = 0; i < MAX_WORKERS; i++) {
+        if(workers[i].sd >= 0)
+            close(workers[i].sd);
+    }
+
+    /* Ctrl-C reaches the whole process group, the capture process ends the workers */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    /* do not outlive the spawner, which does not outlive the capture process */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if(getppid() != parent)
+        _exit(EXIT_SUCCESS);
+
+    for(i = 0; i < pglobal->incnt; i++)
+        pglobal->in[i].cmd = worker_cmd;
+
+    httpd_run();
+
+    for(;;)
+        pause();
+}
+
+/******************************************************************************
+Description.: sends a message over the spawner socket, optionally with a
+              file descriptor
+Input Value.: * sd.: the spawner socket
+              * m..: the message
+              * fd.: descriptor to pass along, -1 for none
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+static int send_message(int sd, spawn_message *m, int fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { m, sizeof(*m) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if(fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return (sendmsg(sd, &msg, MSG_NOSIGNAL) == sizeof(*m)) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: receives a message from the spawner socket
+Input Value.: * sd...: the spawner socket
+              * m....: stores the message
+              * fd...: stores the passed descriptor or -1, may be NULL
+              * flags: flags of recvmsg(), e.g. MSG_DONTWAIT
+Return Value: 0 on success, -1 on error, end of file or if nothing is there
+******************************************************************************/
+static int receive_message(int sd, spawn_message *m, int *fd, int flags)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { m, sizeof(*m) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int passed = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(sd, &msg, flags) != sizeof(*m))
+        return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+
+    if(fd != NULL)
+        *fd = passed;
+    else if(passed >= 0)
+        close(passed);
+
+    return 0;
+}
+
+static void spawner_signal(int signum)
+{
+    if(signum == SIGTERM)
+        spawner_stop = 1;
+}
+
+/******************************************************************************
+Description.: runs the spawner, a process forked before the capture process
+              starts any thread. It forks the workers when the capture
+              process asks for them, so a replacement worker never inherits
+              a lock another thread held at the time of the fork. It reports
+              the workers that ended and takes them down when it stops.
+Input Value.: * sd.....: spawner end of the spawner socket
+              * parent.: process id of the capture process
+Return Value: does not return
+******************************************************************************/
+static void spawner_main(int sd, pid_t parent)
+{
+    struct pollfd pfd = { .fd = sd, .events = POLLIN };
+    pid_t pid, self = getpid();
+    spawn_message m;
+    int fd, status, i;
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, spawner_signal);
+    /* an ended worker interrupts the poll */
+    signal(SIGCHLD, spawner_signal);
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if(getppid() != parent)
+        _exit(EXIT_SUCCESS);
+
+    while(!spawner_stop) {
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for(i = 0; i < MAX_WORKERS && workers[i].pid != pid; i++);
+            if(i == MAX_WORKERS)
+                continue;
+            workers[i].pid = 0;
+
+            m.n = i;
+            m.started = 0;
+            m.pid = pid;
+            m.status = status;
+            send_message(sd, &m, -1);
+        }
+
+        if(poll(&pfd, 1, 1000) <= 0)
+            continue;
+        /* the capture process is gone */
+        if(receive_message(sd, &m, &fd, 0) < 0)
+            break;
+        if(m.n < 0 || m.n >= MAX_WORKERS || fd < 0) {
+            if(fd >= 0)
+                close(fd);
+            continue;
+        }
+
+        if((pid = fork()) == 0) {
+            close(sd);
+            worker_main(m.n, fd, self);
+        }
+        close(fd);
+        if(pid < 0)
+            perror("fork");
+        workers[m.n].pid = pid;
+
+        m.started = 1;
+        m.pid = pid;
+        m.status = 0;
+        send_message(sd, &m, -1);
+    }
+
+    for(i = 0; i < MAX_WORKERS; i++) {
+        if(workers[i].pid > 0)
+            kill(workers[i].pid, SIGTERM);
+    }
+    for(i = 0; i < MAX_WORKERS; i++) {
+        if(workers[i].pid > 0)
+            waitpid(workers[i].pid, NULL, 0);
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/******************************************************************************
+Description.: asks the spawner to fork one worker process, the command
+              thread of the worker starts right away
+Input Value.: number of the worker
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+static int start_worker(int n)
+{
+    spawn_message m = { n, 0, 0, 0 };
+    pthread_t proxy;
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    if(send_message(spawner_sd, &m, sv[1]) < 0) {
+        OPRINT("could not ask the spawner for worker #%02d\n", n);
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    /* the spawner reports the process id, a failed fork closes the socket */
+    close(sv[1]);
+    workers[n].pid = -1;
+    workers[n].sd = sv[0];
+    workers[n].started = time(NULL);
+
+    if(pthread_create(&proxy, NULL, proxy_thread, (void *)(long)sv[0]) != 0) {
+        OPRINT("could not start the command thread of worker #%02d\n", n);
+    } else {
+        pthread_detach(proxy);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: forks the spawner, which forks the worker processes. The frame
+              rings and the listening sockets must exist already and no
+              thread may run yet, the workers inherit this state.
+Input Value.: number of workers
+Return Value: 0 on success, -1 if a worker could not be started
+******************************************************************************/
+int workers_start(int count)
+{
+    pid_t parent = getpid();
+    int i, rc = 0, sv[2];
+
+    worker_count = MIN(count, MAX_WORKERS);
+    for(i = 0; i < MAX_WORKERS; i++)
+        workers[i].sd = -1;
+
+    /* datagrams keep the messages apart */
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    if((spawner_pid = fork()) < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if(spawner_pid == 0) {
+        close(sv[0]);
+        spawner_main(sv[1], parent);
+    }
+
+    close(sv[1]);
+    spawner_sd = sv[0];
+
+    for(i = 0; i < worker_count; i++) {
+        if(start_worker(i) < 0)
+            rc = -1;
+    }
+
+    OPRINT("worker processes..: %d\n", worker_count);
+    return rc;
+}
+
+/******************************************************************************
+Description.: handles the reports of the spawner and restarts the workers
+              that died, called periodically by the capture process. Pins
+              and demand a dead worker left in the rings are dropped first,
+              otherwise the slots stay pinned.
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void workers_reap(void)
+{
+    spawn_message m;
+    int i, k;
+
+    while(receive_message(spawner_sd, &m, NULL, MSG_DONTWAIT) == 0) {
+        if(m.n < 0 || m.n >= worker_count)
+            continue;
+        i = m.n;
+
+        if(m.started) {
+            /* the command thread sees the closed socket of a failed fork */
+            workers[i].pid = (m.pid > 0) ? m.pid : 0;
+            continue;
+        }
+
+        if(WIFSIGNALED(m.status)) {
+            OPRINT("worker #%02d (pid %d) killed by signal %d\n", i, (int)m.pid, WTERMSIG(m.status));
+        } else {
+            OPRINT("worker #%02d (pid %d) exited with %d\n", i, (int)m.pid, WEXITSTATUS(m.status));
+        }
+        workers[i].pid = 0;
+        workers[i].sd = -1; /* closed by its command thread */
+
+        for(k = 0; k < pglobal->incnt; k++) {
+            if(pglobal->in[k].ring != NULL)
+                frame_owner_reset(pglobal->in[k].ring, i + 1);
+            if(pglobal->in[k].history != NULL)
+                timeshift_owner_reset(pglobal->in[k].history, i + 1);
+        }
+    }
+
+    for(i = 0; i < worker_count; i++) {
+        /* a worker that dies right after its start is not restarted in a tight loop */
+        if(workers[i].pid == 0 && time(NULL) != workers[i].started)
+            start_worker(i);
+    }
+}
+
+/******************************************************************************
+Description.: ends all workers and waits for them, the spawner takes them
+              down before it exits
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void workers_stop(void)
+{
+    int i;
+
+    if(spawner_pid > 0) {
+        kill(spawner_pid, SIGTERM);
+        waitpid(spawner_pid, NULL, 0);
+        spawner_pid = 0;
+    }
+
+    for(i = 0; i < worker_count; i++)
+        workers[i].pid = 0;
+}
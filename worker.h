@@ -0,0 +1,46 @@
+/*******************************************************************************
+#                                                                              #
+#      uvcstreamer allows to stream JPG frames from an UVC video camera        #
+#      through the HTTP-connection                                             #
+#                                                                              #
+#      This software based on the mjpeg-streamer                               #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+/*
+ * With worker processes the capture process only grabs frames and HTTP
+ * worker processes serve the clients from the shared frame ring. They are
+ * forked by a spawner process, which is forked before any thread starts,
+ * so a worker never inherits a lock held by a thread of the capture
+ * process. A crashed worker does not stop the capture, it gets restarted.
+ * This header needs httpd.h.
+ */
+#define MAX_WORKERS (FRAME_MAX_OWNERS - 1)
+
+/* capture process */
+int workers_start(int count);
+void workers_reap(void);
+void workers_stop(void);
+
+/* worker processes, they ask the capture process for these */
+int worker_cmd(int plugin, unsigned int control_id, unsigned int group, int value);
+json_doc *worker_input_json(int plugin);
+
+#endif